@@ -0,0 +1,70 @@
+/**
+ * @file batch.h
+ * @brief Running many ILOC programs concurrently in the simulator
+ *
+ * Each job runs on its own simulated machine with its own captured output, so
+ * a runtime error in one program does not affect the others.
+ */
+#ifndef __H_BATCH
+#define __H_BATCH
+
+#include "common.h"
+#include "token.h"
+#include "iloc.h"
+
+/**
+ * @brief Maximum number of worker threads used by @ref run_batch
+ */
+#define MAX_BATCH_THREADS 64
+
+/**
+ * @brief A single program to run as part of a batch
+ */
+typedef struct BatchJob
+{
+    /**
+     * @brief ILOC program to run (not modified)
+     */
+    InsnList* program;
+
+    /**
+     * @brief Simulator options (the output field is ignored; see @ref output)
+     */
+    SimulatorOptions options;
+
+    /**
+     * @brief Outcome of the run (filled in by @ref run_batch)
+     */
+    SimulatorResult result;
+
+    /**
+     * @brief Captured program output (NUL-terminated; filled in by @ref run_batch
+     * and deallocated by @ref BatchJob_free_output)
+     */
+    char* output;
+
+} BatchJob;
+
+/**
+ * @brief Run a batch of ILOC programs across a pool of worker threads
+ *
+ * Jobs are claimed in order by the worker threads and the calling thread, and
+ * each one's result and output are stored in the job. A malformed program
+ * fails only its own job, with an error status (see
+ * @ref run_simulator_with_result). Jobs should not share profiles or trace
+ * streams.
+ *
+ * @param jobs Array of jobs
+ * @param num_jobs Number of jobs
+ * @param num_threads Number of threads to use (0 for one per online processor)
+ */
+void run_batch (BatchJob* jobs, int num_jobs, int num_threads);
+
+/**
+ * @brief Deallocate the captured output of a job
+ *
+ * @param job Job run by @ref run_batch
+ */
+void BatchJob_free_output (BatchJob* job);
+
+#endif
@@ -21,24 +21,24 @@
 #define WORD_SIZE 8
 
 /**
- * @brief Machine memory size (64K)
+ * @brief Default machine memory size (64K)
  */
 #define MEM_SIZE  65536
 
 /**
- * @brief Maximum number of virtual registers
+ * @brief Largest supported machine memory size (1G)
  */
-#define MAX_VIRTUAL_REGS 2048
+#define MAX_MEM_SIZE  0x40000000
 
 /**
- * @brief Maximum number of physical registers
+ * @brief Size of the pages that back simulated memory (see @ref ILOCMemory)
  */
-#define MAX_PHYSICAL_REGS 32
+#define MEM_PAGE_SIZE 4096
 
 /**
- * @brief Maximum number of instructions
+ * @brief Maximum number of physical registers
  */
-#define MAX_INSTRUCTIONS 2048
+#define MAX_PHYSICAL_REGS 32
 
 /**
  * @brief Base pointer offset for parameters
@@ -57,6 +57,44 @@
  */
 #define STATIC_VAR_OFFSET 0x100
 
+/**
+ * @brief Machine word type (and printf format) used by the simulator
+ */
+#if WORD_SIZE == 4
+    typedef int32_t word_t;
+    #define PRIW "%" PRId32
+    #define WORD_MIN INT32_MIN
+#else
+    typedef int64_t word_t;
+    #define PRIW "%" PRId64
+    #define WORD_MIN INT64_MIN
+#endif
+
+/**
+ * @brief Machine byte type used by the simulator
+ */
+typedef uint8_t byte_t;
+
+/**
+ * @brief Initial value of all registers (helps find code gen bugs)
+ */
+#define UNINIT_REG       (-9999999)
+
+/*
+ * Simulator register file layout: the special registers come first, followed
+ * by the physical and then the virtual registers. Shared by the simulator, the
+ * native (JIT) mode, and execution traces. The register file is sized for each
+ * program from its highest virtual register ID (see @ref InsnList_max_id).
+ */
+
+#define SP_SLOT         0                                   /**< @brief Slot of SP */
+#define BP_SLOT         1                                   /**< @brief Slot of BP */
+#define RET_SLOT        2                                   /**< @brief Slot of RET */
+#define PR_SLOT(N)      (3 + (N))                           /**< @brief Slot of physical register N */
+#define VR_SLOT(N)      (3 + MAX_PHYSICAL_REGS + (N))       /**< @brief Slot of virtual register N */
+#define NUM_REG_SLOTS(V) VR_SLOT(V)                         /**< @brief Register file size for V virtual registers */
+#define NO_SLOT         (-1)                                /**< @brief "Slot" of operands that are not registers */
+
 /**
  * @brief Operand type
  */
@@ -142,6 +180,58 @@ Operand int_const (long integer);
  */
 Operand str_const (const char* string);
 
+/**
+ * @brief ID generation state for virtual registers and jump labels
+ * 
+ * @ref virtual_register and @ref anonymous_label draw their IDs from the
+ * calling thread's current context. Each thread starts with its own default
+ * context; installing a freshly-initialized one restarts numbering at zero
+ * (e.g., to compile a second program in the same process).
+ */
+typedef struct ILOCContext
+{
+    /**
+     * @brief Next virtual register ID to hand out
+     */
+    int next_register_id;
+
+    /**
+     * @brief Next jump label ID to hand out
+     */
+    int next_label_id;
+
+} ILOCContext;
+
+/**
+ * @brief Reset a context so that numbering starts from zero
+ * 
+ * @param context Context to initialize
+ */
+void ILOCContext_init (ILOCContext* context);
+
+/**
+ * @brief Look up the calling thread's current context
+ */
+ILOCContext* ILOCContext_get_current (void);
+
+/**
+ * @brief Install a context for the calling thread
+ * 
+ * @param context Context to use for subsequent IDs (or @c NULL to revert to
+ * the thread's default context)
+ */
+void ILOCContext_set_current (ILOCContext* context);
+
+/**
+ * @brief Create a new virtual register operand using the next ID from a context
+ */
+Operand ILOCContext_virtual_register (ILOCContext* context);
+
+/**
+ * @brief Create a new jump label operand using the next ID from a context
+ */
+Operand ILOCContext_anonymous_label (ILOCContext* context);
+
 /**
  * @brief Print an operand
  * 
@@ -360,6 +450,18 @@ DECL_LIST_TYPE (Insn, ILOCInsn*)
  */
 void InsnList_print (InsnList* list, FILE* output);
 
+/**
+ * @brief Find the largest ID of a given operand type in an instruction list
+ *
+ * Used to size per-program tables (e.g., the simulator's register file and
+ * jump target index).
+ *
+ * @param list List of instructions
+ * @param type Operand type (e.g., @ref VIRTUAL_REG or @ref JUMP_LABEL)
+ * @returns Largest ID found, or -1 if no operand has that type
+ */
+int InsnList_max_id (InsnList* list, OperandType type);
+
 /**
  * @brief Create a new AST visitor that allocates addresses for all variable symbols
  *
@@ -427,15 +529,436 @@ void ASTNode_set_temp_reg (ASTNode* node, Operand reg);
  */
 Operand ASTNode_get_temp_reg (ASTNode* node);
 
+/**
+ * @brief Sparse machine memory (address space)
+ *
+ * Memory is divided into @ref MEM_PAGE_SIZE pages that are only allocated when
+ * first written; unwritten memory reads as zero. The footprint therefore
+ * follows the addresses a program actually uses rather than the size of its
+ * address space. Once write tracking is enabled (see @ref ILOCMemory_restore),
+ * memory also remembers which pages have been written since it was last
+ * copied or restored.
+ */
+typedef struct ILOCMemory
+{
+    /**
+     * @brief Size of the address space in bytes
+     */
+    word_t size;
+
+    /**
+     * @brief Number of pages in the address space
+     */
+    word_t num_pages;
+
+    /**
+     * @brief Page table (NULL for pages that have never been written)
+     */
+    byte_t** pages;
+
+    /**
+     * @brief Per-page flags for pages written since tracking was last reset
+     * (NULL if writes are not tracked)
+     */
+    bool* dirty;
+
+    /**
+     * @brief Indices of dirty pages (in the order they were first written)
+     */
+    word_t* dirty_pages;
+
+    /**
+     * @brief Number of dirty pages
+     */
+    word_t num_dirty;
+
+} ILOCMemory;
+
+/**
+ * @brief Check that an address space size is supported
+ *
+ * Valid sizes are multiples of @ref WORD_SIZE larger than
+ * @ref STATIC_VAR_OFFSET and no larger than @ref MAX_MEM_SIZE. Aborts with an
+ * error message otherwise.
+ *
+ * @param size Size in bytes
+ */
+void assert_valid_mem_size (word_t size);
+
+/**
+ * @brief Allocate an empty address space
+ *
+ * @param size Size in bytes (see @ref assert_valid_mem_size)
+ * @returns Pointer to new memory
+ */
+ILOCMemory* ILOCMemory_new (word_t size);
+
+/**
+ * @brief Read a word from memory (the address must be in range)
+ *
+ * @param mem Memory to read
+ * @param address Address of the word's first byte
+ * @returns Word at the given address
+ */
+word_t ILOCMemory_get (ILOCMemory* mem, word_t address);
+
+/**
+ * @brief Write a word to memory (the address must be in range)
+ *
+ * @param mem Memory to modify
+ * @param address Address of the word's first byte
+ * @param value New value
+ */
+void ILOCMemory_set (ILOCMemory* mem, word_t address, word_t value);
+
+/**
+ * @brief Check whether the page containing an address has ever been written
+ *
+ * @param mem Memory to check
+ * @param address Address to look up
+ * @returns True if and only if the page is allocated
+ */
+bool ILOCMemory_is_mapped (ILOCMemory* mem, word_t address);
+
+/**
+ * @brief Copy an address space and start tracking writes to the original
+ *
+ * Only allocated pages are copied. Afterwards, every page written in @p mem
+ * is recorded as dirty so that @ref ILOCMemory_restore can undo the writes
+ * cheaply.
+ *
+ * @param mem Memory to copy
+ * @returns Pointer to new memory with the same contents
+ */
+ILOCMemory* ILOCMemory_copy (ILOCMemory* mem);
+
+/**
+ * @brief Reset memory to the contents of a copy
+ *
+ * If @p only_dirty is set, only the pages written since the last copy or
+ * restore are reset, so the cost is proportional to the memory touched
+ * since then; this is only correct if @p saved is that copy. Otherwise every
+ * page is compared. Either way, write tracking starts over afterwards.
+ *
+ * @param mem Memory to reset
+ * @param saved Copy made by @ref ILOCMemory_copy (same size as @p mem)
+ * @param only_dirty Whether to reset only the dirty pages
+ */
+void ILOCMemory_restore (ILOCMemory* mem, ILOCMemory* saved, bool only_dirty);
+
+/**
+ * @brief Deallocate memory and all of its pages
+ *
+ * @param mem Memory to deallocate
+ */
+void ILOCMemory_free (ILOCMemory* mem);
+
+/**
+ * @brief Check that an ILOC program is well-formed
+ * 
+ * Verifies the operand forms of every instruction, that register IDs are in
+ * range, that every jump and function label is defined exactly once, and that
+ * every call target (including main) resolves to a function. Aborts with an
+ * error message describing the first problem found.
+ * 
+ * @param program List of ILOC instructions
+ */
+void verify_program (InsnList* program);
+
+/**
+ * @brief Check that an ILOC program is well-formed without aborting
+ *
+ * Performs the same checks as @ref verify_program, but describes the first
+ * problem found in @p message instead of printing it and exiting.
+ *
+ * @param program List of ILOC instructions
+ * @param message Destination for the description of the problem (at least
+ * @ref MAX_ERROR_LEN characters; empty if the program is well-formed)
+ * @returns True if and only if the program is well-formed
+ */
+bool check_program (InsnList* program, char* message);
+
+/**
+ * @brief Look up the register file slot of an operand
+ *
+ * @param op Operand
+ * @returns Slot of the register (see @ref SP_SLOT), or @ref NO_SLOT if the
+ * operand is not a register
+ */
+int ILOCMachine_reg_slot (Operand op);
+
+/**
+ * @brief Hash table mapping function names to instruction indices (opaque; see
+ * iloc.c)
+ */
+typedef struct CallTargetTable CallTargetTable;
+
+/**
+ * @brief Allocate an empty call target table
+ *
+ * @returns Pointer to new table
+ */
+CallTargetTable* CallTargetTable_new (void);
+
+/**
+ * @brief Add a function to a call target table (aborts if it is already there)
+ *
+ * @param table Table to modify
+ * @param name Function name
+ * @param index Index of the function's label "instruction"
+ */
+void CallTargetTable_add_new (CallTargetTable* table, const char* name, int index);
+
+/**
+ * @brief Look up a function in a call target table (aborts if it is not there)
+ *
+ * @param table Table to search
+ * @param name Function name
+ * @returns Index of the function's label "instruction"
+ */
+int CallTargetTable_find (CallTargetTable* table, const char* name);
+
+/**
+ * @brief Deallocate a call target table
+ *
+ * @param table Table to deallocate
+ */
+void CallTargetTable_free (CallTargetTable* table);
+
 /**
  * @brief Run ILOC simulator on an ILOC program
  * 
- * If tracing is enabled, the simulator will print the machine state before
- * executing each instruction.
+ * The program is checked with @ref verify_program once before it runs. If
+ * tracing is enabled, the simulator will also print the machine state and
+ * re-validate each instruction before executing it.
  * 
  * @param program List of ILOC instructions
  * @param print_trace Enable/disable debug tracing
  */
 int run_simulator (InsnList* program, bool print_trace);
 
+struct ILOCProfile;
+struct TraceWriter;
+struct ProgramOutput;
+
+/**
+ * @brief Optional simulator features
+ * 
+ * Zero-initialize and set the desired fields; see
+ * @ref run_simulator_with_options.
+ */
+typedef struct SimulatorOptions
+{
+    /**
+     * @brief Print the machine state and re-validate before each instruction
+     */
+    bool print_trace;
+
+    /**
+     * @brief Profile to record executed instructions in (see profile.h), or NULL
+     */
+    struct ILOCProfile* profile;
+
+    /**
+     * @brief Writer for a binary execution trace (see trace.h), or NULL
+     */
+    struct TraceWriter* trace;
+
+    /**
+     * @brief Destination of program output (see output.h), or NULL for stdout
+     *
+     * Output is buffered, and the buffer is flushed before the simulator prints
+     * anything itself (errors, warnings, and debug traces) and when the program
+     * finishes.
+     */
+    struct ProgramOutput* output;
+
+    /**
+     * @brief Skip the checks for reads of uninitialized registers
+     *
+     * Verified programs cannot access registers out of range, so with this set
+     * the simulator accesses registers with no per-access checks at all. The
+     * default (checked) mode warns about every read of a register that has not
+     * been written yet, which helps find code generation bugs.
+     */
+    bool unchecked;
+
+    /**
+     * @brief Size of the address space in bytes (zero for @ref MEM_SIZE)
+     *
+     * Global variables start at @ref STATIC_VAR_OFFSET and the stack grows down
+     * from the end of the address space, so a larger address space allows for
+     * larger global arrays and deeper recursion.
+     */
+    word_t mem_size;
+
+} SimulatorOptions;
+
+/**
+ * @brief Run ILOC simulator on an ILOC program with optional features
+ * 
+ * Behaves like @ref run_simulator, with tracing, profiling, and binary
+ * execution traces enabled as given in the options.
+ * 
+ * @param program List of ILOC instructions
+ * @param options Simulator options
+ */
+int run_simulator_with_options (InsnList* program, SimulatorOptions* options);
+
+/**
+ * @brief How a simulator run ended
+ */
+typedef enum SimulatorStatus
+{
+    SIM_OK,         /**< @brief main() returned */
+    SIM_ERROR,      /**< @brief Runtime error (e.g., invalid address or division by zero) or malformed program */
+    SIM_TIMEOUT     /**< @brief Too many instructions executed (probably an infinite loop) */
+} SimulatorStatus;
+
+/**
+ * @brief Outcome of a simulator run
+ */
+typedef struct SimulatorResult
+{
+    /**
+     * @brief How the run ended
+     */
+    SimulatorStatus status;
+
+    /**
+     * @brief Value of the RET register when main() returned (if successful)
+     */
+    word_t return_value;
+
+    /**
+     * @brief Error message (if unsuccessful)
+     */
+    char message[MAX_ERROR_LEN];
+
+} SimulatorResult;
+
+/**
+ * @brief Simulated machine with a loaded program (opaque; see iloc.c)
+ *
+ * Creating a machine verifies and decodes the program once, so it is cheaper
+ * to run the same program many times on one machine (resetting it in between
+ * with @ref ILOCMachine_restore) than to call @ref run_simulator_with_result
+ * repeatedly.
+ */
+typedef struct ILOCMachine ILOCMachine;
+
+/**
+ * @brief Saved machine state (registers and memory; see @ref ILOCMachine_snapshot)
+ */
+typedef struct ILOCSnapshot ILOCSnapshot;
+
+/**
+ * @brief Create a machine and load a program into it
+ *
+ * Registers start uninitialized except for the stack pointer, and memory
+ * starts zeroed. Aborts with an error message if the program is malformed.
+ *
+ * @param program List of ILOC instructions (must outlive the machine)
+ * @param options Simulator options (copied; a NULL output means standard output)
+ * @returns Pointer to new machine
+ */
+ILOCMachine* ILOCMachine_new (InsnList* program, SimulatorOptions* options);
+
+/**
+ * @brief Run the loaded program from main() using the current machine state
+ *
+ * Runtime errors stop only this run and are described in the result (see
+ * @ref run_simulator_with_result). Program output is flushed before returning.
+ *
+ * @param machine Machine to run
+ * @param result Destination for the outcome of the run
+ * @returns True if and only if main() returned normally
+ */
+bool ILOCMachine_run (ILOCMachine* machine, SimulatorResult* result);
+
+/**
+ * @brief Look up a register's current value
+ *
+ * @param machine Machine to inspect
+ * @param reg Register operand (SP, BP, RET, or a virtual or physical register
+ * that appears in the program)
+ * @returns Register value
+ */
+word_t ILOCMachine_get_reg (ILOCMachine* machine, Operand reg);
+
+/**
+ * @brief Change a register's value (e.g., to set up a starting state)
+ *
+ * @param machine Machine to modify
+ * @param reg Register operand (see @ref ILOCMachine_get_reg)
+ * @param value New value
+ */
+void ILOCMachine_set_reg (ILOCMachine* machine, Operand reg, word_t value);
+
+/**
+ * @brief Access a machine's memory (e.g., to set up a starting state)
+ *
+ * @param machine Machine to inspect
+ * @returns Address space of the machine (owned by the machine)
+ */
+ILOCMemory* ILOCMachine_memory (ILOCMachine* machine);
+
+/**
+ * @brief Save the current registers and memory of a machine
+ *
+ * Copies the register file and every allocated memory page, then starts
+ * tracking memory writes so that restoring this snapshot later only has to
+ * reset the pages that were written in the meantime.
+ *
+ * @param machine Machine to save
+ * @returns Pointer to new snapshot
+ */
+ILOCSnapshot* ILOCMachine_snapshot (ILOCMachine* machine);
+
+/**
+ * @brief Reset a machine to a saved state
+ *
+ * Restoring the snapshot that was most recently taken or restored on the
+ * machine takes time proportional to the memory written since then. Any
+ * other snapshot of the same machine still works but compares every page.
+ *
+ * @param machine Machine to reset
+ * @param snapshot Snapshot taken from the same machine
+ */
+void ILOCMachine_restore (ILOCMachine* machine, ILOCSnapshot* snapshot);
+
+/**
+ * @brief Deallocate a snapshot
+ *
+ * @param snapshot Snapshot to deallocate
+ */
+void ILOCSnapshot_free (ILOCSnapshot* snapshot);
+
+/**
+ * @brief Deallocate a machine (and its output, if it created one)
+ *
+ * @param machine Machine to deallocate
+ */
+void ILOCMachine_free (ILOCMachine* machine);
+
+/**
+ * @brief Run ILOC simulator and report runtime errors instead of exiting
+ * 
+ * Behaves like @ref run_simulator_with_options, except that runtime errors and
+ * timeouts stop only this run: they are described in the result rather than
+ * printed, and the process keeps running. All machine state is local to the
+ * call, so separate programs can be run concurrently on different threads as
+ * long as each run has its own options (in particular, its own output).
+ * Malformed programs (see @ref check_program) are reported the same way, with
+ * an error status, before anything runs. Debug tracing always prints to
+ * standard output.
+ * 
+ * @param program List of ILOC instructions
+ * @param options Simulator options
+ * @param result Destination for the outcome of the run
+ * @returns True if and only if main() returned normally
+ */
+bool run_simulator_with_result (InsnList* program, SimulatorOptions* options,
+        SimulatorResult* result);
+
 #endif
@@ -0,0 +1,59 @@
+/**
+ * @file jit.h
+ * @brief Native x86-64 execution of ILOC programs
+ */
+#ifndef __H_JIT
+#define __H_JIT
+
+#include "common.h"
+#include "token.h"
+#include "iloc.h"
+
+/**
+ * @brief Check whether native execution is supported on this platform
+ *
+ * @returns True if and only if @ref run_jit compiles to native code (rather
+ * than falling back on the simulator)
+ */
+bool jit_available (void);
+
+/**
+ * @brief Run an ILOC program by translating it to native x86-64 code
+ *
+ * The program is verified with @ref verify_program and then translated into
+ * an executable buffer, one ILOC instruction at a time, using the same memory
+ * image layout and register values as the simulator. Return values, PRINT
+ * output, and runtime errors (invalid addresses, stack overflow, division by
+ * zero, timeouts) match @ref run_simulator in unchecked mode (see
+ * @ref SimulatorOptions): like "-u", native code never warns about reads from
+ * uninitialized registers, so its output differs from a checked simulation of
+ * a program that has such reads. On platforms without JIT support this simply
+ * simulates the program in unchecked mode.
+ *
+ * Only the address space size and output fields of the options are used;
+ * instrumentation is not supported in native mode.
+ *
+ * @param program List of ILOC instructions
+ * @param options Simulator options
+ * @returns Value of the RET register when main() returns
+ */
+int run_jit (InsnList* program, SimulatorOptions* options);
+
+/**
+ * @brief Run an ILOC program natively and report runtime errors instead of
+ * exiting
+ *
+ * Behaves like @ref run_jit, except that runtime errors and timeouts stop only
+ * this run and are described in the result (exactly as with
+ * @ref run_simulator_with_result). All state is local to the call, so separate
+ * programs can run concurrently as long as each run has its own output.
+ *
+ * @param program List of ILOC instructions
+ * @param options Simulator options
+ * @param result Destination for the outcome of the run
+ * @returns True if and only if main() returned normally
+ */
+bool run_jit_with_result (InsnList* program, SimulatorOptions* options,
+        SimulatorResult* result);
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ * @file output.h
+ * @brief Buffered output of simulated ILOC programs (PRINT instructions)
+ *
+ * Program output is collected in a large buffer and handed to a sink when the
+ * buffer fills up or is flushed. A sink is either a file stream, a growable
+ * in-memory string (for capturing output without a subprocess), or a callback.
+ */
+#ifndef __H_OUTPUT
+#define __H_OUTPUT
+
+#include "common.h"
+
+/**
+ * @brief Size of the output buffer in bytes
+ */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/**
+ * @brief Callback that receives flushed program output
+ *
+ * @param context Caller-supplied pointer passed to @ref ProgramOutput_new_callback
+ * @param data Output bytes (not NUL-terminated)
+ * @param length Number of bytes
+ */
+typedef void (*OutputCallback) (void* context, const char* data, size_t length);
+
+/**
+ * @brief Buffered program output and its sink
+ */
+typedef struct ProgramOutput
+{
+    /**
+     * @brief Pending output
+     */
+    char buffer[OUTPUT_BUFFER_SIZE];
+
+    /**
+     * @brief Number of pending bytes
+     */
+    size_t length;
+
+    /**
+     * @brief Destination stream (NULL if the sink is not a stream)
+     */
+    FILE* file;
+
+    /**
+     * @brief Destination callback (NULL if the sink is not a callback)
+     */
+    OutputCallback callback;
+
+    /**
+     * @brief Context pointer for @ref callback
+     */
+    void* context;
+
+    /**
+     * @brief Captured output (in-memory sinks only; NUL-terminated)
+     */
+    char* captured;
+
+    /**
+     * @brief Length of captured output
+     */
+    size_t captured_length;
+
+    /**
+     * @brief Capacity of captured output buffer
+     */
+    size_t captured_capacity;
+
+} ProgramOutput;
+
+/**
+ * @brief Create a buffered output that writes to a file stream
+ *
+ * @param file Destination stream (not closed by @ref ProgramOutput_free)
+ * @returns Pointer to new output
+ */
+ProgramOutput* ProgramOutput_new_file (FILE* file);
+
+/**
+ * @brief Create a buffered output that captures everything in memory
+ *
+ * @returns Pointer to new output (see @ref ProgramOutput_contents)
+ */
+ProgramOutput* ProgramOutput_new_memory (void);
+
+/**
+ * @brief Create a buffered output that passes flushed output to a callback
+ *
+ * @param callback Function to call with each flushed chunk
+ * @param context Pointer passed to every call
+ * @returns Pointer to new output
+ */
+ProgramOutput* ProgramOutput_new_callback (OutputCallback callback, void* context);
+
+/**
+ * @brief Append a string
+ *
+ * @param output Output to write to
+ * @param str NUL-terminated string
+ */
+void ProgramOutput_write_str (ProgramOutput* output, const char* str);
+
+/**
+ * @brief Append an integer in decimal
+ *
+ * @param output Output to write to
+ * @param value Value to format
+ */
+void ProgramOutput_write_int (ProgramOutput* output, int64_t value);
+
+/**
+ * @brief Pass all pending output to the sink
+ *
+ * @param output Output to flush
+ */
+void ProgramOutput_flush (ProgramOutput* output);
+
+/**
+ * @brief Retrieve the output captured by an in-memory output
+ *
+ * Flushes pending output first.
+ *
+ * @param output In-memory output
+ * @returns NUL-terminated captured output (owned by @p output), or NULL if the
+ * output is not an in-memory one
+ */
+const char* ProgramOutput_contents (ProgramOutput* output);
+
+/**
+ * @brief Flush and deallocate an output
+ *
+ * @param output Output to deallocate
+ */
+void ProgramOutput_free (ProgramOutput* output);
+
+#endif
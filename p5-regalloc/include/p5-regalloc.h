@@ -9,6 +9,63 @@
 #include "common.h"
 #include "iloc.h"
 
+/**
+ * @brief Register allocation statistics for a single function
+ */
+typedef struct RegAllocStats
+{
+    /**
+     * @brief Function name
+     */
+    char function[MAX_ID_LEN];
+
+    /**
+     * @brief Number of spill stores inserted (including spills at calls)
+     */
+    int num_spills;
+
+    /**
+     * @brief Number of reloads from the stack frame inserted
+     */
+    int num_reloads;
+
+    /**
+     * @brief Number of constants recomputed instead of reloaded
+     */
+    int num_remats;
+
+    /**
+     * @brief Number of spill stores inserted because a value was live across a call
+     */
+    int num_call_spills;
+
+    /**
+     * @brief Number of bytes added to the stack frame for spill slots
+     */
+    int frame_growth;
+
+    /**
+     * @brief Maximum number of simultaneously-live virtual registers
+     */
+    int max_pressure;
+
+    /**
+     * @brief Next function's statistics (if stored in a list)
+     */
+    struct RegAllocStats* next;
+
+} RegAllocStats;
+
+DECL_LIST_TYPE(RegAllocStats, RegAllocStats*)
+
+/**
+ * @brief Print allocation statistics as CSV (one header row, then one row per function)
+ * 
+ * @param stats List of per-function statistics
+ * @param output File stream to print to
+ */
+void RegAllocStatsList_print (RegAllocStatsList* stats, FILE* output);
+
 /**
  * @brief Allocate registers for an ILOC program
  * 
@@ -17,4 +74,27 @@
  */
 void allocate_registers (InsnList* list, int num_physical_registers);
 
+/**
+ * @brief Allocate registers for an ILOC program and report what it cost
+ * 
+ * @param list ILOC program as a list of instructions (the list is modified in place)
+ * @param num_physical_registers Maximum number of physical registers to be used
+ * @param stats List to which per-function statistics are appended in program
+ * order (may be @c NULL)
+ */
+void allocate_registers_with_stats (InsnList* list, int num_physical_registers,
+        RegAllocStatsList* stats);
+
+/**
+ * @brief Renumber virtual registers densely from zero within each function
+ * 
+ * Codegen hands out globally increasing register IDs; after this pass, the
+ * IDs used by each function are 0..N-1 (in order of first appearance), so
+ * per-register tables only need to be as large as the function. This is done
+ * automatically by @ref allocate_registers.
+ * 
+ * @param list ILOC program as a list of instructions (the list is modified in place)
+ */
+void renumber_virtual_registers (InsnList* list);
+
 #endif
@@ -0,0 +1,134 @@
+/**
+ * @file profile.h
+ * @brief Instruction-level profiling of simulated ILOC programs
+ */
+#ifndef __H_PROFILE
+#define __H_PROFILE
+
+#include "common.h"
+#include "token.h"
+#include "iloc.h"
+
+/**
+ * @brief Node in the calling context tree of a profiled run
+ */
+typedef struct CallNode
+{
+    /**
+     * @brief Function index (or -1 for the root)
+     */
+    int function;
+
+    /**
+     * @brief Number of instructions executed with exactly this call stack
+     */
+    long self;
+
+    /**
+     * @brief Calling context (NULL for the root)
+     */
+    struct CallNode* parent;
+
+    /**
+     * @brief First callee context
+     */
+    struct CallNode* child;
+
+    /**
+     * @brief Next context with the same parent
+     */
+    struct CallNode* sibling;
+
+} CallNode;
+
+/**
+ * @brief Execution profile of a single simulator run
+ *
+ * Created for a specific program with @ref ILOCProfile_new and filled in by
+ * passing it to @ref run_simulator_profiled. The simulator reports each
+ * executed instruction (by its position in the program list) and the profile
+ * reconstructs calls, returns, and loop back edges from that sequence.
+ */
+typedef struct ILOCProfile
+{
+    int num_insns;          /**< @brief Number of instructions in the program */
+    ILOCInsn** code;        /**< @brief Instructions indexed by position */
+    long* counts;           /**< @brief Execution count of each instruction */
+    long* back_edges;       /**< @brief Backward branches taken to each instruction */
+    int* function_of;       /**< @brief Function index of each instruction */
+
+    int num_functions;      /**< @brief Number of functions in the program */
+    int* function_label;    /**< @brief Label position of each function */
+    long* calls;            /**< @brief Number of calls to each function */
+    long* inclusive;        /**< @brief Instructions executed in each function and its callees */
+    long* exclusive;        /**< @brief Instructions executed in each function itself */
+    int* active;            /**< @brief Number of activations of each function on the stack */
+
+    int* stack_function;    /**< @brief Shadow call stack: function indices */
+    long* stack_start;      /**< @brief Shadow call stack: instruction total at entry */
+    int depth;              /**< @brief Shadow call stack depth */
+    int capacity;           /**< @brief Shadow call stack capacity */
+
+    CallNode* root;         /**< @brief Root of the calling context tree */
+    CallNode* context;      /**< @brief Current calling context */
+
+    long total;             /**< @brief Total instructions executed */
+    int prev;               /**< @brief Position of the previously executed instruction */
+
+} ILOCProfile;
+
+/**
+ * @brief Allocate an empty profile for a program
+ *
+ * @param program ILOC program that will be profiled (must outlive the profile)
+ * @returns Pointer to new profile
+ */
+ILOCProfile* ILOCProfile_new (InsnList* program);
+
+/**
+ * @brief Record the execution of an instruction (called by the simulator)
+ *
+ * @param profile Profile to update
+ * @param index Position of the instruction in the program
+ */
+void ILOCProfile_step (ILOCProfile* profile, int index);
+
+/**
+ * @brief Account for functions still active at the end of a run
+ *
+ * @param profile Profile to finish
+ */
+void ILOCProfile_finish (ILOCProfile* profile);
+
+/**
+ * @brief Write a human-readable profile report
+ *
+ * Includes per-function call counts and inclusive/exclusive instruction
+ * totals, loop iteration counts, basic block counts, and per-instruction
+ * execution counts.
+ *
+ * @param profile Profile to print
+ * @param output File stream for output
+ */
+void ILOCProfile_print_report (ILOCProfile* profile, FILE* output);
+
+/**
+ * @brief Write the profile in "folded stacks" format
+ *
+ * Each line is a semicolon-separated call stack followed by the number of
+ * instructions executed with exactly that stack, as expected by common flame
+ * graph tools (e.g., flamegraph.pl).
+ *
+ * @param profile Profile to print
+ * @param output File stream for output
+ */
+void ILOCProfile_print_folded (ILOCProfile* profile, FILE* output);
+
+/**
+ * @brief Deallocate a profile
+ *
+ * @param profile Profile to deallocate
+ */
+void ILOCProfile_free (ILOCProfile* profile);
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * @file trace.h
+ * @brief Compact binary execution traces of simulated ILOC programs
+ *
+ * A trace file begins with a header (see @ref TraceWriter_new) followed by one
+ * variable-length record per executed instruction. Each record holds the
+ * position of the instruction in the program, the register(s) it wrote along
+ * with their new values, and the address and new value of any memory word it
+ * stored. All integers are little-endian:
+ *
+ *   u32 pc, u8 flags (bits 0-1: register writes, bit 2: memory write),
+ *   { u32 slot, i64 value } per register write, [ u32 address, i64 value ]
+ *
+ * Register slots use the simulator's register file layout (see iloc.h), and the
+ * header records the size of the register file and address space for the
+ * traced program. Since
+ * the initial machine state is fixed, the state after any step can be rebuilt
+ * by replaying records from the start (@ref Trace_replay).
+ */
+#ifndef __H_TRACE
+#define __H_TRACE
+
+#include "common.h"
+#include "token.h"
+#include "iloc.h"
+
+/**
+ * @brief Identifier at the start of every trace file
+ */
+#define TRACE_MAGIC "ILOCTRC2"
+
+/**
+ * @brief Maximum number of register writes per record (e.g., POP writes SP and a register)
+ */
+#define TRACE_MAX_REG_WRITES 2
+
+/**
+ * @brief Effects of a single executed instruction
+ */
+typedef struct TraceRecord
+{
+    /**
+     * @brief Position of the executed instruction in the program
+     */
+    uint32_t pc;
+
+    /**
+     * @brief Number of register writes (0 to @ref TRACE_MAX_REG_WRITES)
+     */
+    int num_reg_writes;
+
+    /**
+     * @brief Register file slots written (in order)
+     */
+    uint32_t reg_slot[TRACE_MAX_REG_WRITES];
+
+    /**
+     * @brief New register values
+     */
+    word_t reg_value[TRACE_MAX_REG_WRITES];
+
+    /**
+     * @brief Whether a memory word was stored
+     */
+    bool mem_write;
+
+    /**
+     * @brief Address of stored memory word
+     */
+    uint32_t mem_address;
+
+    /**
+     * @brief New value of stored memory word
+     */
+    word_t mem_value;
+
+} TraceRecord;
+
+/**
+ * @brief Trace file writer
+ */
+typedef struct TraceWriter
+{
+    /**
+     * @brief Destination stream
+     */
+    FILE* output;
+
+    /**
+     * @brief Number of records written so far
+     */
+    long num_records;
+
+} TraceWriter;
+
+/**
+ * @brief Create a trace writer and write the file header
+ *
+ * @param output Destination stream (must be opened in binary mode)
+ * @param program ILOC program that will be traced (determines the register file size)
+ * @param mem_size Size of the simulated address space (see @ref SimulatorOptions)
+ * @returns Pointer to new writer
+ */
+TraceWriter* TraceWriter_new (FILE* output, InsnList* program, word_t mem_size);
+
+/**
+ * @brief Append a record to a trace
+ *
+ * @param writer Trace writer
+ * @param record Record to write
+ */
+void TraceWriter_write (TraceWriter* writer, TraceRecord* record);
+
+/**
+ * @brief Flush and deallocate a trace writer (does not close the stream)
+ *
+ * @param writer Trace writer
+ */
+void TraceWriter_free (TraceWriter* writer);
+
+/**
+ * @brief Read and validate a trace file header
+ *
+ * @param input Source stream
+ * @param num_slots Destination for the size of the traced program's register file
+ * @param mem_size Destination for the size of the traced program's address space
+ * @returns True if and only if the header is valid for this simulator
+ */
+bool Trace_read_header (FILE* input, uint32_t* num_slots, uint32_t* mem_size);
+
+/**
+ * @brief Read the next record from a trace
+ *
+ * @param input Source stream (positioned after the header)
+ * @param record Destination record
+ * @returns True if a record was read and false at the end of the trace
+ */
+bool TraceRecord_read (FILE* input, TraceRecord* record);
+
+/**
+ * @brief Machine state reconstructed from a trace
+ */
+typedef struct TraceState
+{
+    /**
+     * @brief Register values
+     */
+    word_t* reg;
+
+    /**
+     * @brief Number of register file slots
+     */
+    uint32_t num_slots;
+
+    /**
+     * @brief Memory contents
+     */
+    ILOCMemory* mem;
+
+    /**
+     * @brief Number of records applied
+     */
+    long step;
+
+    /**
+     * @brief Position of the last instruction applied (if any)
+     */
+    uint32_t pc;
+
+} TraceState;
+
+/**
+ * @brief Rebuild the machine state after a given number of steps
+ *
+ * @param input Trace stream (positioned at the start of the file)
+ * @param step Number of instructions to replay (negative for all of them)
+ * @returns Reconstructed state, or NULL if the trace header is invalid
+ */
+TraceState* Trace_replay (FILE* input, long step);
+
+/**
+ * @brief Deallocate a reconstructed machine state
+ *
+ * @param state State to deallocate
+ */
+void TraceState_free (TraceState* state);
+
+/**
+ * @brief Print a reconstructed machine state
+ *
+ * Uses the same format as the simulator's trace output.
+ *
+ * @param state State to print
+ * @param output File stream for output
+ */
+void TraceState_print (TraceState* state, FILE* output);
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * @file x86_64.h
+ * @brief Native x86-64 emitter (GNU assembler syntax, System V ABI)
+ */
+#ifndef __H_X86_64
+#define __H_X86_64
+
+#include "common.h"
+#include "token.h"
+#include "iloc.h"
+
+/**
+ * @brief Number of ILOC physical registers that can be translated (R0-R8)
+ */
+#define X86_64_NUM_REGS 9
+
+/**
+ * @brief Generate x86-64 assembly from ILOC
+ *
+ * The output is a complete GNU assembler (AT&T syntax) source file that can be
+ * assembled and linked against the C library with the system toolchain (e.g.,
+ * "gcc -o program program.s"). It contains:
+ *
+ *   - the translated Decaf functions (named with a "decaf_" prefix so they
+ *     never collide with C library symbols), which keep the ILOC calling
+ *     convention: arguments on the stack, SP and BP in %rsp and %rbp, RET in
+ *     %rax, and physical registers R0-R8 in %rcx, %rsi, %rdi, %r8, %r9, %rbx,
+ *     %r12, %r13, and %r14
+ *   - a C-callable main() that saves the callee-saved registers, calls the
+ *     Decaf main(), and returns its return value as the exit status
+ *   - a small runtime (print routines built on printf) that follows the System
+ *     V ABI for the call into the C library but preserves every register the
+ *     translated code uses, and error routines for division by zero and
+ *     INT64_MIN / -1 (which would otherwise raise SIGFPE) that print the
+ *     simulator's error message and exit with a failure status
+ *   - string constants and a zero-filled block for the global variables
+ *
+ * Global variables are addressed by ILOC code as absolute addresses starting
+ * at @ref STATIC_VAR_OFFSET, which native code cannot map; %r15 holds the
+ * address of the global block minus that offset, and every memory access
+ * through a general-purpose register (rather than BP or SP) is made relative
+ * to it. %rdx, %r10, and %r11 are scratch registers.
+ *
+ * @param iloc ILOC program as a list of instructions (using only R0-R8)
+ * @param static_size Size of global variables in bytes (the @c staticSize
+ * attribute of the program node)
+ * @param output File stream for output
+ */
+void emit_x86_64 (InsnList* iloc, long static_size, FILE* output);
+
+#endif
@@ -9,14 +9,75 @@
 #include "token.h"
 #include "iloc.h"
 
+/**
+ * @brief Number of ILOC physical registers that can be translated (R0-R3)
+ */
+#define Y86_NUM_PHYSICAL_REGS 4
+
+/**
+ * @brief Space reserved for global variables when their size is unknown
+ *
+ * Places the code at 0x400, as in the original fixed layout.
+ */
+#define Y86_DEFAULT_STATIC_SIZE 0x300
+
+/**
+ * @brief Default address of the top of the stack (if the program fits below it)
+ */
+#define Y86_DEFAULT_STACK_TOP 0xf00
+
+/**
+ * @brief Minimum stack space left above the program by the default layout
+ */
+#define Y86_MIN_STACK_SIZE 0x400
+
+/**
+ * @brief Y86 memory layout options
+ *
+ * Zero-initialize and set the desired fields.
+ */
+typedef struct Y86EmitOptions
+{
+    /**
+     * @brief Size of global variables in bytes (the @c staticSize attribute
+     * of the program node)
+     */
+    long static_size;
+
+    /**
+     * @brief Address of the top of the stack (0 for @ref Y86_DEFAULT_STACK_TOP,
+     * moved up if the program needs more room)
+     */
+    long stack_top;
+
+} Y86EmitOptions;
+
 /**
  * @brief Generate Y86 assembly from ILOC
  *
+ * Reserves @ref Y86_DEFAULT_STATIC_SIZE bytes for global variables (see
+ * @ref emit_y86_with_options).
+ *
  * Some code courtesy of Kevin Kelly (honors option, Fall 2018)
  * 
- * @param iloc ILOC program as a list of instructions
+ * @param iloc ILOC program as a list of instructions (using only R0-R3)
  * @param output File stream for output
  */
 void emit_y86 (InsnList* iloc, FILE* output);
 
+/**
+ * @brief Generate Y86 assembly from ILOC with a measured memory layout
+ *
+ * Global variables are placed at @ref STATIC_VAR_OFFSET (where the ILOC code
+ * expects them) as zero-filled @c .quad words, followed by the code, then the
+ * string constants (each distinct string once), and finally the stack, which
+ * grows down from @c stack_top. Section addresses are computed from the sizes
+ * of the assembled code and data, so sections never overlap.
+ *
+ * @param iloc ILOC program as a list of instructions
+ * @param options Layout options
+ * @param output File stream for output
+ */
+void emit_y86_with_options (InsnList* iloc, Y86EmitOptions* options, FILE* output);
+
 #endif
@@ -0,0 +1,41 @@
+/**
+ * @file y86opt.h
+ * @brief Peephole optimizer for Y86 assembly generated by @ref emit_y86
+ *
+ * The emitter translates one ILOC instruction at a time, which leaves many
+ * short-range redundancies in its output. This pass works on the emitted
+ * assembly text and repeatedly applies the following rewrites (guided by a
+ * liveness analysis of the registers and condition codes) until none apply:
+ *
+ *   - compare-and-branch: a comparison materialized with cmov followed by a
+ *     test of the result (andq r, r; jne/je) becomes a single conditional jump
+ *     on the flags of the subtraction
+ *   - moves: self-moves and copies that are immediately undone are dropped,
+ *     copies are propagated into their single use, and results computed in a
+ *     scratch register and then moved are computed in place
+ *   - constants: irmovq $1 reuses the ONE register (%rbx), and adding an
+ *     immediate -1 becomes a subtraction of it
+ *   - dead code: register writes that are never read are removed, as are
+ *     unreachable instructions
+ *   - jumps: jumps to the next instruction are removed, jumps to jumps are
+ *     threaded, and "jXX a; jmp b; a:" becomes a single inverted jump
+ */
+#ifndef __H_Y86OPT
+#define __H_Y86OPT
+
+#include "common.h"
+
+/**
+ * @brief Optimize Y86 assembly text
+ *
+ * Lines other than instructions (labels, directives, comments) are copied
+ * unchanged. Calls, returns, and traps are treated as reading every register,
+ * except that the flags and the emitter's scratch registers (%rsi, %rdi, %r8,
+ * %r9, %r13, and %r14) are assumed not to carry values out of a function.
+ *
+ * @param text Assembly source code in the format written by @ref emit_y86
+ * @returns Optimized assembly source code (allocated; caller must free)
+ */
+char* optimize_y86 (const char* text);
+
+#endif
@@ -0,0 +1,232 @@
+/**
+ * @file y86sim.h
+ * @brief Y86-64 assembler and emulator (for running the output of @ref emit_y86)
+ *
+ * The assembler accepts the CS:APP assembly syntax produced by the Y86 emitter
+ * (labels, @c .pos, @c .align, @c .quad, @c .byte, and @c .string directives,
+ * and @c $D(%reg) or @c D(%reg) memory operands) and produces a memory image
+ * using the standard Y86-64 instruction encodings. The emulator runs such an
+ * image until it halts or faults, counting instructions and estimating cycles
+ * for the CS:APP five-stage pipeline (PIPE).
+ *
+ * Besides the standard instruction set, the @c iotrap instruction (encoding
+ * 0xC0 | trap number) performs I/O through registers %rsi (source address) and
+ * %rdi (destination address):
+ *
+ *   0 CHAROUT, 1 CHARIN, 2 DECOUT, 3 DECIN, 4 STROUT, 5 FLUSH
+ */
+#ifndef __H_Y86SIM
+#define __H_Y86SIM
+
+#include "common.h"
+#include "token.h"
+#include "iloc.h"
+
+/**
+ * @brief Default size of the emulated address space
+ *
+ * @ref run_y86 places the top of the stack at the end of the address space.
+ */
+#define Y86_MEM_SIZE 0x1000
+
+/**
+ * @brief Number of Y86-64 program registers (%rax through %r14)
+ */
+#define Y86_NUM_REGS 15
+
+/**
+ * @brief Number of executed instructions after which a run is stopped
+ */
+#define Y86_TIMEOUT_NUM_INSTRUCTIONS 500000000
+
+/**
+ * @brief Assembled Y86-64 program (initial memory contents)
+ */
+typedef struct Y86Image
+{
+    /**
+     * @brief Memory contents starting at address zero
+     */
+    byte_t* bytes;
+
+    /**
+     * @brief Number of bytes in the image (one past the highest address used)
+     */
+    int64_t size;
+
+    /**
+     * @brief Number of bytes occupied by instructions (excluding data directives)
+     */
+    int64_t code_size;
+
+} Y86Image;
+
+/**
+ * @brief Assemble Y86-64 assembly text
+ *
+ * @param text Assembly source code
+ * @param error Destination for an error message (at least @ref MAX_ERROR_LEN
+ * characters) if the source code is invalid
+ * @returns Pointer to new image, or NULL if the source code is invalid
+ */
+Y86Image* Y86Image_assemble (const char* text, char* error);
+
+/**
+ * @brief Assemble Y86-64 assembly text and write an object listing
+ *
+ * The listing uses the .yo format of the CS:APP assembler (yas): each source
+ * line is prefixed with its address and the bytes it encodes, so it can be
+ * loaded by the standard Y86-64 simulators.
+ *
+ * @param text Assembly source code
+ * @param listing Destination for the listing (NULL for none)
+ * @param error Destination for an error message (at least @ref MAX_ERROR_LEN
+ * characters) if the source code is invalid
+ * @returns Pointer to new image, or NULL if the source code is invalid
+ */
+Y86Image* Y86Image_assemble_with_listing (const char* text, FILE* listing, char* error);
+
+/**
+ * @brief Write the raw memory contents of an image (starting at address zero)
+ *
+ * @param image Image to write
+ * @param output Destination file (should be opened in binary mode)
+ * @returns True if and only if all bytes were written
+ */
+bool Y86Image_write (Y86Image* image, FILE* output);
+
+/**
+ * @brief Deallocate an assembled image
+ *
+ * @param image Image to deallocate
+ */
+void Y86Image_free (Y86Image* image);
+
+/**
+ * @brief Y86-64 machine status (CS:APP status codes plus a timeout)
+ */
+typedef enum Y86Status
+{
+    Y86_AOK,        /**< @brief Normal operation (never the final status) */
+    Y86_HLT,        /**< @brief Halt instruction executed */
+    Y86_ADR,        /**< @brief Invalid address */
+    Y86_INS,        /**< @brief Invalid instruction (or failed I/O) */
+    Y86_TIMEOUT     /**< @brief Too many instructions executed */
+} Y86Status;
+
+struct ProgramOutput;
+
+/**
+ * @brief Emulator options
+ *
+ * Zero-initialize and set the desired fields.
+ */
+typedef struct Y86Options
+{
+    /**
+     * @brief Size of the address space in bytes (0 for @ref Y86_MEM_SIZE)
+     */
+    int64_t mem_size;
+
+    /**
+     * @brief Destination for output traps (NULL for standard output)
+     */
+    struct ProgramOutput* output;
+
+    /**
+     * @brief Source for input traps (NULL to make input traps fail)
+     */
+    FILE* input;
+
+    /**
+     * @brief Size of the program's global variables in bytes (used by
+     * @ref run_y86 to lay out memory; see @ref Y86EmitOptions)
+     */
+    long static_size;
+
+} Y86Options;
+
+/**
+ * @brief Outcome of an emulator run
+ */
+typedef struct Y86Result
+{
+    /**
+     * @brief Final machine status
+     */
+    Y86Status status;
+
+    /**
+     * @brief Value of %rax when the machine stopped
+     */
+    int64_t return_value;
+
+    /**
+     * @brief Number of instructions executed (including the halt)
+     */
+    long instructions;
+
+    /**
+     * @brief Estimated PIPE cycles (see @ref Y86_run)
+     */
+    long cycles;
+
+    /**
+     * @brief Address of the last instruction fetched
+     */
+    int64_t pc;
+
+    /**
+     * @brief Error message (if the machine did not halt normally)
+     */
+    char message[MAX_ERROR_LEN];
+
+} Y86Result;
+
+/**
+ * @brief Run an assembled program from address zero
+ *
+ * Cycle estimates follow the CS:APP PIPE design: one cycle per instruction
+ * plus four to fill the pipeline, one bubble when an instruction uses a
+ * register loaded by the instruction before it (mrmovq or popq), two when a
+ * conditional jump is not taken (jumps are predicted taken), and three per ret.
+ *
+ * @param image Program to run (not modified)
+ * @param options Emulator options
+ * @param result Destination for the outcome of the run
+ * @returns True if and only if the machine halted normally
+ */
+bool Y86_run (Y86Image* image, Y86Options* options, Y86Result* result);
+
+/**
+ * @brief Translate an ILOC program to Y86 with @ref emit_y86_with_options and run it
+ *
+ * The stack starts at the top of the address space, and space is reserved for
+ * @c static_size bytes of global variables.
+ *
+ * Aborts with an error message if the generated code does not assemble (which
+ * indicates a bug in the emitter).
+ *
+ * @param program List of ILOC instructions (using only physical registers)
+ * @param options Emulator options
+ * @param result Destination for the outcome of the run
+ * @returns True if and only if the machine halted normally
+ */
+bool run_y86 (InsnList* program, Y86Options* options, Y86Result* result);
+
+/**
+ * @brief Translate an ILOC program to Y86 with @ref emit_y86_with_options and
+ * assemble it in memory
+ *
+ * Aborts with an error message if the generated code does not assemble (which
+ * indicates a bug in the emitter).
+ *
+ * @param program List of ILOC instructions (using only physical registers)
+ * @param static_size Size of the program's global variables in bytes
+ * @param stack_top Address of the top of the stack (0 for the emitter's default)
+ * @param listing Destination for a .yo listing (NULL for none)
+ * @returns Pointer to new image
+ */
+Y86Image* assemble_y86 (InsnList* program, long static_size, long stack_top, FILE* listing);
+
+#endif
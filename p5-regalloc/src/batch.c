@@ -0,0 +1,92 @@
+/**
+ * @file batch.c
+ * @brief Running many ILOC programs concurrently in the simulator
+ */
+#define _DEFAULT_SOURCE
+#include "batch.h"
+#include "output.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/**
+ * @brief Jobs shared by all worker threads
+ */
+typedef struct BatchWorkQueue
+{
+    BatchJob* jobs;
+    int num_jobs;
+    atomic_int next;    // index of next job to run
+} BatchWorkQueue;
+
+/*
+ * run one job with its output captured in memory
+ */
+void run_job(BatchJob* job)
+{
+    ProgramOutput* output = ProgramOutput_new_memory();
+    SimulatorOptions options = job->options;
+    options.output = output;
+    run_simulator_with_result(job->program, &options, &job->result);
+
+    const char* contents = ProgramOutput_contents(output);
+    job->output = (char*)malloc(strlen(contents) + 1);
+    CHECK_MALLOC_PTR(job->output);
+    strcpy(job->output, contents);
+    ProgramOutput_free(output);
+}
+
+/*
+ * worker thread: claim jobs from the queue until it is empty
+ */
+void* batch_worker(void* arg)
+{
+    BatchWorkQueue* queue = (BatchWorkQueue*)arg;
+    int j;
+    while ((j = atomic_fetch_add(&queue->next, 1)) < queue->num_jobs) {
+        run_job(&queue->jobs[j]);
+    }
+    return NULL;
+}
+
+void run_batch (BatchJob* jobs, int num_jobs, int num_threads)
+{
+    if (jobs == NULL || num_jobs < 1) {
+        return;
+    }
+
+    BatchWorkQueue queue = {
+        .jobs = jobs,
+        .num_jobs = num_jobs
+    };
+    atomic_init(&queue.next, 0);
+
+    if (num_threads < 1) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (online < 1 ? 1 : (int)online);
+    }
+    if (num_threads > num_jobs) {
+        num_threads = num_jobs;
+    }
+    if (num_threads > MAX_BATCH_THREADS) {
+        num_threads = MAX_BATCH_THREADS;
+    }
+    pthread_t threads[MAX_BATCH_THREADS];
+    int num_started = 0;
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[num_started], NULL, batch_worker, &queue) == 0) {
+            num_started++;
+        }
+    }
+    batch_worker(&queue);       // the calling thread works too
+    for (int t = 0; t < num_started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+void BatchJob_free_output (BatchJob* job)
+{
+    free(job->output);
+    job->output = NULL;
+}
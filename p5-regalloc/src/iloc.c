@@ -1,4 +1,44 @@
+#define _DEFAULT_SOURCE
 #include "iloc.h"
+#include "profile.h"
+#include "trace.h"
+#include "output.h"
+
+/*
+ * ID generation contexts
+ */
+
+static _Thread_local ILOCContext default_context = { 0, 0 };
+static _Thread_local ILOCContext* current_context = NULL;
+
+void ILOCContext_init (ILOCContext* context)
+{
+    context->next_register_id = 0;
+    context->next_label_id = 0;
+}
+
+ILOCContext* ILOCContext_get_current (void)
+{
+    return (current_context != NULL ? current_context : &default_context);
+}
+
+void ILOCContext_set_current (ILOCContext* context)
+{
+    current_context = context;
+}
+
+Operand ILOCContext_virtual_register (ILOCContext* context)
+{
+    Operand op = { .type = VIRTUAL_REG, .id = context->next_register_id++ };
+    return op;
+}
+
+Operand ILOCContext_anonymous_label (ILOCContext* context)
+{
+    Operand op = { .type = JUMP_LABEL, .id = context->next_label_id++ };
+    return op;
+}
+
 
 /*
  * ILOC operands
@@ -30,9 +70,7 @@ Operand return_register (void)
 
 Operand virtual_register (void)
 {
-    static int next_id = 0;
-    Operand op = { .type = VIRTUAL_REG, .id = next_id++ };
-    return op;
+    return ILOCContext_virtual_register(ILOCContext_get_current());
 }
 
 Operand physical_register (int id)
@@ -43,9 +81,7 @@ Operand physical_register (int id)
 
 Operand anonymous_label (void)
 {
-    static int next_id = 0;
-    Operand op = { .type = JUMP_LABEL, .id = next_id++ };
-    return op;
+    return ILOCContext_anonymous_label(ILOCContext_get_current());
 }
 
 Operand call_label (const char* label)
@@ -282,7 +318,7 @@ void InsnList_print (InsnList* list, FILE* output)
 {
     FOR_EACH(ILOCInsn*, i, list) {
         if (i->form != LABEL) {
-            printf("  ");
+            fprintf(output, "  ");
         }
         ILOCInsn_print(i, output);
         if (i->comment[0] != '\0') {
@@ -292,6 +328,19 @@ void InsnList_print (InsnList* list, FILE* output)
     }
 }
 
+int InsnList_max_id (InsnList* list, OperandType type)
+{
+    int max_id = -1;
+    FOR_EACH(ILOCInsn*, i, list) {
+        for (int op = 0; op < 3; op++) {
+            if (i->op[op].type == type && i->op[op].id > max_id) {
+                max_id = i->op[op].id;
+            }
+        }
+    }
+    return max_id;
+}
+
 
 /*
  * AST VISITOR: Symbol storage/memory allocation
@@ -476,375 +525,784 @@ Operand ASTNode_get_temp_reg (ASTNode* node)
  * ILOC machine simulator
  */
 
-#if WORD_SIZE == 4
-    typedef int32_t word_t;
-    #define PRIW "%" PRId32
-#else
-    typedef int64_t word_t;
-    #define PRIW "%" PRId64
-#endif
-typedef uint8_t byte_t;
-
-#define UNINIT_REG       (-9999999)
 
 /**
- * @brief Information about call targets (i.e., functions)
- * 
- * This information is prefetched with a single pass over the instruction
- * before it is simulated.
+ * @brief Verification that reports problems instead of aborting (see
+ * @ref check_program)
  */
-typedef struct CallTarget
+typedef struct ProgramCheck
 {
     /**
-     * @brief Function name
+     * @brief Destination for the description of the first problem found
      */
-    char name[MAX_TOKEN_LEN];
+    char* message;
 
     /**
-     * @brief Pointer to corresponding label "instruction"
+     * @brief Where to resume when a problem is found
      */
-    ILOCInsn* insn;
-    
-    /**
-     * @brief Next call target (if stored in a list)
-     */
-    struct CallTarget* next;
+    jmp_buf abort;
 
-} CallTarget;
+} ProgramCheck;
+
+/* verification in progress on this thread (NULL if problems should abort) */
+static _Thread_local ProgramCheck* current_check = NULL;
 
-DECL_LIST_TYPE(CallTarget, CallTarget*)
-DEF_LIST_IMPL(CallTarget, CallTarget*, free)
+/* description of a problem as it is being written (see invalid_program_begin) */
+static _Thread_local char* problem_text = NULL;
+static _Thread_local size_t problem_length = 0;
 
-void CallTargetList_add_new (CallTargetList* list, const char* name, ILOCInsn* target)
+/*
+ * start describing a problem with the program being verified
+ */
+FILE* invalid_program_begin (void)
 {
-    CallTarget* new_target = (CallTarget*)calloc(1, sizeof(CallTarget));
-    CHECK_MALLOC_PTR(new_target);
-    snprintf(new_target->name, MAX_TOKEN_LEN, "%s", name);
-    new_target->insn = target;
-    CallTargetList_add(list, new_target);
+    FILE* err = open_memstream(&problem_text, &problem_length);
+    CHECK_MALLOC_PTR(err);
+    return err;
 }
 
-ILOCInsn* CallTargetList_find (CallTargetList* list, const char* name)
+/*
+ * finish describing a problem and report it (does not return): to the caller of
+ * check_program if one is in progress, otherwise by printing it and aborting
+ */
+void invalid_program_end (FILE* err)
 {
-    FOR_EACH (CallTarget*, target, list) {
-        if (token_str_eq(target->name, name)) {
-            return target->insn;
-        }
+    fclose(err);
+    if (current_check != NULL) {
+        snprintf(current_check->message, MAX_ERROR_LEN, "%s", problem_text);
+        free(problem_text);
+        longjmp(current_check->abort, 1);
     }
-    printf("ERROR: No call target found for '%s'\n", name);
+    printf("%s\n", problem_text);
+    free(problem_text);
     exit(EXIT_FAILURE);
 }
 
+
 /**
- * @brief ILOC machine state structure
+ * @brief Information about call targets (i.e., functions)
+ *
+ * This information is prefetched with a single pass over the instruction
+ * before it is simulated.
  */
-typedef struct ILOCMachine
+typedef struct CallTarget
 {
     /**
-     * @brief Virtual register values
-     */
-    word_t reg[MAX_VIRTUAL_REGS];
-
-    /**
-     * @brief Physical register values
-     */
-    word_t pr[MAX_PHYSICAL_REGS];
-
-    /**
-     * @brief Program counter (pointer to next instruction to execute)
-     */
-    ILOCInsn* pc;
-
-    /**
-     * @brief Stack pointer value
-     */
-    word_t sp;
-    
-    /**
-     * @brief Base pointer value
+     * @brief Function name
      */
-    word_t bp;
+    char name[MAX_TOKEN_LEN];
 
     /**
-     * @brief Function return value
+     * @brief Index of corresponding label "instruction"
      */
-    word_t ret;
+    int index;
 
     /**
-     * @brief Program address space (memory w/ global variables and stack)
+     * @brief Next call target (in the same hash bucket)
      */
-    byte_t mem[MEM_SIZE];
+    struct CallTarget* next;
 
-    /**
-     * @brief List of program instructions (i.e., code)
-     * 
-     * Note that instructions are NOT stored in the program's "address space."
-     */
-    ILOCInsn* instructions[MAX_INSTRUCTIONS];
+} CallTarget;
 
-    /**
-     * @brief Jump targets (instrution pointers indexed by jump label IDs)
-     */
-    ILOCInsn* jump_targets[MAX_INSTRUCTIONS];
+/**
+ * @brief Number of buckets in a call target table
+ */
+#define CALL_TARGET_BUCKETS 64
 
+/**
+ * @brief Hash table of call targets (function name to instruction index)
+ */
+typedef struct CallTargetTable
+{
     /**
-     * @brief Call targets (list of string label and instruction pointer pairs)
+     * @brief Bucket chains (linked through @c CallTarget::next)
      */
-    CallTargetList* call_targets;
+    CallTarget* buckets[CALL_TARGET_BUCKETS];
 
-} ILOCMachine;
+} CallTargetTable;
 
-ILOCMachine* ILOCMachine_new(void)
+CallTargetTable* CallTargetTable_new (void)
 {
-    ILOCMachine* machine = (ILOCMachine*)calloc(1, sizeof(ILOCMachine));
-    CHECK_MALLOC_PTR(machine);
+    CallTargetTable* table = (CallTargetTable*)calloc(1, sizeof(CallTargetTable));
+    CHECK_MALLOC_PTR(table);
+    return table;
+}
 
-    /* set all registers to special "uninitialized" value (helps find code gen bugs) */
-    for (int i = 0; i < MAX_VIRTUAL_REGS; i++) {
-        machine->reg[i] = UNINIT_REG;
+/* djb2 string hash */
+unsigned int CallTargetTable_hash (const char* name)
+{
+    unsigned int hash = 5381;
+    for (const char* c = name; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char)*c;
     }
-    for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
-        machine->pr[i] = UNINIT_REG;
+    return hash % CALL_TARGET_BUCKETS;
+}
+
+CallTarget* CallTargetTable_lookup (CallTargetTable* table, const char* name)
+{
+    for (CallTarget* target = table->buckets[CallTargetTable_hash(name)];
+            target != NULL; target = target->next) {
+        if (token_str_eq(target->name, name)) {
+            return target;
+        }
     }
-    machine->sp = machine->bp = machine->ret = UNINIT_REG;
+    return NULL;
+}
 
-    /* initialize call target list */
-    machine->call_targets = CallTargetList_new();
+void CallTargetTable_add_new (CallTargetTable* table, const char* name, int index)
+{
+    if (CallTargetTable_lookup(table, name) != NULL) {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: Duplicate call target '%s'", name);
+        invalid_program_end(err);
+    }
+    CallTarget* new_target = (CallTarget*)calloc(1, sizeof(CallTarget));
+    CHECK_MALLOC_PTR(new_target);
+    snprintf(new_target->name, MAX_TOKEN_LEN, "%s", name);
+    new_target->index = index;
 
-    /* everything else can stay zero/NULL from the calloc */
-    return machine;
+    unsigned int bucket = CallTargetTable_hash(name);
+    new_target->next = table->buckets[bucket];
+    table->buckets[bucket] = new_target;
 }
 
-void ILOCMachine_set_reg(ILOCMachine* machine, Operand op, word_t value)
+int CallTargetTable_find (CallTargetTable* table, const char* name)
 {
-    switch (op.type) {
-        case STACK_REG:  machine->sp  = value; break;
-        case BASE_REG:   machine->bp  = value; break;
-        case RETURN_REG: machine->ret = value; break;
-        case VIRTUAL_REG:
-            if (op.id < 0 || op.id > MAX_VIRTUAL_REGS) {
-                printf("ERROR: Register r%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
-            }
-            machine->reg[op.id] = value;
-            break;
-        case PHYSICAL_REG:
-            if (op.id < 0 || op.id > MAX_PHYSICAL_REGS) {
-                printf("ERROR: Register R%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
-            }
-            machine->pr[op.id] = value;
-            break;
-        default:
-            printf("ERROR: Cannot write register using a non-register operand: ");
-            Operand_print(op, stdout);
-            printf("\n");
-            break;
+    CallTarget* target = CallTargetTable_lookup(table, name);
+    if (target == NULL) {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: No call target found for '%s'", name);
+        invalid_program_end(err);
     }
+    return target->index;
 }
 
-word_t ILOCMachine_get_reg(ILOCMachine* machine, Operand op)
+void CallTargetTable_free (CallTargetTable* table)
 {
-    switch (op.type) {
-        case STACK_REG:  return machine->sp;
-        case BASE_REG:   return machine->bp;
-        case RETURN_REG: return machine->ret;
-        case VIRTUAL_REG:
-            if (op.id < 0 || op.id > MAX_VIRTUAL_REGS) {
-                printf("ERROR: Register r%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
-            } else if (machine->reg[op.id] == UNINIT_REG) {
-                printf("WARNING: Potential uninitialized read from register r%d\n", op.id);
-            }
-            return machine->reg[op.id];
-        case PHYSICAL_REG:
-            if (op.id < 0 || op.id > MAX_PHYSICAL_REGS) {
-                printf("ERROR: Register R%d does not exist\n", op.id);
-                exit(EXIT_FAILURE);
-            } else if (machine->pr[op.id] == UNINIT_REG) {
-                printf("WARNING: Potential uninitialized read from register R%d\n", op.id);
-            }
-            return machine->pr[op.id];
-        default:
-            printf("ERROR: Cannot read register using a non-register operand: ");
-            Operand_print(op, stdout);
-            printf("\n");
-            exit(EXIT_FAILURE);
+    for (int b = 0; b < CALL_TARGET_BUCKETS; b++) {
+        CallTarget* target = table->buckets[b];
+        while (target != NULL) {
+            CallTarget* next = target->next;
+            free(target);
+            target = next;
+        }
     }
+    free(table);
 }
 
-void ILOCMachine_set_mem(ILOCMachine* machine, int address, word_t value)
+void assert_valid_mem_size (word_t size)
 {
-    if (address < 0 || address > MEM_SIZE - WORD_SIZE) {
-        printf("ERROR: Address %d is invalid (out of range)\n", address);
+    if (size <= STATIC_VAR_OFFSET || size > MAX_MEM_SIZE || size % WORD_SIZE != 0) {
+        printf("ERROR: Invalid memory size " PRIW "\n", size);
         exit(EXIT_FAILURE);
     }
-    /* actual memory write */
-    *(word_t*)(machine->mem + address) = value;
 }
 
-word_t ILOCMachine_get_mem(ILOCMachine* machine, int address)
+ILOCMemory* ILOCMemory_new (word_t size)
 {
-    if (address < 0 || address > MEM_SIZE - WORD_SIZE) {
-        printf("ERROR: Address %d is invalid (out of range)\n", address);
-        exit(EXIT_FAILURE);
+    assert_valid_mem_size(size);
+    ILOCMemory* mem = (ILOCMemory*)calloc(1, sizeof(ILOCMemory));
+    CHECK_MALLOC_PTR(mem);
+    mem->size = size;
+    mem->num_pages = (size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+    mem->pages = (byte_t**)calloc(mem->num_pages, sizeof(byte_t*));
+    CHECK_MALLOC_PTR(mem->pages);
+    return mem;
+}
+
+/*
+ * remember that a page has been written (only when tracking writes)
+ */
+static inline void ILOCMemory_touch (ILOCMemory* mem, word_t page)
+{
+    if (mem->dirty != NULL && !mem->dirty[page]) {
+        mem->dirty[page] = true;
+        mem->dirty_pages[mem->num_dirty++] = page;
     }
-    /* actual memory read */
-    return *(word_t*)(machine->mem + address);
 }
 
-void ILOCMachine_print(ILOCMachine* machine, FILE* output)
+/*
+ * byte-level access for words that straddle a page boundary
+ */
+
+byte_t ILOCMemory_get_byte (ILOCMemory* mem, word_t address)
 {
-    fprintf(output, "==========================\n");
+    byte_t* page = mem->pages[address / MEM_PAGE_SIZE];
+    return (page != NULL ? page[address % MEM_PAGE_SIZE] : 0);
+}
 
-    /* registers (special and virtual) */
-    fprintf(output, "sp=" PRIW " bp=" PRIW " ret=" PRIW "\n", machine->sp, machine->bp, machine->ret);
-    fprintf(output, "registers: ");
-    for (int i = 0; i < MAX_VIRTUAL_REGS; i++) {
-        if (machine->reg[i] != UNINIT_REG) {
-            fprintf(output, " r%d=" PRIW, i, machine->reg[i]);
-        }
+void ILOCMemory_set_byte (ILOCMemory* mem, word_t address, byte_t value)
+{
+    ILOCMemory_touch(mem, address / MEM_PAGE_SIZE);
+    byte_t** page = &mem->pages[address / MEM_PAGE_SIZE];
+    if (*page == NULL) {
+        *page = (byte_t*)calloc(MEM_PAGE_SIZE, 1);
+        CHECK_MALLOC_PTR(*page);
     }
-    for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
-        if (machine->pr[i] != UNINIT_REG) {
-            fprintf(output, " R%d=" PRIW, i, machine->pr[i]);
+    (*page)[address % MEM_PAGE_SIZE] = value;
+}
+
+static inline word_t ILOCMemory_read (ILOCMemory* mem, word_t address)
+{
+    word_t value = 0;
+    word_t offset = address % MEM_PAGE_SIZE;
+    if (offset <= MEM_PAGE_SIZE - WORD_SIZE) {
+        byte_t* page = mem->pages[address / MEM_PAGE_SIZE];
+        if (page != NULL) {
+            memcpy(&value, page + offset, sizeof(word_t));
         }
+    } else {
+        byte_t bytes[WORD_SIZE];
+        for (int i = 0; i < WORD_SIZE; i++) {
+            bytes[i] = ILOCMemory_get_byte(mem, address + i);
+        }
+        memcpy(&value, bytes, sizeof(word_t));
     }
-    fprintf(output, "\n");
-    
-    /* stack (memory from MEM_SIZE down to stack pointer) */
-    fprintf(output, "stack:");
-    for (int addr = MEM_SIZE - WORD_SIZE; addr >= machine->sp; addr -= WORD_SIZE) {
-        fprintf(output, "  %d: " PRIW, addr, ILOCMachine_get_mem(machine, addr));
-    }
-    fprintf(output, "\n");
+    return value;
+}
 
-    /* other memory (any WORD_SIZE-aligned value that is non-zero) */
-    fprintf(output, "other memory:");
-    for (int addr = STATIC_VAR_OFFSET; addr < machine->sp; addr += WORD_SIZE) {
-        word_t value = ILOCMachine_get_mem(machine, addr);
-        if (value != 0) {
-            fprintf(output, "  %d: " PRIW, addr, value);
+static inline void ILOCMemory_write (ILOCMemory* mem, word_t address, word_t value)
+{
+    word_t offset = address % MEM_PAGE_SIZE;
+    byte_t* page = mem->pages[address / MEM_PAGE_SIZE];
+    if (page != NULL && offset <= MEM_PAGE_SIZE - WORD_SIZE) {
+        ILOCMemory_touch(mem, address / MEM_PAGE_SIZE);
+        memcpy(page + offset, &value, sizeof(word_t));
+    } else {
+        /* first write to the page(s) */
+        byte_t bytes[WORD_SIZE];
+        memcpy(bytes, &value, sizeof(word_t));
+        for (int i = 0; i < WORD_SIZE; i++) {
+            ILOCMemory_set_byte(mem, address + i, bytes[i]);
         }
     }
-    fprintf(output, "\n");
+}
 
-    fprintf(output, "==========================\n");
+word_t ILOCMemory_get (ILOCMemory* mem, word_t address)
+{
+    return ILOCMemory_read(mem, address);
 }
 
-void ILOCMachine_free(ILOCMachine* machine)
+void ILOCMemory_set (ILOCMemory* mem, word_t address, word_t value)
 {
-    CallTargetList_free(machine->call_targets);
-    free(machine);
+    ILOCMemory_write(mem, address, value);
 }
 
-void assert_operand_count (ILOCInsn* insn, int count)
+bool ILOCMemory_is_mapped (ILOCMemory* mem, word_t address)
 {
-    int actual_count = ILOCInsn_get_operand_count(insn);
-    if (actual_count != count) {
-        printf("ERROR: Invalid instruction (expected %d operands but found %d): ",
-                count, actual_count);
-        ILOCInsn_print(insn, stdout);
-        printf("\n");
-        exit(EXIT_FAILURE);
+    return address >= 0 && address < mem->size && mem->pages[address / MEM_PAGE_SIZE] != NULL;
+}
+
+/*
+ * forget which pages have been written (allocating the tracking tables the
+ * first time)
+ */
+void ILOCMemory_reset_tracking (ILOCMemory* mem)
+{
+    if (mem->dirty == NULL) {
+        mem->dirty = (bool*)calloc(mem->num_pages, sizeof(bool));
+        mem->dirty_pages = (word_t*)malloc(mem->num_pages * sizeof(word_t));
+        CHECK_MALLOC_PTR(mem->dirty);
+        CHECK_MALLOC_PTR(mem->dirty_pages);
+    }
+    for (word_t i = 0; i < mem->num_dirty; i++) {
+        mem->dirty[mem->dirty_pages[i]] = false;
     }
+    mem->num_dirty = 0;
 }
 
-void assert_operand_is_register (ILOCInsn* insn, Operand op)
+ILOCMemory* ILOCMemory_copy (ILOCMemory* mem)
 {
-    if (op.type != STACK_REG  && op.type != BASE_REG &&
-        op.type != RETURN_REG && op.type != VIRTUAL_REG && op.type != PHYSICAL_REG)
-    {
-        printf("ERROR: Invalid operand '");
-        Operand_print(op, stdout);
-        printf("' (expected register): ");
-        ILOCInsn_print(insn, stdout);
-        printf("\n");
-        exit(EXIT_FAILURE);
+    ILOCMemory* copy = ILOCMemory_new(mem->size);
+    for (word_t p = 0; p < mem->num_pages; p++) {
+        if (mem->pages[p] != NULL) {
+            copy->pages[p] = (byte_t*)malloc(MEM_PAGE_SIZE);
+            CHECK_MALLOC_PTR(copy->pages[p]);
+            memcpy(copy->pages[p], mem->pages[p], MEM_PAGE_SIZE);
+        }
     }
+    ILOCMemory_reset_tracking(mem);
+    return copy;
 }
 
-void assert_all_register_operands (ILOCInsn* insn, int count)
+/*
+ * make one page match the saved copy (unmapping it if the copy never had it)
+ */
+void ILOCMemory_restore_page (ILOCMemory* mem, ILOCMemory* saved, word_t page)
 {
-    assert_operand_count(insn, count);
-    for (int i = 0; i < count; i++) {
-        assert_operand_is_register(insn, insn->op[i]);
+    if (saved->pages[page] == NULL) {
+        free(mem->pages[page]);
+        mem->pages[page] = NULL;
+    } else {
+        if (mem->pages[page] == NULL) {
+            mem->pages[page] = (byte_t*)malloc(MEM_PAGE_SIZE);
+            CHECK_MALLOC_PTR(mem->pages[page]);
+        }
+        memcpy(mem->pages[page], saved->pages[page], MEM_PAGE_SIZE);
     }
 }
 
-void assert_operand_type (ILOCInsn* insn, Operand op, OperandType type)
+void ILOCMemory_restore (ILOCMemory* mem, ILOCMemory* saved, bool only_dirty)
 {
-    if (op.type != type) {
-        printf("ERROR: Invalid operand '");
-        Operand_print(op, stdout);
-        printf("': ");
-        ILOCInsn_print(insn, stdout);
-        printf("\n");
-        exit(EXIT_FAILURE);
+    if (only_dirty && mem->dirty != NULL) {
+        for (word_t i = 0; i < mem->num_dirty; i++) {
+            ILOCMemory_restore_page(mem, saved, mem->dirty_pages[i]);
+        }
+    } else {
+        for (word_t p = 0; p < mem->num_pages; p++) {
+            if (mem->pages[p] != NULL || saved->pages[p] != NULL) {
+                ILOCMemory_restore_page(mem, saved, p);
+            }
+        }
     }
+    ILOCMemory_reset_tracking(mem);
 }
 
-void assert_valid_insn (ILOCInsn* insn)
+void ILOCMemory_free (ILOCMemory* mem)
 {
-    switch (insn->form)
-    {
-        /* no operands */
-        case RETURN:
-        case NOP:
-            assert_operand_count(insn, 0);
-            break;
+    for (word_t p = 0; p < mem->num_pages; p++) {
+        free(mem->pages[p]);
+    }
+    free(mem->pages);
+    free(mem->dirty);
+    free(mem->dirty_pages);
+    free(mem);
+}
 
-        /* reg */
-        case PUSH:
-        case POP:
-            assert_operand_count(insn, 1);
-            assert_operand_is_register(insn, insn->op[0]);
-            break;
+/*
+ * simulator-only form that marks the end of the decoded program
+ */
 
-        /* reg, reg */
-        case I2I:
-        case NOT:
-        case NEG:
-        case LOAD:
-        case STORE:
-            assert_all_register_operands(insn, 2);
-            break;
+#define HALT            (PHI + 1)
 
-        /* reg, reg, reg */
-        case ADD:
-        case SUB:
-        case MULT:
-        case DIV:
-        case AND:
-        case OR:
-        case CMP_LT:
-        case CMP_LE:
-        case CMP_EQ:
-        case CMP_GE:
-        case CMP_GT:
-        case CMP_NE:
-        case LOAD_AO:
-        case STORE_AO:
-        case PHI:
-            assert_all_register_operands(insn, 3);
-            break;
+/*
+ * simulator-only superinstructions: each one replaces the form of the first
+ * instruction in a common pair and executes both (the second instruction stays
+ * decoded in place, so jumps and returns into it still work)
+ */
 
-        /* int, reg */
-        case LOAD_I:
-            assert_operand_count(insn, 2);
-            assert_operand_type(insn, insn->op[0], INT_CONST);
-            assert_operand_is_register(insn, insn->op[1]);
-            break;
+#define CMP_LT_CBR      (HALT + 1)
+#define CMP_LE_CBR      (HALT + 2)
+#define CMP_EQ_CBR      (HALT + 3)
+#define CMP_NE_CBR      (HALT + 4)
+#define CMP_GE_CBR      (HALT + 5)
+#define CMP_GT_CBR      (HALT + 6)
+#define LOAD_I_LOAD_AI  (HALT + 7)
+#define MULT_I_LOAD_AO  (HALT + 8)
+#define MULT_I_STORE_AO (HALT + 9)
+#define PUSH_CALL       (HALT + 10)
 
-        /* reg, int, reg */
-        case ADD_I:
-        case MULT_I:
-        case LOAD_AI:
-            assert_operand_count(insn, 3);
-            assert_operand_is_register(insn, insn->op[0]);
-            assert_operand_type(insn, insn->op[1], INT_CONST);
-            assert_operand_is_register(insn, insn->op[2]);
-            break;
+#define NUM_SIM_FORMS   (HALT + 11)
+
+/**
+ * @brief Pre-decoded ILOC instruction
+ *
+ * Each ILOC instruction is translated into one of these before the program
+ * runs, so that the simulator does not need to inspect operand types or follow
+ * list pointers and labels while executing. Instruction indices match the
+ * positions of the original instructions in the program list (labels included),
+ * so return addresses on the stack are the same as before decoding.
+ */
+typedef struct DecodedInsn
+{
+    /**
+     * @brief Address of the instruction's handler (threaded dispatch only)
+     */
+    const void* handler;
+
+    /**
+     * @brief Instruction form (an @ref InsnForm or @c HALT)
+     */
+    int form;
+
+    /**
+     * @brief Register file slots of register operands (@c NO_SLOT otherwise)
+     */
+    int r[3];
+
+    /**
+     * @brief Register file entries of register operands (NULL otherwise)
+     *
+     * Resolved when the program is loaded so that register accesses do not need
+     * to index the register file.
+     */
+    word_t* reg[3];
+
+    /**
+     * @brief Operands read as source registers (bit N set for operand N)
+     */
+    int reads;
+
+    /**
+     * @brief Immediate operand (if any)
+     */
+    word_t imm;
+
+    /**
+     * @brief Decoded instruction indices of jump and call targets
+     *
+     * The first entry is the target of JUMP and CALL and the "true" target of
+     * CBR; the second is the "false" target of CBR.
+     */
+    int target[2];
+
+    /**
+     * @brief String operand (PRINT only)
+     */
+    const char* str;
+
+    /**
+     * @brief Original instruction (for tracing and error messages)
+     */
+    ILOCInsn* insn;
+
+} DecodedInsn;
+
+/**
+ * @brief ILOC machine state structure
+ */
+typedef struct ILOCMachine
+{
+    /**
+     * @brief Register values (see the slot layout above)
+     */
+    word_t* reg;
+
+    /**
+     * @brief Number of virtual registers in the register file
+     */
+    int num_vregs;
+
+    /**
+     * @brief Program address space (memory w/ global variables and stack)
+     */
+    ILOCMemory* mem;
+
+    /**
+     * @brief Decoded program (i.e., code), terminated by a HALT instruction
+     *
+     * Note that instructions are NOT stored in the program's "address space."
+     */
+    DecodedInsn* code;
+
+    /**
+     * @brief Number of decoded instructions (not including the HALT)
+     */
+    int num_insns;
+
+    /**
+     * @brief Jump targets (instruction indices of labels indexed by jump label IDs)
+     */
+    int* jump_targets;
+
+    /**
+     * @brief Call targets (function name to instruction index)
+     */
+    CallTargetTable* call_targets;
+
+    /**
+     * @brief Optional features (tracing, profiling, etc.)
+     */
+    SimulatorOptions options;
+
+    /**
+     * @brief Most recently executed instruction (maintained only when instrumented)
+     */
+    DecodedInsn* last;
+
+    /**
+     * @brief Program output (PRINT instructions and warnings)
+     */
+    ProgramOutput* output;
+
+    /**
+     * @brief Whether @ref output was created by the machine (rather than the caller)
+     */
+    bool owns_output;
+
+    /**
+     * @brief Number of snapshots taken so far
+     */
+    int num_snapshots;
+
+    /**
+     * @brief Snapshot that memory writes are currently tracked against (0 if none)
+     */
+    int baseline;
+
+    /**
+     * @brief Outcome of the current run (filled in when it stops)
+     */
+    SimulatorResult* result;
+
+    /**
+     * @brief Where to resume when the run stops early (see @ref ILOCMachine_error)
+     */
+    jmp_buf abort;
+
+} ILOCMachine;
+
+/**
+ * @brief Saved machine state
+ */
+typedef struct ILOCSnapshot
+{
+    /**
+     * @brief Machine the snapshot was taken from
+     */
+    ILOCMachine* machine;
+
+    /**
+     * @brief Sequence number of the snapshot on its machine (starting at 1)
+     */
+    int id;
+
+    /**
+     * @brief Register values (including SP, BP, and RET)
+     */
+    word_t* reg;
+
+    /**
+     * @brief Memory contents
+     */
+    ILOCMemory* mem;
+
+} ILOCSnapshot;
+
+int ILOCMachine_reg_slot(Operand op)
+{
+    switch (op.type) {
+        case STACK_REG:  return SP_SLOT;
+        case BASE_REG:   return BP_SLOT;
+        case RETURN_REG: return RET_SLOT;
+        case VIRTUAL_REG:  return VR_SLOT(op.id);
+        case PHYSICAL_REG: return PR_SLOT(op.id);
+        default:
+            return NO_SLOT;
+    }
+}
+
+/*
+ * stop the current run with a runtime error (does not return; the message is
+ * reported through the run's result rather than printed)
+ */
+void ILOCMachine_error(ILOCMachine* machine, SimulatorStatus status, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(machine->result->message, MAX_ERROR_LEN, format, args);
+    va_end(args);
+    machine->result->status = status;
+    longjmp(machine->abort, 1);
+}
+
+/*
+ * warn about source registers that still hold UNINIT_REG (checked mode only);
+ * special registers are never reported (they start uninitialized too)
+ */
+void ILOCMachine_uninit_reads(ILOCMachine* machine, DecodedInsn* ip)
+{
+    for (int op = 0; op < 3; op++) {
+        if (!(ip->reads & (1 << op)) || *ip->reg[op] != UNINIT_REG) {
+            continue;
+        }
+        int slot = ip->r[op];
+        char warning[MAX_LINE_LEN];
+        if (slot >= VR_SLOT(0)) {
+            snprintf(warning, MAX_LINE_LEN,
+                    "WARNING: Potential uninitialized read from register r%d\n", slot - VR_SLOT(0));
+        } else if (slot >= PR_SLOT(0)) {
+            snprintf(warning, MAX_LINE_LEN,
+                    "WARNING: Potential uninitialized read from register R%d\n", slot - PR_SLOT(0));
+        } else {
+            continue;
+        }
+        ProgramOutput_write_str(machine->output, warning);
+    }
+}
+
+static inline void ILOCMachine_set_mem(ILOCMachine* machine, word_t address, word_t value)
+{
+    if (address < 0 || address > machine->mem->size - WORD_SIZE) {
+        ILOCMachine_error(machine, SIM_ERROR, "ERROR: Address " PRIW " is invalid (out of range)", address);
+    }
+    /* actual memory write */
+    ILOCMemory_write(machine->mem, address, value);
+}
+
+static inline word_t ILOCMachine_get_mem(ILOCMachine* machine, word_t address)
+{
+    if (address < 0 || address > machine->mem->size - WORD_SIZE) {
+        ILOCMachine_error(machine, SIM_ERROR, "ERROR: Address " PRIW " is invalid (out of range)", address);
+    }
+    /* actual memory read */
+    return ILOCMemory_read(machine->mem, address);
+}
+
+void ILOCMachine_print(ILOCMachine* machine, FILE* output)
+{
+    fprintf(output, "==========================\n");
+
+    /* registers (special and virtual) */
+    fprintf(output, "sp=" PRIW " bp=" PRIW " ret=" PRIW "\n",
+            machine->reg[SP_SLOT], machine->reg[BP_SLOT], machine->reg[RET_SLOT]);
+    fprintf(output, "registers: ");
+    for (int i = 0; i < machine->num_vregs; i++) {
+        if (machine->reg[VR_SLOT(i)] != UNINIT_REG) {
+            fprintf(output, " r%d=" PRIW, i, machine->reg[VR_SLOT(i)]);
+        }
+    }
+    for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
+        if (machine->reg[PR_SLOT(i)] != UNINIT_REG) {
+            fprintf(output, " R%d=" PRIW, i, machine->reg[PR_SLOT(i)]);
+        }
+    }
+    fprintf(output, "\n");
+
+    /* stack (memory from the end of the address space down to stack pointer) */
+    fprintf(output, "stack:");
+    for (word_t addr = machine->mem->size - WORD_SIZE; addr >= machine->reg[SP_SLOT]; addr -= WORD_SIZE) {
+        fprintf(output, "  " PRIW ": " PRIW, addr, ILOCMachine_get_mem(machine, addr));
+    }
+    fprintf(output, "\n");
+
+    /* other memory (any WORD_SIZE-aligned value that is non-zero; skips unwritten pages) */
+    fprintf(output, "other memory:");
+    for (word_t addr = STATIC_VAR_OFFSET; addr < machine->reg[SP_SLOT]; addr += WORD_SIZE) {
+        if (!ILOCMemory_is_mapped(machine->mem, addr)) {
+            addr += MEM_PAGE_SIZE - addr % MEM_PAGE_SIZE - WORD_SIZE;
+            continue;
+        }
+        word_t value = ILOCMachine_get_mem(machine, addr);
+        if (value != 0) {
+            fprintf(output, "  " PRIW ": " PRIW, addr, value);
+        }
+    }
+    fprintf(output, "\n");
+
+    fprintf(output, "==========================\n");
+}
+
+void ILOCMachine_free (ILOCMachine* machine)
+{
+    if (machine->owns_output) {
+        ProgramOutput_free(machine->output);
+    }
+    CallTargetTable_free(machine->call_targets);
+    ILOCMemory_free(machine->mem);
+    free(machine->reg);
+    free(machine->code);
+    free(machine->jump_targets);
+    free(machine);
+}
+
+void assert_operand_count (ILOCInsn* insn, int count)
+{
+    int actual_count = ILOCInsn_get_operand_count(insn);
+    if (actual_count != count) {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: Invalid instruction (expected %d operands but found %d): ",
+                count, actual_count);
+        ILOCInsn_print(insn, err);
+        invalid_program_end(err);
+    }
+}
+
+void assert_operand_is_register (ILOCInsn* insn, Operand op)
+{
+    if (op.type != STACK_REG  && op.type != BASE_REG &&
+        op.type != RETURN_REG && op.type != VIRTUAL_REG && op.type != PHYSICAL_REG)
+    {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: Invalid operand '");
+        Operand_print(op, err);
+        fprintf(err, "' (expected register): ");
+        ILOCInsn_print(insn, err);
+        invalid_program_end(err);
+    }
+}
+
+void assert_all_register_operands (ILOCInsn* insn, int count)
+{
+    assert_operand_count(insn, count);
+    for (int i = 0; i < count; i++) {
+        assert_operand_is_register(insn, insn->op[i]);
+    }
+}
+
+void assert_operand_type (ILOCInsn* insn, Operand op, OperandType type)
+{
+    if (op.type != type) {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: Invalid operand '");
+        Operand_print(op, err);
+        fprintf(err, "': ");
+        ILOCInsn_print(insn, err);
+        invalid_program_end(err);
+    }
+}
+
+void assert_valid_insn (ILOCInsn* insn)
+{
+    switch (insn->form)
+    {
+        /* no operands */
+        case RETURN:
+        case NOP:
+            assert_operand_count(insn, 0);
+            break;
+
+        /* reg */
+        case PUSH:
+        case POP:
+            assert_operand_count(insn, 1);
+            assert_operand_is_register(insn, insn->op[0]);
+            break;
+
+        /* reg, reg */
+        case I2I:
+        case NOT:
+        case NEG:
+        case LOAD:
+        case STORE:
+            assert_all_register_operands(insn, 2);
+            break;
+
+        /* reg, reg, reg */
+        case ADD:
+        case SUB:
+        case MULT:
+        case DIV:
+        case AND:
+        case OR:
+        case CMP_LT:
+        case CMP_LE:
+        case CMP_EQ:
+        case CMP_GE:
+        case CMP_GT:
+        case CMP_NE:
+        case LOAD_AO:
+        case STORE_AO:
+        case PHI:
+            assert_all_register_operands(insn, 3);
+            break;
+
+        /* int, reg */
+        case LOAD_I:
+            assert_operand_count(insn, 2);
+            assert_operand_type(insn, insn->op[0], INT_CONST);
+            assert_operand_is_register(insn, insn->op[1]);
+            break;
+
+        /* reg, int, reg */
+        case ADD_I:
+        case MULT_I:
+        case LOAD_AI:
+            assert_operand_count(insn, 3);
+            assert_operand_is_register(insn, insn->op[0]);
+            assert_operand_type(insn, insn->op[1], INT_CONST);
+            assert_operand_is_register(insn, insn->op[2]);
+            break;
 
         /* reg, reg, int */
         case STORE_AI:
@@ -878,12 +1336,12 @@ void assert_valid_insn (ILOCInsn* insn)
             if (insn->op[0].type != CALL_LABEL &&
                 insn->op[0].type != JUMP_LABEL)
             {
-                printf("Invalid label '");
-                Operand_print(insn->op[0], stdout);
-                printf("': ");
-                ILOCInsn_print(insn, stdout);
-                printf("\n");
-                exit(EXIT_FAILURE);
+                FILE* err = invalid_program_begin();
+                fprintf(err, "Invalid label '");
+                Operand_print(insn->op[0], err);
+                fprintf(err, "': ");
+                ILOCInsn_print(insn, err);
+                invalid_program_end(err);
             }
             break;
 
@@ -898,209 +1356,766 @@ void assert_valid_insn (ILOCInsn* insn)
                 insn->op[0].type != INT_CONST &&
                 insn->op[0].type != STR_CONST)
             {
-                printf("Invalid parameter '");
-                Operand_print(insn->op[0], stdout);
-                printf("': ");
-                ILOCInsn_print(insn, stdout);
-                printf("\n");
-                exit(EXIT_FAILURE);
+                FILE* err = invalid_program_begin();
+                fprintf(err, "Invalid parameter '");
+                Operand_print(insn->op[0], err);
+                fprintf(err, "': ");
+                ILOCInsn_print(insn, err);
+                invalid_program_end(err);
             }
             break;
 
         default:
-            printf("Unrecognized instruction: ");
-            ILOCInsn_print(insn, stdout);
-            printf("\n");
-            exit(EXIT_FAILURE);
+        {
+            FILE* err = invalid_program_begin();
+            fprintf(err, "Unrecognized instruction: ");
+            ILOCInsn_print(insn, err);
+            invalid_program_end(err);
+        }
+    }
+}
+
+
+void assert_register_in_range (ILOCInsn* insn, Operand op)
+{
+    if ((op.type == VIRTUAL_REG  && op.id < 0) ||
+        (op.type == PHYSICAL_REG && (op.id < 0 || op.id >= MAX_PHYSICAL_REGS)))
+    {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: Register ");
+        Operand_print(op, err);
+        fprintf(err, " does not exist: ");
+        ILOCInsn_print(insn, err);
+        invalid_program_end(err);
+    }
+}
+
+void assert_label_defined (ILOCInsn* insn, Operand op, bool* defined)
+{
+    if (op.type == JUMP_LABEL && !defined[op.id]) {
+        FILE* err = invalid_program_begin();
+        fprintf(err, "ERROR: Undefined jump label '");
+        Operand_print(op, err);
+        fprintf(err, "': ");
+        ILOCInsn_print(insn, err);
+        invalid_program_end(err);
     }
 }
 
 /*
- * shortcut macros to make the simulator code cleaner
+ * verify a program using caller-allocated label tables (so that check_program
+ * can still deallocate them when a problem is reported)
  */
+void verify_program_with_tables (InsnList* program, bool* defined, CallTargetTable* functions)
+{
+    /* operand forms and ranges; collect labels */
+    int index = 0;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        assert_valid_insn(insn);
+        for (int op = 0; op < 3; op++) {
+            assert_register_in_range(insn, insn->op[op]);
+            if (insn->op[op].type == JUMP_LABEL &&
+                    insn->op[op].id < 0) {
+                FILE* err = invalid_program_begin();
+                fprintf(err, "ERROR: Jump label ID %d is out of range: ", insn->op[op].id);
+                ILOCInsn_print(insn, err);
+                invalid_program_end(err);
+            }
+        }
+        if (insn->form == LABEL) {
+            if (insn->op[0].type == JUMP_LABEL) {
+                if (defined[insn->op[0].id]) {
+                    FILE* err = invalid_program_begin();
+                    fprintf(err, "ERROR: Duplicate jump label: ");
+                    ILOCInsn_print(insn, err);
+                    invalid_program_end(err);
+                }
+                defined[insn->op[0].id] = true;
+            } else {
+                CallTargetTable_add_new(functions, insn->op[0].str, index);
+            }
+        }
+        index++;
+    }
 
-#define OP0    (machine->pc->op[0])
-#define OP1    (machine->pc->op[1])
-#define OP2    (machine->pc->op[2])
-#define IMMOP0 (machine->pc->op[0].imm)
-#define IMMOP1 (machine->pc->op[1].imm)
-#define IMMOP2 (machine->pc->op[2].imm)
-#define STROP0 (machine->pc->op[0].str)
-
-#define SET_REG(OP,VAL)   ILOCMachine_set_reg(machine, (OP), (VAL))
-#define GET_REG(OP)       ILOCMachine_get_reg(machine, (OP))
-#define SET_MEM(ADDR,VAL) ILOCMachine_set_mem(machine, (ADDR), (VAL))
-#define GET_MEM(ADDR)     ILOCMachine_get_mem(machine, (ADDR))
+    /* control transfers (CallTargetTable_find aborts on unknown functions) */
+    FOR_EACH (ILOCInsn*, insn, program) {
+        if (insn->form == JUMP || insn->form == CBR) {
+            for (int op = 0; op < 3; op++) {
+                assert_label_defined(insn, insn->op[op], defined);
+            }
+        } else if (insn->form == CALL) {
+            CallTargetTable_find(functions, insn->op[0].str);
+        }
+    }
+    CallTargetTable_find(functions, "main");
+}
 
-#define PUSH(VAL)   machine->sp -= WORD_SIZE; \
-                    if (machine->sp <= STATIC_VAR_OFFSET) { \
-                        printf("ERROR: Stack overflow\n"); \
-                        exit(EXIT_FAILURE); \
-                    } \
-                    ILOCMachine_set_mem(machine, machine->sp, (VAL));
+void verify_program (InsnList* program)
+{
+    bool* defined = (bool*)calloc(InsnList_max_id(program, JUMP_LABEL) + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(defined);
+    CallTargetTable* functions = CallTargetTable_new();
+    verify_program_with_tables(program, defined, functions);
+    CallTargetTable_free(functions);
+    free(defined);
+}
 
-#define POP(LOC)    if (machine->sp > MEM_SIZE - WORD_SIZE) { \
-                        printf("ERROR: Cannot pop from empty stack\n"); \
-                        exit(EXIT_FAILURE); \
-                    } \
-                    *(LOC) = ILOCMachine_get_mem(machine, machine->sp); \
-                    machine->sp += WORD_SIZE;
+bool check_program (InsnList* program, char* message)
+{
+    bool* defined = (bool*)calloc(InsnList_max_id(program, JUMP_LABEL) + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(defined);
+    CallTargetTable* functions = CallTargetTable_new();
+    ProgramCheck check = { .message = message };
+    ProgramCheck* enclosing = current_check;
+    current_check = &check;
+    bool valid;
+    if (setjmp(check.abort) == 0) {
+        verify_program_with_tables(program, defined, functions);
+        message[0] = '\0';
+        valid = true;
+    } else {
+        valid = false;
+    }
+    current_check = enclosing;
+    CallTargetTable_free(functions);
+    free(defined);
+    return valid;
+}
 
-#define TIMEOUT_NUM_INSTRUCTIONS 100000000
+/*
+ * determine which register operands an instruction reads (see the simulator loop)
+ */
+int source_operands (DecodedInsn* d)
+{
+    int reads = 0;
+    switch (d->form) {
+        case LOAD: case LOAD_AI: case ADD_I: case MULT_I: case I2I: case NOT:
+        case NEG: case PUSH: case CBR: case PRINT:
+            reads = 1;
+            break;
+        case LOAD_AO: case STORE: case STORE_AI: case ADD: case SUB: case MULT:
+        case DIV: case AND: case OR: case CMP_LT: case CMP_LE: case CMP_EQ:
+        case CMP_NE: case CMP_GE: case CMP_GT:
+            reads = 3;
+            break;
+        case STORE_AO:
+            reads = 7;
+            break;
+        default:
+            break;
+    }
+    for (int op = 0; op < 3; op++) {
+        if (d->r[op] == NO_SLOT) {
+            reads &= ~(1 << op);
+        }
+    }
+    return reads;
+}
 
-int run_simulator (InsnList* program, bool print_trace)
+/*
+ * translate a (verified) program into the machine's decoded instruction array
+ */
+void ILOCMachine_load (ILOCMachine* machine, InsnList* program)
 {
-    /* initialize machine */
-    ILOCMachine* machine = ILOCMachine_new();
-    machine->sp = MEM_SIZE;
+    /* size the register file and code tables for this program */
+    int num_insns = 0;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        num_insns++;
+    }
+    machine->num_insns = num_insns;
+    machine->num_vregs = InsnList_max_id(program, VIRTUAL_REG) + 1;
+    machine->reg = (word_t*)malloc(NUM_REG_SLOTS(machine->num_vregs) * sizeof(word_t));
+    machine->code = (DecodedInsn*)calloc(num_insns + 1, sizeof(DecodedInsn));
+    machine->jump_targets = (int*)calloc(InsnList_max_id(program, JUMP_LABEL) + 1, sizeof(int));
+    CHECK_MALLOC_PTR(machine->reg);
+    CHECK_MALLOC_PTR(machine->code);
+    CHECK_MALLOC_PTR(machine->jump_targets);
+
+    /* set all registers to special "uninitialized" value (helps find code gen bugs) */
+    for (int i = 0; i < NUM_REG_SLOTS(machine->num_vregs); i++) {
+        machine->reg[i] = UNINIT_REG;
+    }
+    machine->reg[SP_SLOT] = machine->mem->size;
 
     /* build jump and call target indices */
     int i = 0;
     FOR_EACH (ILOCInsn*, insn, program) {
-        machine->instructions[i++] = insn;
         if (insn->form == LABEL) {
             if (insn->op[0].type == JUMP_LABEL) {
-                machine->jump_targets[insn->op[0].id] = insn;
+                machine->jump_targets[insn->op[0].id] = i;
             } else {
-                CallTargetList_add_new(machine->call_targets, insn->op[0].str, insn);
+                CallTargetTable_add_new(machine->call_targets, insn->op[0].str, i);
             }
         }
+        i++;
     }
 
-    /* search for main and begin there */
-    machine->pc = CallTargetList_find(machine->call_targets, "main")->next;
+    /* decode instructions; control transfers skip over the target label */
+    i = 0;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        DecodedInsn* d = &machine->code[i++];
+        d->form = insn->form;
+        d->insn = insn;
+        for (int op = 0; op < 3; op++) {
+            Operand* o = &insn->op[op];
+            d->r[op] = ILOCMachine_reg_slot(*o);
+            d->reg[op] = (d->r[op] != NO_SLOT ? &machine->reg[d->r[op]] : NULL);
+            switch (o->type) {
+                case INT_CONST:
+                    d->imm = o->imm;
+                    break;
+                case STR_CONST:
+                    d->str = o->str;
+                    break;
+                case JUMP_LABEL:
+                    d->target[op == 2 ? 1 : 0] = machine->jump_targets[o->id] + 1;
+                    break;
+                case CALL_LABEL:
+                    if (insn->form == CALL) {
+                        d->target[0] = CallTargetTable_find(machine->call_targets, o->str) + 1;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        d->reads = source_operands(d);
+    }
+    machine->code[i].form = HALT;
+    machine->code[i].r[0] = machine->code[i].r[1] = machine->code[i].r[2] = NO_SLOT;
+}
 
-    /* main program loop */
-    int num_instructions_executed = 0;
-    while (machine->pc != NULL) {
+/*
+ * replace common instruction pairs with superinstructions (only used when no
+ * per-instruction checks or instrumentation are needed, since a superinstruction
+ * executes its second instruction without dispatching it)
+ */
+void ILOCMachine_fuse (ILOCMachine* machine)
+{
+    static const struct {
+        int first, second, fused;
+    } pairs[] = {
+        { CMP_LT, CBR, CMP_LT_CBR }, { CMP_LE, CBR, CMP_LE_CBR },
+        { CMP_EQ, CBR, CMP_EQ_CBR }, { CMP_NE, CBR, CMP_NE_CBR },
+        { CMP_GE, CBR, CMP_GE_CBR }, { CMP_GT, CBR, CMP_GT_CBR },
+        { LOAD_I, LOAD_AI, LOAD_I_LOAD_AI },
+        { MULT_I, LOAD_AO, MULT_I_LOAD_AO }, { MULT_I, STORE_AO, MULT_I_STORE_AO },
+        { PUSH, CALL, PUSH_CALL }
+    };
+    DecodedInsn* code = machine->code;
+    for (int i = 0; i + 1 < machine->num_insns; i++) {
+        for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+            if (code[i].form == pairs[p].first && code[i+1].form == pairs[p].second) {
+                code[i].form = pairs[p].fused;
+                i++;
+                break;
+            }
+        }
+    }
+}
 
-        /* assumes no jumps; may be overwritten later */
-        ILOCInsn* next_insn = machine->pc->next;
+/*
+ * use computed-goto ("threaded") dispatch where the compiler supports it, and
+ * fall back on a plain switch otherwise (or if ILOC_SWITCH_DISPATCH is defined)
+ */
 
-        /* print trace debug info if desired */
-        if (print_trace) {
-            printf("\n");
-            ILOCMachine_print(machine, stdout);
-            printf("\nExecuting: ");
-            ILOCInsn_print(machine->pc, stdout);
-            printf("\n");
-        }
+#if defined(__GNUC__) && !defined(ILOC_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
 
-        /* verify that current instruction is valid */
-        assert_valid_insn(machine->pc);
+/*
+ * shortcut macros to make the simulator code cleaner
+ */
 
-        /* handle current instruction */
-        switch (machine->pc->form)
-        {
-            case LOAD_I:   SET_REG(OP1, IMMOP0);                               break;
-            case LOAD:     SET_REG(OP1, GET_MEM(GET_REG(OP0)));                break;
-            case LOAD_AI:  SET_REG(OP2, GET_MEM(GET_REG(OP0) + IMMOP1));       break;
-            case LOAD_AO:  SET_REG(OP2, GET_MEM(GET_REG(OP0) + GET_REG(OP1))); break;
-            case STORE:    SET_MEM(GET_REG(OP1),                GET_REG(OP0)); break;
-            case STORE_AI: SET_MEM(GET_REG(OP1) + IMMOP2,       GET_REG(OP0)); break;
-            case STORE_AO: SET_MEM(GET_REG(OP1) + GET_REG(OP2), GET_REG(OP0)); break;
-
-            case ADD:    SET_REG(OP2, GET_REG(OP0) +  GET_REG(OP1)); break;
-            case SUB:    SET_REG(OP2, GET_REG(OP0) -  GET_REG(OP1)); break;
-            case MULT:   SET_REG(OP2, GET_REG(OP0) *  GET_REG(OP1)); break;
-            case DIV:    SET_REG(OP2, GET_REG(OP0) /  GET_REG(OP1)); break;
-            case AND:    SET_REG(OP2, GET_REG(OP0) &  GET_REG(OP1)); break;
-            case OR:     SET_REG(OP2, GET_REG(OP0) |  GET_REG(OP1)); break;
-            case CMP_LT: SET_REG(OP2, GET_REG(OP0) <  GET_REG(OP1)); break;
-            case CMP_LE: SET_REG(OP2, GET_REG(OP0) <= GET_REG(OP1)); break;
-            case CMP_EQ: SET_REG(OP2, GET_REG(OP0) == GET_REG(OP1)); break;
-            case CMP_NE: SET_REG(OP2, GET_REG(OP0) != GET_REG(OP1)); break;
-            case CMP_GE: SET_REG(OP2, GET_REG(OP0) >= GET_REG(OP1)); break;
-            case CMP_GT: SET_REG(OP2, GET_REG(OP0) >  GET_REG(OP1)); break;
-
-            case ADD_I:  SET_REG(OP2, GET_REG(OP0) + IMMOP1); break;
-            case MULT_I: SET_REG(OP2, GET_REG(OP0) * IMMOP1); break;
-
-            case I2I:    SET_REG(OP1,    GET_REG(OP0) );    break;
-            case NOT:    SET_REG(OP1, ((~GET_REG(OP0))&1)); break;
-            case NEG:    SET_REG(OP1,  -(GET_REG(OP0)));    break;
-
-            case PUSH:
-                PUSH(GET_REG(OP0));
-                break;
+#define IMM     (ip->imm)
+#define STR     (ip->str)
+#define DST(N)  (*ip->reg[N])
+#define SRC(N)  (*ip->reg[N])
 
-            case POP:
-            {
-                word_t tmp;
-                POP(&tmp);
-                SET_REG(OP0, tmp);
-                break;
+#define SET_MEM(ADDR,VAL) ILOCMachine_set_mem(machine, (ADDR), (VAL))
+#define GET_MEM(ADDR)     ILOCMachine_get_mem(machine, (ADDR))
+
+#define PUSH(VAL)   reg[SP_SLOT] -= WORD_SIZE; \
+                    if (reg[SP_SLOT] <= STATIC_VAR_OFFSET) { \
+                        ILOCMachine_error(machine, SIM_ERROR, "ERROR: Stack overflow"); \
+                    } \
+                    ILOCMachine_set_mem(machine, reg[SP_SLOT], (VAL));
+
+#define POP(LOC)    if (reg[SP_SLOT] > machine->mem->size - WORD_SIZE) { \
+                        ILOCMachine_error(machine, SIM_ERROR, "ERROR: Cannot pop from empty stack"); \
+                    } \
+                    *(LOC) = ILOCMachine_get_mem(machine, reg[SP_SLOT]); \
+                    reg[SP_SLOT] += WORD_SIZE;
+
+#define TIMEOUT_NUM_INSTRUCTIONS 100000000
+
+/* whether operand N is a source register holding UNINIT_REG (checked mode) */
+#define READS_UNINIT(N) ((ip->reads & (1 << (N))) && *ip->reg[N] == UNINIT_REG)
+
+/* checks done before every instruction */
+#define STEP_CHECKS \
+    if (slow_path) { \
+        if (instrumented) { \
+            ILOCMachine_instrument(machine, ip); \
+        } \
+        if (checked && READS_UNINIT(0) | READS_UNINIT(1) | READS_UNINIT(2)) { \
+            ILOCMachine_uninit_reads(machine, ip); \
+        } \
+    } \
+    if (++num_instructions_executed > TIMEOUT_NUM_INSTRUCTIONS) { \
+        ILOCMachine_error(machine, SIM_TIMEOUT, \
+                "TIMEOUT: Program executed too many instructions (probably an infinite loop)"); \
+    }
+
+/*
+ * record the effects of an executed instruction in the binary trace (called
+ * afterwards, so written registers and stored words hold their new values)
+ */
+void ILOCMachine_record (ILOCMachine* machine, DecodedInsn* d)
+{
+    word_t* reg = machine->reg;
+    TraceRecord record = { .pc = (uint32_t)(d - machine->code) };
+    int written = NO_SLOT;
+    word_t address = -1;
+    switch (d->form) {
+        case LOAD_I:  case LOAD:   case I2I:    case NOT:    case NEG:
+            written = d->r[1];
+            break;
+        case LOAD_AI: case LOAD_AO: case ADD_I: case MULT_I:
+        case ADD:     case SUB:    case MULT:   case DIV:    case AND:   case OR:
+        case CMP_LT:  case CMP_LE: case CMP_EQ: case CMP_NE: case CMP_GE: case CMP_GT:
+            written = d->r[2];
+            break;
+        case POP:
+            record.reg_slot[record.num_reg_writes++] = SP_SLOT;
+            written = d->r[0];
+            break;
+        case PUSH:
+        case CALL:
+            record.reg_slot[record.num_reg_writes++] = SP_SLOT;
+            address = reg[SP_SLOT];
+            break;
+        case RETURN:
+            record.reg_slot[record.num_reg_writes++] = SP_SLOT;
+            break;
+        case STORE:    address = reg[d->r[1]];                break;
+        case STORE_AI: address = reg[d->r[1]] + d->imm;       break;
+        case STORE_AO: address = reg[d->r[1]] + reg[d->r[2]]; break;
+        default:
+            break;
+    }
+    if (written != NO_SLOT) {
+        record.reg_slot[record.num_reg_writes++] = (uint32_t)written;
+    }
+    for (int i = 0; i < record.num_reg_writes; i++) {
+        record.reg_value[i] = reg[record.reg_slot[i]];
+    }
+    if (address >= 0) {
+        record.mem_write = true;
+        record.mem_address = (uint32_t)address;
+        record.mem_value = ILOCMachine_get_mem(machine, address);
+    }
+    TraceWriter_write(machine->options.trace, &record);
+}
+
+/*
+ * per-instruction instrumentation (debug tracing, profiling, binary traces);
+ * called before executing ip, which may be the final HALT
+ */
+void ILOCMachine_instrument (ILOCMachine* machine, DecodedInsn* ip)
+{
+    if (machine->options.trace != NULL && machine->last != NULL) {
+        ILOCMachine_record(machine, machine->last);
+    }
+    if (ip->form == HALT) {
+        machine->last = NULL;
+        return;
+    }
+    machine->last = ip;
+
+    if (machine->options.print_trace) {
+        ProgramOutput_flush(machine->output);
+        printf("\n");
+        ILOCMachine_print(machine, stdout);
+        printf("\nExecuting: ");
+        ILOCInsn_print(ip->insn, stdout);
+        printf("\n");
+
+        /* full validation only when debugging */
+        assert_valid_insn(ip->insn);
+    }
+    if (machine->options.profile != NULL) {
+        ILOCProfile_step(machine->options.profile, (int)(ip - machine->code));
+    }
+}
+
+#ifdef THREADED_DISPATCH
+#define CASE(F)     do_##F:
+#define NEXT        STEP_CHECKS; goto *ip->handler;
+#else
+#define CASE(F)     case F:
+#define NEXT        continue;
+#endif
+
+/* advance to the following instruction */
+#define FALL        ip++; NEXT
+
+/* move on to the second half of a superinstruction (counts as executed) */
+#define FUSE        ip++; num_instructions_executed++;
+
+/* compare-and-branch superinstruction */
+#define CMP_CBR(CMP,OP) \
+        CASE(CMP_##CMP##_CBR) \
+            DST(2) = SRC(0) OP SRC(1); \
+            FUSE \
+            ip = &code[(bool)SRC(0) ? ip->target[0] : ip->target[1]]; \
+            NEXT
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/*
+ * run a loaded machine from the given instruction index until main() returns
+ */
+void ILOCMachine_execute (ILOCMachine* machine, int start)
+{
+    word_t* reg = machine->reg;
+    DecodedInsn* code = machine->code;
+    DecodedInsn* ip = &code[start];
+    long num_instructions_executed = 0;
+    bool instrumented = machine->options.print_trace ||
+        machine->options.profile != NULL || machine->options.trace != NULL;
+    bool checked = !machine->options.unchecked;
+    bool slow_path = instrumented || checked;
+
+#ifdef THREADED_DISPATCH
+    static const void* handlers[NUM_SIM_FORMS] = {
+        [LOAD_I] = &&do_LOAD_I, [LOAD] = &&do_LOAD, [LOAD_AI] = &&do_LOAD_AI,
+        [LOAD_AO] = &&do_LOAD_AO, [STORE] = &&do_STORE, [STORE_AI] = &&do_STORE_AI,
+        [STORE_AO] = &&do_STORE_AO, [ADD] = &&do_ADD, [SUB] = &&do_SUB,
+        [MULT] = &&do_MULT, [DIV] = &&do_DIV, [AND] = &&do_AND, [OR] = &&do_OR,
+        [CMP_LT] = &&do_CMP_LT, [CMP_LE] = &&do_CMP_LE, [CMP_EQ] = &&do_CMP_EQ,
+        [CMP_NE] = &&do_CMP_NE, [CMP_GE] = &&do_CMP_GE, [CMP_GT] = &&do_CMP_GT,
+        [ADD_I] = &&do_ADD_I, [MULT_I] = &&do_MULT_I, [I2I] = &&do_I2I,
+        [NOT] = &&do_NOT, [NEG] = &&do_NEG, [PUSH] = &&do_PUSH, [POP] = &&do_POP,
+        [JUMP] = &&do_JUMP, [CBR] = &&do_CBR, [CALL] = &&do_CALL,
+        [RETURN] = &&do_RETURN, [PRINT] = &&do_PRINT, [LABEL] = &&do_LABEL,
+        [NOP] = &&do_NOP, [PHI] = &&do_PHI, [HALT] = &&do_HALT,
+        [CMP_LT_CBR] = &&do_CMP_LT_CBR, [CMP_LE_CBR] = &&do_CMP_LE_CBR,
+        [CMP_EQ_CBR] = &&do_CMP_EQ_CBR, [CMP_NE_CBR] = &&do_CMP_NE_CBR,
+        [CMP_GE_CBR] = &&do_CMP_GE_CBR, [CMP_GT_CBR] = &&do_CMP_GT_CBR,
+        [LOAD_I_LOAD_AI] = &&do_LOAD_I_LOAD_AI, [MULT_I_LOAD_AO] = &&do_MULT_I_LOAD_AO,
+        [MULT_I_STORE_AO] = &&do_MULT_I_STORE_AO, [PUSH_CALL] = &&do_PUSH_CALL
+    };
+    for (int i = 0; i <= machine->num_insns; i++) {
+        code[i].handler = handlers[code[i].form];
+    }
+    NEXT
+#else
+    for (;;) {
+        STEP_CHECKS
+        switch (ip->form)
+#endif
+    {
+        CASE(LOAD_I)   DST(1) = IMM;                                  FALL
+        CASE(LOAD)     DST(1) = GET_MEM(SRC(0));                      FALL
+        CASE(LOAD_AI)  DST(2) = GET_MEM(SRC(0) + IMM);                FALL
+        CASE(LOAD_AO)  DST(2) = GET_MEM(SRC(0) + SRC(1));             FALL
+        CASE(STORE)    SET_MEM(SRC(1),          SRC(0));              FALL
+        CASE(STORE_AI) SET_MEM(SRC(1) + IMM,    SRC(0));              FALL
+        CASE(STORE_AO) SET_MEM(SRC(1) + SRC(2), SRC(0));              FALL
+
+        CASE(ADD)    DST(2) = SRC(0) +  SRC(1); FALL
+        CASE(SUB)    DST(2) = SRC(0) -  SRC(1); FALL
+        CASE(MULT)   DST(2) = SRC(0) *  SRC(1); FALL
+        CASE(DIV)
+            if (SRC(1) == 0) {
+                ILOCMachine_error(machine, SIM_ERROR, "ERROR: Division by zero");
+            } else if (SRC(1) == -1 && SRC(0) == WORD_MIN) {
+                ILOCMachine_error(machine, SIM_ERROR, "ERROR: Division overflow (" PRIW " / -1)", SRC(0));
             }
+            DST(2) = SRC(0) / SRC(1);
+            FALL
+        CASE(AND)    DST(2) = SRC(0) &  SRC(1); FALL
+        CASE(OR)     DST(2) = SRC(0) |  SRC(1); FALL
+        CASE(CMP_LT) DST(2) = SRC(0) <  SRC(1); FALL
+        CASE(CMP_LE) DST(2) = SRC(0) <= SRC(1); FALL
+        CASE(CMP_EQ) DST(2) = SRC(0) == SRC(1); FALL
+        CASE(CMP_NE) DST(2) = SRC(0) != SRC(1); FALL
+        CASE(CMP_GE) DST(2) = SRC(0) >= SRC(1); FALL
+        CASE(CMP_GT) DST(2) = SRC(0) >  SRC(1); FALL
+
+        CASE(ADD_I)  DST(2) = SRC(0) + IMM; FALL
+        CASE(MULT_I) DST(2) = SRC(0) * IMM; FALL
+
+        CASE(I2I)    DST(1) =    SRC(0);     FALL
+        CASE(NOT)    DST(1) = ((~SRC(0))&1); FALL
+        CASE(NEG)    DST(1) =  -(SRC(0));    FALL
+
+        CASE(PUSH)
+        {
+            PUSH(SRC(0));
+            FALL
+        }
 
-            case JUMP:
-                next_insn = machine->jump_targets[OP0.id]->next;
-                break;
+        CASE(POP)
+        {
+            word_t tmp;
+            POP(&tmp);
+            DST(0) = tmp;
+            FALL
+        }
 
-            case CBR:
-                if ((bool)GET_REG(OP0)) {
-                    next_insn = machine->jump_targets[OP1.id]->next;
-                } else {
-                    next_insn = machine->jump_targets[OP2.id]->next;
-                }
-                break;
+        CASE(JUMP)
+            ip = &code[ip->target[0]];
+            NEXT
 
-            case CALL:
-            {
-                /* calculate index of next instruction */
-                int idx = 0;
-                for (next_insn = program->head;
-                     next_insn != NULL && next_insn != machine->pc->next;
-                     next_insn = next_insn->next) {
-                    idx++;
-                }
-                PUSH((word_t)idx);
-                next_insn = CallTargetList_find(machine->call_targets, STROP0)->next;
-                break;
+        CASE(CBR)
+            ip = &code[(bool)SRC(0) ? ip->target[0] : ip->target[1]];
+            NEXT
+
+        CASE(CALL)
+        {
+            /* return address is the index of the next instruction */
+            PUSH((word_t)(ip - code + 1));
+            ip = &code[ip->target[0]];
+            NEXT
+        }
+
+        CASE(RETURN)
+        {
+            if (reg[SP_SLOT] == machine->mem->size) {
+                /* stack is empty, so this must be the return from main() */
+                return;
             }
+            word_t tmp;
+            POP(&tmp);
+            if (tmp < 0 || tmp > machine->num_insns) {
+                ILOCMachine_error(machine, SIM_ERROR, "ERROR: Invalid return address " PRIW, tmp);
+            }
+            ip = &code[tmp];
+            NEXT
+        }
 
-            case RETURN:
-            {
-                if (machine->sp == MEM_SIZE) {
-                    /* stack is empty, so this must be the return from main() */
-                    next_insn = NULL;
-                    break;
-                }
-                word_t tmp;
-                POP(&tmp);
-                next_insn = machine->instructions[tmp];
-                break;
+        CASE(PRINT)
+            if (STR != NULL) {
+                ProgramOutput_write_str(machine->output, STR);
+            } else if (ip->r[0] != NO_SLOT) {
+                ProgramOutput_write_int(machine->output, SRC(0));
+            } else {
+                ProgramOutput_write_int(machine->output, IMM);
             }
+            FALL
+
+        CASE(LABEL)
+        CASE(NOP)
+        CASE(PHI)
+            /* nothing to do */
+            FALL
+
+        CASE(HALT)
+            /* fell off the end of the program */
+            return;
+
+        CMP_CBR(LT, <)
+        CMP_CBR(LE, <=)
+        CMP_CBR(EQ, ==)
+        CMP_CBR(NE, !=)
+        CMP_CBR(GE, >=)
+        CMP_CBR(GT, >)
+
+        CASE(LOAD_I_LOAD_AI)
+            DST(1) = IMM;
+            FUSE
+            DST(2) = GET_MEM(SRC(0) + IMM);
+            FALL
+
+        CASE(MULT_I_LOAD_AO)
+            DST(2) = SRC(0) * IMM;
+            FUSE
+            DST(2) = GET_MEM(SRC(0) + SRC(1));
+            FALL
+
+        CASE(MULT_I_STORE_AO)
+            DST(2) = SRC(0) * IMM;
+            FUSE
+            SET_MEM(SRC(1) + SRC(2), SRC(0));
+            FALL
+
+        CASE(PUSH_CALL)
+        {
+            PUSH(SRC(0));
+            FUSE
+            PUSH((word_t)(ip - code + 1));
+            ip = &code[ip->target[0]];
+            NEXT
+        }
+    }
+#ifndef THREADED_DISPATCH
+    }
+#endif
+}
 
-            case PRINT:
-                if (OP0.type == STR_CONST) {
-                    printf("%s", STROP0);
-                } else {  /* virtual register */
-                    printf(PRIW, GET_REG(OP0));
-                }
-                break;
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
 
-            case LABEL:
-            case NOP:
-            case PHI:
-                /* nothing to do */
-                break;
+int run_simulator (InsnList* program, bool print_trace)
+{
+    SimulatorOptions options = { .print_trace = print_trace };
+    return run_simulator_with_options(program, &options);
+}
+
+int run_simulator_with_options (InsnList* program, SimulatorOptions* options)
+{
+    SimulatorResult result;
+    if (!run_simulator_with_result(program, options, &result)) {
+        /* program output has already been flushed */
+        if (result.status == SIM_TIMEOUT) {
+            fprintf(stderr, "%s", result.message);
+        } else {
+            printf("%s\n", result.message);
         }
+        exit(EXIT_FAILURE);
+    }
+    return result.return_value;
+}
 
-        /* update pc */
-        machine->pc = next_insn;
+/*
+ * create a machine for a program that has already been verified
+ */
+ILOCMachine* ILOCMachine_new_verified (InsnList* program, SimulatorOptions* options)
+{
+    ILOCMachine* machine = (ILOCMachine*)calloc(1, sizeof(ILOCMachine));
+    CHECK_MALLOC_PTR(machine);
+    machine->options = *options;
+    machine->call_targets = CallTargetTable_new();
+    machine->mem = ILOCMemory_new(options->mem_size > 0 ? options->mem_size : MEM_SIZE);
+    machine->owns_output = (options->output == NULL);
+    machine->output = (machine->owns_output ? ProgramOutput_new_file(stdout) : options->output);
+    ILOCMachine_load(machine, program);
+    if (options->unchecked && !options->print_trace &&
+            options->profile == NULL && options->trace == NULL) {
+        ILOCMachine_fuse(machine);
+    }
 
-        /* check timeout */
-        num_instructions_executed++;
-        if (num_instructions_executed > TIMEOUT_NUM_INSTRUCTIONS) {
-            fprintf(stderr, "TIMEOUT: Program executed too many instructions (probably an infinite loop)");
-            exit(EXIT_FAILURE);
+    /* everything else can stay zero/NULL from the calloc */
+    return machine;
+}
+bool run_simulator_with_result (InsnList* program, SimulatorOptions* options,
+        SimulatorResult* result)
+{
+    if (!check_program(program, result->message)) {
+        result->status = SIM_ERROR;
+        result->return_value = 0;
+        return false;
+    }
+    ILOCMachine* machine = ILOCMachine_new_verified(program, options);
+    bool success = ILOCMachine_run(machine, result);
+    ILOCMachine_free(machine);
+    return success;
+}
+
+ILOCMachine* ILOCMachine_new (InsnList* program, SimulatorOptions* options)
+{
+    verify_program(program);
+    return ILOCMachine_new_verified(program, options);
+}
+
+bool ILOCMachine_run (ILOCMachine* machine, SimulatorResult* result)
+{
+    machine->result = result;
+    machine->last = NULL;
+    result->status = SIM_OK;
+    result->return_value = 0;
+    result->message[0] = '\0';
+
+    /* search for main and begin there (runtime errors resume below) */
+    if (setjmp(machine->abort) == 0) {
+        int start = CallTargetTable_find(machine->call_targets, "main") + 1;
+        ILOCMachine_execute(machine, start);
+
+        /* the last instruction's effects haven't been recorded yet */
+        if (machine->options.trace != NULL && machine->last != NULL) {
+            ILOCMachine_record(machine, machine->last);
         }
+        if (machine->options.profile != NULL) {
+            ILOCProfile_finish(machine->options.profile);
+        }
+        result->return_value = machine->reg[RET_SLOT];
     }
+    ProgramOutput_flush(machine->output);
+    return result->status == SIM_OK;
+}
 
-    /* clean up */
-    word_t return_value = machine->ret;
-    CallTargetList_free(machine->call_targets);
-    free(machine);
+/*
+ * register file slot for an operand (aborts for non-registers and registers
+ * outside the loaded program's register file)
+ */
+int ILOCMachine_checked_slot (ILOCMachine* machine, Operand reg)
+{
+    int slot = ILOCMachine_reg_slot(reg);
+    if (slot == NO_SLOT || slot >= NUM_REG_SLOTS(machine->num_vregs) ||
+            (reg.type == PHYSICAL_REG && (reg.id < 0 || reg.id >= MAX_PHYSICAL_REGS))) {
+        printf("ERROR: Invalid register operand '");
+        Operand_print(reg, stdout);
+        printf("'\n");
+        exit(EXIT_FAILURE);
+    }
+    return slot;
+}
+
+word_t ILOCMachine_get_reg (ILOCMachine* machine, Operand reg)
+{
+    return machine->reg[ILOCMachine_checked_slot(machine, reg)];
+}
+
+void ILOCMachine_set_reg (ILOCMachine* machine, Operand reg, word_t value)
+{
+    machine->reg[ILOCMachine_checked_slot(machine, reg)] = value;
+}
+
+ILOCMemory* ILOCMachine_memory (ILOCMachine* machine)
+{
+    return machine->mem;
+}
+
+ILOCSnapshot* ILOCMachine_snapshot (ILOCMachine* machine)
+{
+    size_t reg_size = NUM_REG_SLOTS(machine->num_vregs) * sizeof(word_t);
+    ILOCSnapshot* snapshot = (ILOCSnapshot*)calloc(1, sizeof(ILOCSnapshot));
+    CHECK_MALLOC_PTR(snapshot);
+    snapshot->machine = machine;
+    snapshot->id = ++machine->num_snapshots;
+    snapshot->reg = (word_t*)malloc(reg_size);
+    CHECK_MALLOC_PTR(snapshot->reg);
+    memcpy(snapshot->reg, machine->reg, reg_size);
+
+    /* copying memory also restarts write tracking */
+    snapshot->mem = ILOCMemory_copy(machine->mem);
+    machine->baseline = snapshot->id;
+    return snapshot;
+}
 
-    return return_value;
+void ILOCMachine_restore (ILOCMachine* machine, ILOCSnapshot* snapshot)
+{
+    if (snapshot->machine != machine) {
+        printf("ERROR: Cannot restore a snapshot taken from a different machine\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* the register file is updated in place (decoded instructions point into it) */
+    memcpy(machine->reg, snapshot->reg, NUM_REG_SLOTS(machine->num_vregs) * sizeof(word_t));
+    ILOCMemory_restore(machine->mem, snapshot->mem, machine->baseline == snapshot->id);
+    machine->baseline = snapshot->id;
+}
+
+void ILOCSnapshot_free (ILOCSnapshot* snapshot)
+{
+    ILOCMemory_free(snapshot->mem);
+    free(snapshot->reg);
+    free(snapshot);
 }
@@ -0,0 +1,775 @@
+/**
+ * @file jit.c
+ * @brief Native x86-64 execution of ILOC programs
+ *
+ * Each ILOC instruction is translated into a short sequence of x86-64 machine
+ * code. ILOC registers live in a memory-resident register file (laid out like
+ * the simulator's: SP, BP, RET, physical registers, then virtual registers) and
+ * the ILOC address space is a flat byte array, so the memory image is the same
+ * as the simulator's. The address space is an anonymous mapping that is not
+ * committed up front, so (like the simulator's paged memory) only pages that
+ * are touched take up space. The generated code keeps the following host registers
+ * pinned:
+ *
+ *   rbx = register file, r12 = ILOC memory, r13 = instruction address table,
+ *   r14 = executed instruction count (for timeouts), r15 = run context
+ *
+ * and uses rax, rcx, rdx, rsi, and rdi as scratch registers. The run context holds
+ * everything the runtime helpers need (program output and the run's result),
+ * so no state is shared between runs. Runtime errors are recorded in the result
+ * by a helper, after which the generated code returns to its caller as if
+ * main() had returned. CALL pushes the index of
+ * the following instruction onto the ILOC stack (exactly as the simulator
+ * does) and RETURN jumps indirectly through the address table.
+ */
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "output.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+/*
+ * timeout (matches the simulator)
+ */
+
+#define TIMEOUT_NUM_INSTRUCTIONS 100000000
+
+/*
+ * x86-64 register numbers used in ModRM encodings
+ */
+
+#define RAX 0
+#define RCX 1
+#define RDI 7
+
+/*
+ * shared code stubs (branch targets other than ILOC instructions)
+ */
+
+typedef enum JITStub
+{
+    STUB_EXIT,
+    STUB_MEM_ERROR,
+    STUB_OVERFLOW,
+    STUB_EMPTY_POP,
+    STUB_BAD_RETURN,
+    STUB_TIMEOUT,
+    STUB_DIV_ZERO,
+    STUB_DIV_OVERFLOW,
+    NUM_STUBS
+} JITStub;
+
+/**
+ * @brief Branch whose rel32 displacement must be patched after translation
+ */
+typedef struct JITFixup
+{
+    size_t offset;      /**< @brief Offset of the rel32 field in the buffer */
+    int target;         /**< @brief ILOC instruction index (or stub if @c stub is true) */
+    bool stub;          /**< @brief Whether @c target refers to a @ref JITStub */
+} JITFixup;
+
+/**
+ * @brief Growable machine code buffer
+ */
+typedef struct CodeBuffer
+{
+    uint8_t* bytes;
+    size_t size;
+    size_t capacity;
+
+    JITFixup* fixups;
+    int num_fixups;
+    int fixup_capacity;
+
+    word_t mem_size;    /* address space size (used in bounds checks) */
+} CodeBuffer;
+
+void emit_byte (CodeBuffer* buf, uint8_t byte)
+{
+    if (buf->size == buf->capacity) {
+        buf->capacity = (buf->capacity == 0 ? 4096 : buf->capacity * 2);
+        buf->bytes = (uint8_t*)realloc(buf->bytes, buf->capacity);
+        CHECK_MALLOC_PTR(buf->bytes);
+    }
+    buf->bytes[buf->size++] = byte;
+}
+
+void emit_bytes (CodeBuffer* buf, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    for (int i = 0; i < count; i++) {
+        emit_byte(buf, (uint8_t)va_arg(args, int));
+    }
+    va_end(args);
+}
+
+void emit_u32 (CodeBuffer* buf, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        emit_byte(buf, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+void emit_u64 (CodeBuffer* buf, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        emit_byte(buf, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+/*
+ * emit a rel32 placeholder to be resolved once all code has been emitted
+ */
+void emit_rel32 (CodeBuffer* buf, int target, bool stub)
+{
+    if (buf->num_fixups == buf->fixup_capacity) {
+        buf->fixup_capacity = (buf->fixup_capacity == 0 ? 256 : buf->fixup_capacity * 2);
+        buf->fixups = (JITFixup*)realloc(buf->fixups, buf->fixup_capacity * sizeof(JITFixup));
+        CHECK_MALLOC_PTR(buf->fixups);
+    }
+    JITFixup fixup = { .offset = buf->size, .target = target, .stub = stub };
+    buf->fixups[buf->num_fixups++] = fixup;
+    emit_u32(buf, 0);
+}
+
+bool fits_int32 (long value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/*
+ * instruction encodings
+ */
+
+/* mov r64, [rbx + slot*8] */
+void emit_load_reg (CodeBuffer* buf, int host, Operand op)
+{
+    emit_bytes(buf, 3, 0x48, 0x8B, 0x83 | (host << 3));
+    emit_u32(buf, (uint32_t)(ILOCMachine_reg_slot(op) * WORD_SIZE));
+}
+
+/* mov [rbx + slot*8], r64 */
+void emit_store_reg (CodeBuffer* buf, int host, Operand op)
+{
+    emit_bytes(buf, 3, 0x48, 0x89, 0x83 | (host << 3));
+    emit_u32(buf, (uint32_t)(ILOCMachine_reg_slot(op) * WORD_SIZE));
+}
+
+/* mov rax/rcx, imm */
+void emit_load_imm (CodeBuffer* buf, int host, long value)
+{
+    if (fits_int32(value)) {
+        emit_bytes(buf, 3, 0x48, 0xC7, 0xC0 | host);
+        emit_u32(buf, (uint32_t)value);
+    } else {
+        emit_bytes(buf, 2, 0x48, 0xB8 | host);
+        emit_u64(buf, (uint64_t)value);
+    }
+}
+
+/* rax += imm */
+void emit_add_imm (CodeBuffer* buf, long value)
+{
+    if (fits_int32(value)) {
+        emit_bytes(buf, 2, 0x48, 0x05);
+        emit_u32(buf, (uint32_t)value);
+    } else {
+        emit_load_imm(buf, RCX, value);
+        emit_bytes(buf, 3, 0x48, 0x01, 0xC8);
+    }
+}
+
+/* jcc rel32 (cc is the second opcode byte, e.g. 0x84 for je) */
+void emit_jcc (CodeBuffer* buf, uint8_t cc, int target, bool stub)
+{
+    emit_bytes(buf, 2, 0x0F, cc);
+    emit_rel32(buf, target, stub);
+}
+
+/* jmp rel32 */
+void emit_jmp (CodeBuffer* buf, int target, bool stub)
+{
+    emit_byte(buf, 0xE9);
+    emit_rel32(buf, target, stub);
+}
+
+/* mov rax, fn; call rax (the stack is always 16-byte aligned in generated code) */
+void emit_call_helper (CodeBuffer* buf, uintptr_t fn)
+{
+    emit_bytes(buf, 2, 0x48, 0xB8);
+    emit_u64(buf, (uint64_t)fn);
+    emit_bytes(buf, 2, 0xFF, 0xD0);
+}
+
+/* abort unless rax is a valid word address (unsigned compare also catches negatives) */
+void emit_check_address (CodeBuffer* buf)
+{
+    emit_bytes(buf, 2, 0x48, 0x3D);
+    emit_u32(buf, (uint32_t)(buf->mem_size - WORD_SIZE));
+    emit_jcc(buf, 0x87, STUB_MEM_ERROR, true);          /* ja */
+}
+
+/* rax = mem[rax] */
+void emit_mem_load (CodeBuffer* buf)
+{
+    emit_check_address(buf);
+    emit_bytes(buf, 4, 0x49, 0x8B, 0x04, 0x04);
+}
+
+/* mem[rax] = rcx */
+void emit_mem_store (CodeBuffer* buf)
+{
+    emit_check_address(buf);
+    emit_bytes(buf, 4, 0x49, 0x89, 0x0C, 0x04);
+}
+
+/* push rcx onto the ILOC stack */
+void emit_push_rcx (CodeBuffer* buf)
+{
+    Operand sp = stack_register();
+    emit_load_reg(buf, RAX, sp);
+    emit_bytes(buf, 4, 0x48, 0x83, 0xE8, WORD_SIZE);    /* sub rax, 8 */
+    emit_store_reg(buf, RAX, sp);
+    emit_bytes(buf, 2, 0x48, 0x3D);                     /* cmp rax, STATIC_VAR_OFFSET */
+    emit_u32(buf, STATIC_VAR_OFFSET);
+    emit_jcc(buf, 0x8E, STUB_OVERFLOW, true);           /* jle */
+    emit_mem_store(buf);
+}
+
+/* pop the top of the ILOC stack into rcx */
+void emit_pop_rcx (CodeBuffer* buf)
+{
+    Operand sp = stack_register();
+    emit_load_reg(buf, RAX, sp);
+    emit_bytes(buf, 2, 0x48, 0x3D);                     /* cmp rax, mem_size-WORD_SIZE */
+    emit_u32(buf, (uint32_t)(buf->mem_size - WORD_SIZE));
+    emit_jcc(buf, 0x8F, STUB_EMPTY_POP, true);          /* jg */
+    emit_check_address(buf);
+    emit_bytes(buf, 4, 0x49, 0x8B, 0x0C, 0x04);         /* mov rcx, [r12+rax] */
+    emit_bytes(buf, 4, 0x48, 0x83, 0xC0, WORD_SIZE);    /* add rax, 8 */
+    emit_store_reg(buf, RAX, sp);
+}
+
+/* rax = op0 <op> op1 */
+void emit_binary (CodeBuffer* buf, ILOCInsn* insn)
+{
+    emit_load_reg(buf, RAX, insn->op[0]);
+    emit_load_reg(buf, RCX, insn->op[1]);
+    switch (insn->form) {
+        case ADD:  emit_bytes(buf, 3, 0x48, 0x01, 0xC8);       break;
+        case SUB:  emit_bytes(buf, 3, 0x48, 0x29, 0xC8);       break;
+        case MULT: emit_bytes(buf, 4, 0x48, 0x0F, 0xAF, 0xC1); break;
+        case DIV:
+            emit_bytes(buf, 3, 0x48, 0x85, 0xC9);                   /* test rcx, rcx */
+            emit_jcc(buf, 0x84, STUB_DIV_ZERO, true);               /* je */
+            emit_bytes(buf, 6, 0x48, 0x83, 0xF9, 0xFF, 0x75, 0x13); /* cmp rcx, -1; jne +19 */
+            emit_bytes(buf, 2, 0x48, 0xBA);                         /* mov rdx, INT64_MIN */
+            emit_u64(buf, (uint64_t)INT64_MIN);
+            emit_bytes(buf, 3, 0x48, 0x39, 0xD0);                   /* cmp rax, rdx */
+            emit_jcc(buf, 0x84, STUB_DIV_OVERFLOW, true);           /* je */
+            emit_bytes(buf, 5, 0x48, 0x99, 0x48, 0xF7, 0xF9);       /* cqo; idiv rcx */
+            break;
+        case AND:  emit_bytes(buf, 3, 0x48, 0x21, 0xC8);       break;
+        case OR:   emit_bytes(buf, 3, 0x48, 0x09, 0xC8);       break;
+        default:
+        {
+            uint8_t setcc = 0;
+            switch (insn->form) {
+                case CMP_LT: setcc = 0x9C; break;
+                case CMP_LE: setcc = 0x9E; break;
+                case CMP_EQ: setcc = 0x94; break;
+                case CMP_NE: setcc = 0x95; break;
+                case CMP_GE: setcc = 0x9D; break;
+                default:     setcc = 0x9F; break;      /* CMP_GT */
+            }
+            emit_bytes(buf, 3, 0x48, 0x39, 0xC8);       /* cmp rax, rcx */
+            emit_bytes(buf, 3, 0x0F, setcc, 0xC0);      /* setcc al */
+            emit_bytes(buf, 3, 0x0F, 0xB6, 0xC0);       /* movzx eax, al */
+            break;
+        }
+    }
+}
+
+/*
+ * runtime helpers called from generated code
+ */
+
+/**
+ * @brief State of a single native run (passed to generated code in r15)
+ */
+typedef struct JITContext
+{
+    ProgramOutput* output;      /**< @brief Destination of PRINT output */
+    SimulatorResult* result;    /**< @brief Outcome of the run */
+} JITContext;
+
+void jit_print_str (JITContext* ctx, const char* str)
+{
+    ProgramOutput_write_str(ctx->output, str);
+}
+
+void jit_print_int (JITContext* ctx, int64_t value)
+{
+    ProgramOutput_write_int(ctx->output, value);
+}
+
+/*
+ * record a runtime error (the calling stub then leaves the generated code)
+ */
+void jit_error (JITContext* ctx, SimulatorStatus status, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(ctx->result->message, MAX_ERROR_LEN, format, args);
+    va_end(args);
+    ctx->result->status = status;
+}
+
+void jit_mem_error (JITContext* ctx, int64_t address)
+{
+    jit_error(ctx, SIM_ERROR, "ERROR: Address %" PRId64 " is invalid (out of range)", address);
+}
+
+void jit_stack_overflow (JITContext* ctx)
+{
+    jit_error(ctx, SIM_ERROR, "ERROR: Stack overflow");
+}
+
+void jit_empty_pop (JITContext* ctx)
+{
+    jit_error(ctx, SIM_ERROR, "ERROR: Cannot pop from empty stack");
+}
+
+void jit_bad_return (JITContext* ctx, int64_t index)
+{
+    jit_error(ctx, SIM_ERROR, "ERROR: Invalid return address %" PRId64, index);
+}
+
+void jit_div_zero (JITContext* ctx)
+{
+    jit_error(ctx, SIM_ERROR, "ERROR: Division by zero");
+}
+
+void jit_div_overflow (JITContext* ctx)
+{
+    jit_error(ctx, SIM_ERROR, "ERROR: Division overflow (%" PRId64 " / -1)", INT64_MIN);
+}
+
+void jit_timeout (JITContext* ctx)
+{
+    jit_error(ctx, SIM_TIMEOUT,
+            "TIMEOUT: Program executed too many instructions (probably an infinite loop)");
+}
+
+/*
+ * translation
+ */
+
+/*
+ * instruction indices where straight-line runs start (every control transfer
+ * lands on one of these)
+ */
+bool is_leader (ILOCInsn** code, int index)
+{
+    if (index == 0) {
+        return true;
+    }
+    InsnForm prev = code[index-1]->form;
+    return prev == LABEL || prev == JUMP || prev == CBR || prev == CALL || prev == RETURN;
+}
+
+/*
+ * count a whole straight-line run at its start, so the timeout needs no
+ * per-instruction check
+ */
+void emit_count (CodeBuffer* buf, ILOCInsn** code, int index, int num_insns)
+{
+    int count = 1;
+    while (index + count < num_insns && !is_leader(code, index + count)) {
+        count++;
+    }
+    emit_bytes(buf, 3, 0x49, 0x81, 0xC6);               /* add r14, count */
+    emit_u32(buf, (uint32_t)count);
+    emit_bytes(buf, 3, 0x49, 0x81, 0xFE);               /* cmp r14, TIMEOUT */
+    emit_u32(buf, TIMEOUT_NUM_INSTRUCTIONS);
+    emit_jcc(buf, 0x8F, STUB_TIMEOUT, true);            /* jg */
+}
+
+void translate_insn (CodeBuffer* buf, ILOCInsn* insn, int index,
+        int* jump_targets, int* call_targets, int num_insns)
+{
+    Operand* op = insn->op;
+    switch (insn->form) {
+        case LOAD_I:
+            emit_load_imm(buf, RAX, op[0].imm);
+            emit_store_reg(buf, RAX, op[1]);
+            break;
+        case LOAD:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_mem_load(buf);
+            emit_store_reg(buf, RAX, op[1]);
+            break;
+        case LOAD_AI:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_add_imm(buf, op[1].imm);
+            emit_mem_load(buf);
+            emit_store_reg(buf, RAX, op[2]);
+            break;
+        case LOAD_AO:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_load_reg(buf, RCX, op[1]);
+            emit_bytes(buf, 3, 0x48, 0x01, 0xC8);
+            emit_mem_load(buf);
+            emit_store_reg(buf, RAX, op[2]);
+            break;
+        case STORE:
+            emit_load_reg(buf, RAX, op[1]);
+            emit_load_reg(buf, RCX, op[0]);
+            emit_mem_store(buf);
+            break;
+        case STORE_AI:
+            emit_load_reg(buf, RAX, op[1]);
+            emit_add_imm(buf, op[2].imm);
+            emit_load_reg(buf, RCX, op[0]);
+            emit_mem_store(buf);
+            break;
+        case STORE_AO:
+            emit_load_reg(buf, RAX, op[1]);
+            emit_load_reg(buf, RCX, op[2]);
+            emit_bytes(buf, 3, 0x48, 0x01, 0xC8);
+            emit_load_reg(buf, RCX, op[0]);
+            emit_mem_store(buf);
+            break;
+
+        case ADD:    case SUB:    case MULT:   case DIV:
+        case AND:    case OR:
+        case CMP_LT: case CMP_LE: case CMP_EQ:
+        case CMP_NE: case CMP_GE: case CMP_GT:
+            emit_binary(buf, insn);
+            emit_store_reg(buf, RAX, op[2]);
+            break;
+
+        case ADD_I:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_add_imm(buf, op[1].imm);
+            emit_store_reg(buf, RAX, op[2]);
+            break;
+        case MULT_I:
+            emit_load_reg(buf, RAX, op[0]);
+            if (fits_int32(op[1].imm)) {
+                emit_bytes(buf, 3, 0x48, 0x69, 0xC0);   /* imul rax, rax, imm32 */
+                emit_u32(buf, (uint32_t)op[1].imm);
+            } else {
+                emit_load_imm(buf, RCX, op[1].imm);
+                emit_bytes(buf, 4, 0x48, 0x0F, 0xAF, 0xC1);
+            }
+            emit_store_reg(buf, RAX, op[2]);
+            break;
+
+        case I2I:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_store_reg(buf, RAX, op[1]);
+            break;
+        case NOT:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_bytes(buf, 3, 0x48, 0xF7, 0xD0);       /* not rax */
+            emit_bytes(buf, 4, 0x48, 0x83, 0xE0, 0x01); /* and rax, 1 */
+            emit_store_reg(buf, RAX, op[1]);
+            break;
+        case NEG:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_bytes(buf, 3, 0x48, 0xF7, 0xD8);       /* neg rax */
+            emit_store_reg(buf, RAX, op[1]);
+            break;
+
+        case PUSH:
+            emit_load_reg(buf, RCX, op[0]);
+            emit_push_rcx(buf);
+            break;
+        case POP:
+            emit_pop_rcx(buf);
+            emit_store_reg(buf, RCX, op[0]);
+            break;
+
+        case JUMP:
+            emit_jmp(buf, jump_targets[op[0].id] + 1, false);
+            break;
+        case CBR:
+            emit_load_reg(buf, RAX, op[0]);
+            emit_bytes(buf, 3, 0x48, 0x85, 0xC0);       /* test rax, rax */
+            emit_jcc(buf, 0x85, jump_targets[op[1].id] + 1, false);
+            emit_jmp(buf, jump_targets[op[2].id] + 1, false);
+            break;
+
+        case CALL:
+            emit_load_imm(buf, RCX, index + 1);
+            emit_push_rcx(buf);
+            emit_jmp(buf, call_targets[index] + 1, false);
+            break;
+        case RETURN:
+            /* return from main() if the stack is empty */
+            emit_load_reg(buf, RAX, stack_register());
+            emit_bytes(buf, 2, 0x48, 0x3D);
+            emit_u32(buf, (uint32_t)buf->mem_size);
+            emit_jcc(buf, 0x84, STUB_EXIT, true);       /* je */
+            emit_pop_rcx(buf);
+            emit_bytes(buf, 3, 0x48, 0x81, 0xF9);       /* cmp rcx, num_insns */
+            emit_u32(buf, (uint32_t)num_insns);
+            emit_jcc(buf, 0x87, STUB_BAD_RETURN, true); /* ja */
+            emit_bytes(buf, 5, 0x41, 0xFF, 0x64, 0xCD, 0x00);   /* jmp [r13+rcx*8] */
+            break;
+
+        case PRINT:
+            if (op[0].type == STR_CONST) {
+                emit_bytes(buf, 3, 0x4C, 0x89, 0xFF);   /* mov rdi, r15 */
+                emit_bytes(buf, 2, 0x48, 0xBE);         /* mov rsi, imm64 */
+                emit_u64(buf, (uint64_t)(uintptr_t)op[0].str);
+                emit_call_helper(buf, (uintptr_t)jit_print_str);
+            } else {
+                if (op[0].type == INT_CONST) {
+                    emit_load_imm(buf, RAX, op[0].imm);
+                } else {
+                    emit_load_reg(buf, RAX, op[0]);
+                }
+                emit_bytes(buf, 3, 0x4C, 0x89, 0xFF);   /* mov rdi, r15 */
+                emit_bytes(buf, 3, 0x48, 0x89, 0xC6);   /* mov rsi, rax */
+                emit_call_helper(buf, (uintptr_t)jit_print_int);
+            }
+            break;
+
+        case LABEL:
+        case NOP:
+        case PHI:
+            /* nothing to do */
+            break;
+    }
+}
+
+/*
+ * function-pointer type of the generated entry sequence
+ */
+typedef void (*JITEntry)(int64_t* reg, uint8_t* mem, void** table, void* start,
+        JITContext* ctx);
+
+/* mov rdi, r15; call fn; jmp exit (error stubs) */
+void emit_error_stub (CodeBuffer* buf, uintptr_t fn)
+{
+    emit_bytes(buf, 3, 0x4C, 0x89, 0xFF);
+    emit_call_helper(buf, fn);
+    emit_jmp(buf, STUB_EXIT, true);
+}
+
+void emit_entry_and_stubs (CodeBuffer* buf, size_t* stubs)
+{
+    /* entry: save callee-saved registers (leaves rsp 16-byte aligned) */
+    emit_bytes(buf, 9, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+    emit_bytes(buf, 3, 0x48, 0x89, 0xFB);               /* mov rbx, rdi */
+    emit_bytes(buf, 3, 0x49, 0x89, 0xF4);               /* mov r12, rsi */
+    emit_bytes(buf, 3, 0x49, 0x89, 0xD5);               /* mov r13, rdx */
+    emit_bytes(buf, 3, 0x45, 0x31, 0xF6);               /* xor r14d, r14d */
+    emit_bytes(buf, 3, 0x4D, 0x89, 0xC7);               /* mov r15, r8 */
+    emit_bytes(buf, 2, 0xFF, 0xE1);                     /* jmp rcx */
+
+    stubs[STUB_EXIT] = buf->size;
+    emit_bytes(buf, 9, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B);
+    emit_byte(buf, 0xC3);                               /* ret */
+
+    stubs[STUB_MEM_ERROR] = buf->size;
+    emit_bytes(buf, 3, 0x48, 0x89, 0xC6);               /* mov rsi, rax */
+    emit_error_stub(buf, (uintptr_t)jit_mem_error);
+
+    stubs[STUB_OVERFLOW] = buf->size;
+    emit_error_stub(buf, (uintptr_t)jit_stack_overflow);
+
+    stubs[STUB_EMPTY_POP] = buf->size;
+    emit_error_stub(buf, (uintptr_t)jit_empty_pop);
+
+    stubs[STUB_BAD_RETURN] = buf->size;
+    emit_bytes(buf, 3, 0x48, 0x89, 0xCE);               /* mov rsi, rcx */
+    emit_error_stub(buf, (uintptr_t)jit_bad_return);
+
+    stubs[STUB_TIMEOUT] = buf->size;
+    emit_error_stub(buf, (uintptr_t)jit_timeout);
+
+    stubs[STUB_DIV_ZERO] = buf->size;
+    emit_error_stub(buf, (uintptr_t)jit_div_zero);
+
+    stubs[STUB_DIV_OVERFLOW] = buf->size;
+    emit_error_stub(buf, (uintptr_t)jit_div_overflow);
+}
+
+bool jit_available (void)
+{
+    return true;
+}
+
+bool run_jit_with_result (InsnList* program, SimulatorOptions* options,
+        SimulatorResult* result)
+{
+    word_t mem_size = (options->mem_size > 0 ? options->mem_size : MEM_SIZE);
+    assert_valid_mem_size(mem_size);
+    if (!check_program(program, result->message)) {
+        result->status = SIM_ERROR;
+        result->return_value = 0;
+        return false;
+    }
+
+    /* index instructions and resolve labels */
+    int num_insns = 0;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        num_insns++;
+    }
+    ILOCInsn** code = (ILOCInsn**)malloc((num_insns + 1) * sizeof(ILOCInsn*));
+    int* jump_targets = (int*)malloc((InsnList_max_id(program, JUMP_LABEL) + 1) * sizeof(int));
+    int* call_targets = (int*)malloc((num_insns + 1) * sizeof(int));
+    CallTargetTable* functions = CallTargetTable_new();
+    size_t* offsets = (size_t*)malloc((num_insns + 1) * sizeof(size_t));
+    CHECK_MALLOC_PTR(code);
+    CHECK_MALLOC_PTR(jump_targets);
+    CHECK_MALLOC_PTR(call_targets);
+    CHECK_MALLOC_PTR(offsets);
+    int i = 0;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        code[i] = insn;
+        if (insn->form == LABEL && insn->op[0].type == JUMP_LABEL) {
+            jump_targets[insn->op[0].id] = i;
+        } else if (insn->form == LABEL && insn->op[0].type == CALL_LABEL) {
+            CallTargetTable_add_new(functions, insn->op[0].str, i);
+        }
+        i++;
+    }
+    for (i = 0; i < num_insns; i++) {
+        if (code[i]->form == CALL) {
+            call_targets[i] = CallTargetTable_find(functions, code[i]->op[0].str);
+        }
+    }
+    int main_index = CallTargetTable_find(functions, "main");
+    CallTargetTable_free(functions);
+
+    /* translate */
+    CodeBuffer buf = { NULL, 0, 0, NULL, 0, 0, mem_size };
+    size_t stubs[NUM_STUBS];
+    emit_entry_and_stubs(&buf, stubs);
+    for (i = 0; i < num_insns; i++) {
+        offsets[i] = buf.size;
+        if (is_leader(code, i)) {
+            emit_count(&buf, code, i, num_insns);
+        }
+        translate_insn(&buf, code[i], i, jump_targets, call_targets, num_insns);
+    }
+    offsets[num_insns] = buf.size;
+    emit_jmp(&buf, STUB_EXIT, true);
+
+    /* resolve branches */
+    for (int f = 0; f < buf.num_fixups; f++) {
+        JITFixup* fixup = &buf.fixups[f];
+        size_t target = (fixup->stub ? stubs[fixup->target] : offsets[fixup->target]);
+        int32_t rel = (int32_t)((long)target - (long)(fixup->offset + 4));
+        memcpy(buf.bytes + fixup->offset, &rel, sizeof(rel));
+    }
+
+    /* copy into an executable mapping */
+    uint8_t* exec = (uint8_t*)mmap(NULL, buf.size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (exec == MAP_FAILED) {
+        printf("ERROR: Could not allocate executable memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(exec, buf.bytes, buf.size);
+    if (mprotect(exec, buf.size, PROT_READ | PROT_EXEC) != 0) {
+        printf("ERROR: Could not make generated code executable\n");
+        exit(EXIT_FAILURE);
+    }
+    void** table = (void**)malloc((num_insns + 1) * sizeof(void*));
+    CHECK_MALLOC_PTR(table);
+    for (i = 0; i <= num_insns; i++) {
+        table[i] = exec + offsets[i];
+    }
+
+    /* initialize machine state and run */
+    int num_slots = NUM_REG_SLOTS(InsnList_max_id(program, VIRTUAL_REG) + 1);
+    int64_t* reg = (int64_t*)malloc(num_slots * sizeof(int64_t));
+    uint8_t* mem = (uint8_t*)mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    CHECK_MALLOC_PTR(reg);
+    if (mem == MAP_FAILED) {
+        printf("ERROR: Could not allocate " PRIW " bytes of memory\n", mem_size);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_slots; i++) {
+        reg[i] = UNINIT_REG;
+    }
+    reg[SP_SLOT] = mem_size;
+
+    result->status = SIM_OK;
+    result->return_value = 0;
+    result->message[0] = '\0';
+    JITContext ctx = { .result = result };
+    ctx.output = (options->output != NULL ? options->output : ProgramOutput_new_file(stdout));
+    JITEntry entry;
+    *(void**)&entry = exec;
+    entry(reg, mem, table, table[main_index + 1], &ctx);
+    if (options->output != NULL) {
+        ProgramOutput_flush(ctx.output);
+    } else {
+        ProgramOutput_free(ctx.output);
+    }
+    if (result->status == SIM_OK) {
+        result->return_value = reg[RET_SLOT];
+    }
+
+    /* clean up */
+    munmap(exec, buf.size);
+    free(buf.bytes);
+    free(buf.fixups);
+    free(table);
+    free(reg);
+    munmap(mem, mem_size);
+    free(code);
+    free(jump_targets);
+    free(call_targets);
+    free(offsets);
+
+    return result->status == SIM_OK;
+}
+
+#else
+
+bool jit_available (void)
+{
+    return false;
+}
+
+bool run_jit_with_result (InsnList* program, SimulatorOptions* options,
+        SimulatorResult* result)
+{
+    /* simulate the way native code would run: unchecked, uninstrumented */
+    SimulatorOptions simulated = {
+        .output = options->output,
+        .mem_size = options->mem_size,
+        .unchecked = true
+    };
+    return run_simulator_with_result(program, &simulated, result);
+}
+
+#endif
+
+int run_jit (InsnList* program, SimulatorOptions* options)
+{
+    SimulatorResult result;
+    if (!run_jit_with_result(program, options, &result)) {
+        /* program output has already been flushed */
+        if (result.status == SIM_TIMEOUT) {
+            fprintf(stderr, "%s", result.message);
+        } else {
+            printf("%s\n", result.message);
+        }
+        exit(EXIT_FAILURE);
+    }
+    return result.return_value;
+}
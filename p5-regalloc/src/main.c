@@ -10,6 +10,11 @@
 #include "p5-regalloc.h"
 
 #include "y86.h"
+#include "y86sim.h"
+#include "x86_64.h"
+#include "jit.h"
+#include "profile.h"
+#include "trace.h"
 
 /**
  * @brief Error message buffer
@@ -64,6 +69,103 @@ bool read_file (const char* filename, char* text)
     return true;
 }
 
+/**
+ * @brief Default number of physical registers for register allocation
+ */
+#define DEFAULT_NUM_REGISTERS 4
+
+/**
+ * @brief Print command-line usage information
+ *
+ * @param program Name of the compiler executable
+ */
+void print_usage (const char* program)
+{
+    fprintf(stderr, "Usage: %s [options] <decaf-filename>\n", program);
+    fprintf(stderr, "       %s -D <trace-file> [-n <step>]\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -r <num>   number of physical registers (default %d, or %d with -x; at most %d\n"
+                    "             with -y, -o, or -b, and at most %d with -x)\n",
+            DEFAULT_NUM_REGISTERS, X86_64_NUM_REGS, Y86_NUM_PHYSICAL_REGS, X86_64_NUM_REGS);
+    fprintf(stderr, "  -s <file>  write register allocation statistics (CSV) to file\n");
+    fprintf(stderr, "  -j         run the program as native code instead of simulating it (unchecked, as with -u)\n");
+    fprintf(stderr, "  -y         run the program as Y86-64 code in the built-in emulator (stats to stderr)\n");
+    fprintf(stderr, "  -o <file>  write the program as a Y86-64 object listing (.yo) to file\n");
+    fprintf(stderr, "  -b <file>  write the program as a raw Y86-64 memory image to file\n");
+    fprintf(stderr, "  -x <file>  write the program as native x86-64 assembly (GNU as) to file\n");
+    fprintf(stderr, "  -u         skip uninitialized register checks when simulating (faster)\n");
+    fprintf(stderr, "  -m <size>  size of the program's address space in bytes (default %d)\n", MEM_SIZE);
+    fprintf(stderr, "  -p <file>  write an execution profile report to file\n");
+    fprintf(stderr, "  -g <file>  write execution profile call stacks (folded, for flame graphs) to file\n");
+    fprintf(stderr, "  -t <file>  write a binary execution trace to file\n");
+    fprintf(stderr, "  -D <file>  print the machine state recorded in a binary execution trace\n");
+    fprintf(stderr, "  -n <step>  with -D, print the state after this many instructions (default: all)\n");
+}
+
+/**
+ * @brief Generate and assemble Y86-64 code, writing a .yo listing and/or a raw
+ * memory image (the code size is reported on standard error)
+ *
+ * @param iloc Register-allocated ILOC program
+ * @param static_size Size of the program's global variables in bytes
+ * @param stack_top Address of the top of the stack (0 for the default layout)
+ * @param listing_filename Destination for the listing (NULL for none)
+ * @param image_filename Destination for the memory image (NULL for none)
+ */
+void write_y86 (InsnList* iloc, long static_size, long stack_top,
+        const char* listing_filename, const char* image_filename)
+{
+    FILE* listing_file = NULL;
+    if (listing_filename != NULL) {
+        listing_file = fopen(listing_filename, "w");
+        if (listing_file == NULL) {
+            fprintf(stderr, "Could not write file: %s\n", listing_filename);
+        }
+    }
+    Y86Image* image = assemble_y86(iloc, static_size, stack_top, listing_file);
+    if (listing_file != NULL) {
+        fclose(listing_file);
+    }
+    if (image_filename != NULL) {
+        FILE* image_file = fopen(image_filename, "wb");
+        if (image_file == NULL || !Y86Image_write(image, image_file)) {
+            fprintf(stderr, "Could not write file: %s\n", image_filename);
+        }
+        if (image_file != NULL) {
+            fclose(image_file);
+        }
+    }
+    fprintf(stderr, "Y86: %" PRId64 " bytes of code, %" PRId64 "-byte image\n",
+            image->code_size, image->size);
+    Y86Image_free(image);
+}
+
+/**
+ * @brief Print the machine state reconstructed from a binary execution trace
+ *
+ * @param filename Name of trace file
+ * @param step Number of instructions to replay (negative for all of them)
+ * @returns @c EXIT_SUCCESS if the trace could be read and @c EXIT_FAILURE
+ * otherwise
+ */
+int decode_trace (const char* filename, long step)
+{
+    FILE* input = fopen(filename, "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Could not read file: %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    TraceState* state = Trace_replay(input, step);
+    fclose(input);
+    if (state == NULL) {
+        fprintf(stderr, "Invalid trace file: %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    TraceState_print(state, stdout);
+    TraceState_free(state);
+    return EXIT_SUCCESS;
+}
+
 /**
  * @brief Compiler entry point
  *
@@ -74,12 +176,78 @@ bool read_file (const char* filename, char* text)
  */
 int main(int argc, char** argv)
 {
-    /* check for filename */
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <decaf-filename>\n", argv[0]);
+    /* parse options and check for filename */
+    char* filename = NULL;
+    char* stats_filename = NULL;
+    int num_registers = DEFAULT_NUM_REGISTERS;
+    bool registers_given = false;
+    bool use_jit = false;
+    bool use_y86 = false;
+    bool unchecked = false;
+    long mem_size = MEM_SIZE;
+    long y86_stack_top = 0;
+    char* listing_filename = NULL;
+    char* image_filename = NULL;
+    char* x86_64_filename = NULL;
+    char* profile_filename = NULL;
+    char* folded_filename = NULL;
+    char* trace_filename = NULL;
+    char* decode_filename = NULL;
+    long decode_step = -1;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-r") == 0 && a + 1 < argc) {
+            num_registers = atoi(argv[++a]);
+            registers_given = true;
+        } else if (strcmp(argv[a], "-s") == 0 && a + 1 < argc) {
+            stats_filename = argv[++a];
+        } else if (strcmp(argv[a], "-j") == 0) {
+            use_jit = true;
+        } else if (strcmp(argv[a], "-y") == 0) {
+            use_y86 = true;
+        } else if (strcmp(argv[a], "-u") == 0) {
+            unchecked = true;
+        } else if (strcmp(argv[a], "-m") == 0 && a + 1 < argc) {
+            mem_size = atol(argv[++a]);
+            y86_stack_top = mem_size;
+        } else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc) {
+            listing_filename = argv[++a];
+        } else if (strcmp(argv[a], "-b") == 0 && a + 1 < argc) {
+            image_filename = argv[++a];
+        } else if (strcmp(argv[a], "-x") == 0 && a + 1 < argc) {
+            x86_64_filename = argv[++a];
+        } else if (strcmp(argv[a], "-p") == 0 && a + 1 < argc) {
+            profile_filename = argv[++a];
+        } else if (strcmp(argv[a], "-g") == 0 && a + 1 < argc) {
+            folded_filename = argv[++a];
+        } else if (strcmp(argv[a], "-t") == 0 && a + 1 < argc) {
+            trace_filename = argv[++a];
+        } else if (strcmp(argv[a], "-D") == 0 && a + 1 < argc) {
+            decode_filename = argv[++a];
+        } else if (strcmp(argv[a], "-n") == 0 && a + 1 < argc) {
+            decode_step = atol(argv[++a]);
+        } else if (argv[a][0] != '-' && filename == NULL) {
+            filename = argv[a];
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (decode_filename != NULL) {
+        return decode_trace(decode_filename, decode_step);
+    }
+    bool y86_output = (use_y86 || listing_filename != NULL || image_filename != NULL);
+    if (x86_64_filename != NULL && !registers_given && !y86_output) {
+        /* use every register the native backend can map (the Y86 emitter
+         * only maps R0-R3, so keep the default if Y86 code is also wanted) */
+        num_registers = X86_64_NUM_REGS;
+    }
+    if (filename == NULL || num_registers < 1 ||
+            (y86_output && num_registers > Y86_NUM_PHYSICAL_REGS) ||
+            (x86_64_filename != NULL && num_registers > X86_64_NUM_REGS) ||
+            mem_size <= STATIC_VAR_OFFSET || mem_size > MAX_MEM_SIZE || mem_size % WORD_SIZE != 0) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
-    char* filename = argv[argc-1];
 
     /* read file */
     char text[MAX_FILE_SIZE];
@@ -150,21 +318,117 @@ int main(int argc, char** argv)
 
     /* PROJECT 4: code gen */
     InsnList* iloc = generate_code(tree);
+    long static_size = (long)ASTNode_get_int_attribute(tree, "staticSize");
 
     /* clean up syntax tree (no longer needed) */
     ASTNode_free(tree);
     tree = NULL;
 
     /* PROJECT 5: register allocation */
-    allocate_registers(iloc, 4);
+    if (stats_filename != NULL) {
+        RegAllocStatsList* stats = RegAllocStatsList_new();
+        allocate_registers_with_stats(iloc, num_registers, stats);
+        FILE* stats_file = fopen(stats_filename, "w");
+        if (stats_file != NULL) {
+            RegAllocStatsList_print(stats, stats_file);
+            fclose(stats_file);
+        } else {
+            fprintf(stderr, "Could not write file: %s\n", stats_filename);
+        }
+        RegAllocStatsList_free(stats);
+    } else {
+        allocate_registers(iloc, num_registers);
+    }
 
     /* print ILOC */
     InsnList_print(iloc, stdout);
 
+    /* assemble generated Y86 code in memory and write it out */
+    if (listing_filename != NULL || image_filename != NULL) {
+        write_y86(iloc, static_size, y86_stack_top, listing_filename, image_filename);
+    }
+
+    /* write native x86-64 code */
+    if (x86_64_filename != NULL) {
+        FILE* x86_64_file = fopen(x86_64_filename, "w");
+        if (x86_64_file != NULL) {
+            emit_x86_64(iloc, static_size, x86_64_file);
+            fclose(x86_64_file);
+        } else {
+            fprintf(stderr, "Could not write file: %s\n", x86_64_filename);
+        }
+    }
+
+    /* run generated Y86 code instead of the ILOC (for testing the Y86 backend) */
+    if (use_y86) {
+        Y86Options y86_options = { .mem_size = mem_size, .static_size = static_size };
+        Y86Result y86_result;
+        bool halted = run_y86(iloc, &y86_options, &y86_result);
+        fprintf(stderr, "Y86: %ld instructions, %ld cycles (CPI %.2f)\n",
+                y86_result.instructions, y86_result.cycles,
+                (double)y86_result.cycles / (y86_result.instructions > 0 ? y86_result.instructions : 1));
+        if (y86_result.status == Y86_TIMEOUT) {
+            fprintf(stderr, "%s", y86_result.message);
+            exit(EXIT_FAILURE);
+        } else if (!halted) {
+            printf("%s\n", y86_result.message);
+            exit(EXIT_FAILURE);
+        }
+        printf("RETURN VALUE = %d\n", (int)y86_result.return_value);
+        InsnList_free(iloc);
+        return EXIT_SUCCESS;
+    }
+
     /* run program (change 'true' to 'false' to disable trace output) */
-    int return_value = run_simulator(iloc, false);
+    SimulatorOptions options = { .print_trace = false, .unchecked = unchecked, .mem_size = mem_size };
+    ILOCProfile* profile = NULL;
+    if (profile_filename != NULL || folded_filename != NULL) {
+        profile = ILOCProfile_new(iloc);
+        options.profile = profile;
+    }
+    FILE* trace_file = NULL;
+    if (trace_filename != NULL) {
+        trace_file = fopen(trace_filename, "wb");
+        if (trace_file != NULL) {
+            options.trace = TraceWriter_new(trace_file, iloc, mem_size);
+        } else {
+            fprintf(stderr, "Could not write file: %s\n", trace_filename);
+        }
+    }
+    bool instrumented = options.profile != NULL || options.trace != NULL;
+    int return_value = (use_jit && !instrumented ? run_jit(iloc, &options) :
+            run_simulator_with_options(iloc, &options));
     printf("RETURN VALUE = %d\n", return_value);
 
+    /* finish trace */
+    if (trace_file != NULL) {
+        TraceWriter_free(options.trace);
+        fclose(trace_file);
+    }
+
+    /* write profiles */
+    if (profile != NULL) {
+        if (profile_filename != NULL) {
+            FILE* profile_file = fopen(profile_filename, "w");
+            if (profile_file != NULL) {
+                ILOCProfile_print_report(profile, profile_file);
+                fclose(profile_file);
+            } else {
+                fprintf(stderr, "Could not write file: %s\n", profile_filename);
+            }
+        }
+        if (folded_filename != NULL) {
+            FILE* folded_file = fopen(folded_filename, "w");
+            if (folded_file != NULL) {
+                ILOCProfile_print_folded(profile, folded_file);
+                fclose(folded_file);
+            } else {
+                fprintf(stderr, "Could not write file: %s\n", folded_filename);
+            }
+        }
+        ILOCProfile_free(profile);
+    }
+
     /* enable this to generate Y86 (requires a functional P5 solution first) */
     /*
      *FILE* y86_file = fopen("program.ys", "w");
@@ -0,0 +1,103 @@
+/**
+ * @file output.c
+ * @brief Buffered output of simulated ILOC programs (PRINT instructions)
+ */
+#include "output.h"
+
+ProgramOutput* ProgramOutput_new_file (FILE* file)
+{
+    ProgramOutput* output = (ProgramOutput*)calloc(1, sizeof(ProgramOutput));
+    CHECK_MALLOC_PTR(output);
+    output->file = file;
+    return output;
+}
+
+ProgramOutput* ProgramOutput_new_memory (void)
+{
+    ProgramOutput* output = (ProgramOutput*)calloc(1, sizeof(ProgramOutput));
+    CHECK_MALLOC_PTR(output);
+    output->captured_capacity = 256;
+    output->captured = (char*)malloc(output->captured_capacity);
+    CHECK_MALLOC_PTR(output->captured);
+    output->captured[0] = '\0';
+    return output;
+}
+
+ProgramOutput* ProgramOutput_new_callback (OutputCallback callback, void* context)
+{
+    ProgramOutput* output = (ProgramOutput*)calloc(1, sizeof(ProgramOutput));
+    CHECK_MALLOC_PTR(output);
+    output->callback = callback;
+    output->context = context;
+    return output;
+}
+
+void ProgramOutput_flush (ProgramOutput* output)
+{
+    if (output->length == 0) {
+        return;
+    }
+    if (output->file != NULL) {
+        fwrite(output->buffer, 1, output->length, output->file);
+    } else if (output->callback != NULL) {
+        output->callback(output->context, output->buffer, output->length);
+    } else if (output->captured != NULL) {
+        size_t needed = output->captured_length + output->length + 1;
+        if (needed > output->captured_capacity) {
+            while (output->captured_capacity < needed) {
+                output->captured_capacity *= 2;
+            }
+            output->captured = (char*)realloc(output->captured, output->captured_capacity);
+            CHECK_MALLOC_PTR(output->captured);
+        }
+        memcpy(output->captured + output->captured_length, output->buffer, output->length);
+        output->captured_length += output->length;
+        output->captured[output->captured_length] = '\0';
+    }
+    output->length = 0;
+}
+
+void ProgramOutput_write_str (ProgramOutput* output, const char* str)
+{
+    while (*str != '\0') {
+        if (output->length == OUTPUT_BUFFER_SIZE) {
+            ProgramOutput_flush(output);
+        }
+        output->buffer[output->length++] = *str++;
+    }
+}
+
+void ProgramOutput_write_int (ProgramOutput* output, int64_t value)
+{
+    /* digits are generated backwards (unsigned negation handles INT64_MIN) */
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    uint64_t magnitude = (value < 0 ? -(uint64_t)value : (uint64_t)value);
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+
+    size_t length = digits + sizeof(digits) - p;
+    if (output->length + length > OUTPUT_BUFFER_SIZE) {
+        ProgramOutput_flush(output);
+    }
+    memcpy(output->buffer + output->length, p, length);
+    output->length += length;
+}
+
+const char* ProgramOutput_contents (ProgramOutput* output)
+{
+    ProgramOutput_flush(output);
+    return output->captured;
+}
+
+void ProgramOutput_free (ProgramOutput* output)
+{
+    ProgramOutput_flush(output);
+    free(output->captured);
+    free(output);
+}
@@ -6,16 +6,77 @@
  */
 #include "p5-regalloc.h" 
 
-#define INFINITY MAX_INSTRUCTIONS
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define INFINITY INT_MAX
 
 #define INVALID -1 // indicates empty register
 
-int offset[MAX_VIRTUAL_REGS]; // stack offset for spilled registers
+/*
+ * functions are only allocated on separate threads when the program is big
+ * enough to amortize the thread startup cost
+ */
+#define MAX_ALLOC_THREADS 8
+#define MIN_PARALLEL_INSNS 512
+
+/**
+ * @brief Register allocation state for a single function
+ * 
+ * Everything the allocator needs lives here rather than in globals, so that
+ * separate functions can be allocated concurrently and so that nothing leaks
+ * from one call to @ref allocate_registers into the next.
+ */
+typedef struct RegAllocContext
+{
+    int size;                           // num of physical registers
+    int name[MAX_PHYSICAL_REGS];        // mapping of phys_reg => vr
+    int num_vregs;                      // num of (renumbered) virtual registers in the function
+    int* offset;                        // stack offset for spilled registers
+    bool* remat;                        // can the register be recomputed instead of reloaded?
+    long* remat_value;                  // constant that recomputes a rematerializable register
+    ILOCInsn* stack_allocator;          // "addI SP, -X => SP" of the current function
+    RegAllocStats* stats;               // counters for the current function
+
+    int num_insns;                      // num of (original) instructions in the function
+    ILOCInsn** code;                    // original instructions, indexed by position
+    int k;                              // position of the instruction being allocated
+    int* refs_vr;                       // [pos*3+op] => vr referenced by that operand (or INVALID)
+    int* refs_next;                     // [pos*3+op] => position of the next reference to that vr
+    int* next_ref;                      // vr => position of its next reference at or after k
+} RegAllocContext;
 
-int allocate(Operand vr, int *name, int size, ILOCInsn* prev_insn, ILOCInsn* stack_allocator, InsnList* list);
-int ensure(Operand vr, int *name, int size, ILOCInsn* prev_insn, ILOCInsn* stack_allocator, InsnList* list);
-int dist(int vr, ILOCInsn* insn, InsnList* list);
-void spill(int pr, int* name, ILOCInsn* prev_insn, ILOCInsn* stack_allocator);
+/**
+ * @brief Range of instructions belonging to one function
+ */
+typedef struct FunctionRange
+{
+    ILOCInsn* first;    // call label
+    ILOCInsn* last;     // last instruction before the next call label
+    RegAllocStats* stats;
+} FunctionRange;
+
+/**
+ * @brief Work queue shared by allocator threads
+ */
+typedef struct AllocWorkQueue
+{
+    FunctionRange* functions;
+    int num_functions;
+    int num_physical_registers;
+    atomic_int next;    // index of next function to allocate
+} AllocWorkQueue;
+
+void allocate_function(FunctionRange* func, int num_physical_registers);
+int renumber_function(ILOCInsn* first);
+int max_pressure(ILOCInsn* first, int num_vregs);
+void find_use_chains(RegAllocContext* ctx);
+void find_rematerializable(RegAllocContext* ctx, ILOCInsn* first);
+int allocate(RegAllocContext* ctx, Operand vr, ILOCInsn* insn, ILOCInsn** cursor);
+int ensure(RegAllocContext* ctx, Operand vr, ILOCInsn* insn, ILOCInsn** cursor);
+int dist(RegAllocContext* ctx, int vr);
+void spill(RegAllocContext* ctx, int pr, ILOCInsn** cursor);
 /**
  * @brief Replace a virtual register id with a physical register id
  * 
@@ -68,6 +129,25 @@ int insert_spill(int pr, ILOCInsn* prev_insn, ILOCInsn* local_allocator)
     return bp_offset;
 }
 
+/**
+ * @brief Insert a store instruction to an existing spill slot
+ * 
+ * @param pr Physical register being spilled
+ * @param bp_offset BP-based offset of the spill slot
+ * @param prev_insn Reference to an instruction; the new instruction will be
+ * inserted directly after this one
+ */
+void insert_store(int pr, int bp_offset, ILOCInsn* prev_insn)
+{
+    /* create store instruction */
+    ILOCInsn* new_insn = ILOCInsn_new_3op(STORE_AI,
+            physical_register(pr), base_register(), int_const(bp_offset));
+
+    /* insert into code */
+    new_insn->next = prev_insn->next;
+    prev_insn->next = new_insn;
+}
+
 /**
  * @brief Insert a load instruction to load a spilled register
  * 
@@ -87,31 +167,197 @@ void insert_load(int bp_offset, int pr, ILOCInsn* prev_insn)
     prev_insn->next = new_insn;
 }
 
+/**
+ * @brief Insert a load-immediate instruction to rematerialize a register
+ * 
+ * Used instead of @ref insert_load for registers whose only definition is a
+ * @c loadI; recomputing the constant is cheaper than a round trip through
+ * the stack frame.
+ * 
+ * @param value Constant that the register holds
+ * @param pr Physical register where the value should be loaded
+ * @param prev_insn Reference to an instruction; the new instruction will be
+ * inserted directly after this one
+ */
+void insert_remat(long value, int pr, ILOCInsn* prev_insn)
+{
+    /* create load-immediate instruction */
+    ILOCInsn* new_insn = ILOCInsn_new_2op(LOAD_I, int_const(value), physical_register(pr));
+
+    /* insert into code */
+    new_insn->next = prev_insn->next;
+    prev_insn->next = new_insn;
+}
+
+DEF_LIST_IMPL(RegAllocStats, RegAllocStats*, free)
+
+void RegAllocStatsList_print (RegAllocStatsList* stats, FILE* output)
+{
+    fprintf(output, "function,spills,reloads,remats,call_spills,frame_growth,max_pressure\n");
+    FOR_EACH(RegAllocStats*, st, stats) {
+        fprintf(output, "%s,%d,%d,%d,%d,%d,%d\n", st->function, st->num_spills,
+                st->num_reloads, st->num_remats, st->num_call_spills,
+                st->frame_growth, st->max_pressure);
+    }
+}
+
+/*
+ * worker thread: claim functions from the queue until it is empty
+ */
+void* allocate_worker(void* arg)
+{
+    AllocWorkQueue* queue = (AllocWorkQueue*)arg;
+    int f;
+    while ((f = atomic_fetch_add(&queue->next, 1)) < queue->num_functions) {
+        allocate_function(&queue->functions[f], queue->num_physical_registers);
+    }
+    return NULL;
+}
+
 void allocate_registers (InsnList* list, int num_physical_registers)
+{
+    allocate_registers_with_stats(list, num_physical_registers, NULL);
+}
+
+void allocate_registers_with_stats (InsnList* list, int num_physical_registers,
+        RegAllocStatsList* stats)
 {
     // terminate if list is null
     if (list == NULL || num_physical_registers < 1) 
     {
         exit(0);
     }
+    if (num_physical_registers > MAX_PHYSICAL_REGS) {
+        num_physical_registers = MAX_PHYSICAL_REGS;
+    }
 
-    // reinitialize local data structs 
-    int size = num_physical_registers;
-    int name[size];     // mapping of phys_reg => vr
+    // split the program into functions (each one starts with a call label)
+    int num_functions = 0;
+    int num_insns = 0;
+    FOR_EACH(ILOCInsn*, i, list) {
+        if (i->form == LABEL && i->op[0].type == CALL_LABEL) {
+            num_functions++;
+        }
+        num_insns++;
+    }
+    if (num_functions == 0) {
+        return;
+    }
+    FunctionRange* functions = (FunctionRange*)calloc(num_functions, sizeof(FunctionRange));
+    CHECK_MALLOC_PTR(functions);
+    int f = -1;
+    FOR_EACH(ILOCInsn*, i, list) {
+        if (i->form == LABEL && i->op[0].type == CALL_LABEL) {
+            functions[++f].first = i;
+            functions[f].stats = (RegAllocStats*)calloc(1, sizeof(RegAllocStats));
+            CHECK_MALLOC_PTR(functions[f].stats);
+            snprintf(functions[f].stats->function, MAX_ID_LEN, "%s", i->op[0].str);
+        }
+        if (f >= 0) {
+            functions[f].last = i;
+        }
+    }
 
-    ILOCInsn* stack_allocator = NULL;
-    ILOCInsn* prev_ins = NULL;
+    // detach functions from each other so that next-use scans stop at the
+    // end of the current function (spill code is always inserted before an
+    // existing instruction, so the last instruction of each range stays last)
+    for (f = 0; f < num_functions; f++) {
+        functions[f].last->next = NULL;
+    }
+
+    AllocWorkQueue queue = {
+        .functions = functions,
+        .num_functions = num_functions,
+        .num_physical_registers = num_physical_registers
+    };
+    atomic_init(&queue.next, 0);
 
-    for (int i = 0; i < size; i++) {
-        name[i] = INVALID;
+    int num_threads = (num_insns < MIN_PARALLEL_INSNS ? 1 : num_functions);
+    if (num_threads > MAX_ALLOC_THREADS) {
+        num_threads = MAX_ALLOC_THREADS;
+    }
+    pthread_t threads[MAX_ALLOC_THREADS];
+    int num_started = 0;
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[num_started], NULL, allocate_worker, &queue) == 0) {
+            num_started++;
+        }
+    }
+    allocate_worker(&queue);    // the calling thread works too
+    for (int t = 0; t < num_started; t++) {
+        pthread_join(threads[t], NULL);
     }
 
-    // for each instruction i in program:
-    FOR_EACH(ILOCInsn*, i, list) {
-        // *save reference to stack allocator instruction if i is a call label
-        if (i->form == LABEL && i->op[0].type == CALL_LABEL) {
-            stack_allocator = i->next->next->next;
+    // stitch the program back together
+    for (f = 0; f + 1 < num_functions; f++) {
+        functions[f].last->next = functions[f+1].first;
+    }
+    for (f = 0; f < num_functions; f++) {
+        if (stats != NULL) {
+            RegAllocStatsList_add(stats, functions[f].stats);
+        } else {
+            free(functions[f].stats);
         }
+    }
+    free(functions);
+}
+
+/*
+ * bottom-up local allocation for a single function (detached from the rest
+ * of the program)
+ */
+void allocate_function(FunctionRange* func, int num_physical_registers)
+{
+    // reinitialize local data structs (sized for this function only)
+    RegAllocContext* ctx = (RegAllocContext*)calloc(1, sizeof(RegAllocContext));
+    CHECK_MALLOC_PTR(ctx);
+    ctx->size = num_physical_registers;
+    ctx->stats = func->stats;
+    ctx->num_vregs = renumber_function(func->first);
+    ctx->offset = (int*)malloc((ctx->num_vregs + 1) * sizeof(int));
+    ctx->remat = (bool*)calloc(ctx->num_vregs + 1, sizeof(bool));
+    ctx->remat_value = (long*)calloc(ctx->num_vregs + 1, sizeof(long));
+    CHECK_MALLOC_PTR(ctx->offset);
+    CHECK_MALLOC_PTR(ctx->remat);
+    CHECK_MALLOC_PTR(ctx->remat_value);
+    for (int pr = 0; pr < ctx->size; pr++) {
+        ctx->name[pr] = INVALID;
+    }
+    for (int vr = 0; vr < ctx->num_vregs; vr++) {
+        ctx->offset[vr] = INVALID;
+    }
+
+    // *save reference to stack allocator instruction (i is a call label)
+    ctx->stack_allocator = func->first->next->next->next;
+    long frame_size = ctx->stack_allocator->op[1].imm;
+    ctx->stats->max_pressure = max_pressure(func->first, ctx->num_vregs);
+
+    // find values that can be recomputed rather than spilled
+    find_rematerializable(ctx, func->first);
+
+    // index the original instructions (spill code is only ever inserted
+    // before the current instruction, so later positions never shift)
+    for (ILOCInsn* i = func->first; i != NULL; i = i->next) {
+        ctx->num_insns++;
+    }
+    ctx->code = (ILOCInsn**)malloc(ctx->num_insns * sizeof(ILOCInsn*));
+    CHECK_MALLOC_PTR(ctx->code);
+    int pos = 0;
+    for (ILOCInsn* i = func->first; i != NULL; i = i->next) {
+        ctx->code[pos++] = i;
+    }
+
+    // find next uses for choosing spill victims
+    find_use_chains(ctx);
+
+    ILOCInsn* prev_ins = NULL;
+
+    // for each instruction i in function:
+    for (ctx->k = 0; ctx->k < ctx->num_insns; ctx->k++) {
+        ILOCInsn* i = ctx->code[ctx->k];
+
+        // *new spill/reload code goes between prev_ins and i (in order)
+        ILOCInsn* cursor = prev_ins;
 
         // for each read vr in i:
         ILOCInsn* read_regs = ILOCInsn_get_read_registers(i);
@@ -119,13 +365,22 @@ void allocate_registers (InsnList* list, int num_physical_registers)
             Operand vr = read_regs->op[op];
             if (vr.type == VIRTUAL_REG) {
                 // make sure vr is in a phys reg
-                int pr = ensure(vr, name, size, prev_ins, stack_allocator, list);
+                int pr = ensure(ctx, vr, read_regs, &cursor);
                 // change register id
                 replace_register(vr.id, pr, i);
-                /* this part allows reuse of registers that are no longer needed */
-                if (dist(vr.id, i, list) == INFINITY) {
-                    name[pr] = INVALID;
-                } 
+            }
+        }
+
+        /* this part allows reuse of registers that are no longer needed
+         * (only after all reads are in place, so operands can't share a register) */
+        for (int op = 0; op < 3; op++) {
+            Operand vr = read_regs->op[op];
+            if (vr.type == VIRTUAL_REG && dist(ctx, vr.id) == INFINITY) {
+                for (int pr = 0; pr < ctx->size; pr++) {
+                    if (ctx->name[pr] == vr.id) {
+                        ctx->name[pr] = INVALID;
+                    }
+                }
             }
         }
         ILOCInsn_free(read_regs);
@@ -134,24 +389,219 @@ void allocate_registers (InsnList* list, int num_physical_registers)
         Operand write_reg = ILOCInsn_get_write_register(i);
         if (write_reg.type == VIRTUAL_REG) {
             // make sure phys_reg is available
-            int pr = allocate(write_reg, name, size, prev_ins, stack_allocator, list);
+            int pr = allocate(ctx, write_reg, NULL, &cursor);
             replace_register(write_reg.id, pr, i);
         }
 
         // *spill any live registers before procedure calls
         if (i->form == CALL) {
-            for (int pr = 0; pr < size; pr++) {
-                if (name[pr] != INVALID)
-                    spill(pr, name, prev_ins, stack_allocator);
+            for (int pr = 0; pr < ctx->size; pr++) {
+                if (ctx->name[pr] != INVALID) {
+                    if (!ctx->remat[ctx->name[pr]]) {
+                        ctx->stats->num_call_spills++;
+                    }
+                    spill(ctx, pr, &cursor);
+                }
+            }
+        }
+
+        // *advance next-use positions past i
+        for (int op = 0; op < 3; op++) {
+            int vr = ctx->refs_vr[ctx->k*3 + op];
+            if (vr != INVALID && ctx->next_ref[vr] == ctx->k) {
+                ctx->next_ref[vr] = ctx->refs_next[ctx->k*3 + op];
             }
         }
 
         // *save reference to i to facilitate spilling before next instruction
         prev_ins = i;
-        
+    }
+
+    ctx->stats->frame_growth = (int)(frame_size - ctx->stack_allocator->op[1].imm);
+
+    free(ctx->code);
+    free(ctx->refs_vr);
+    free(ctx->refs_next);
+    free(ctx->next_ref);
+    free(ctx->offset);
+    free(ctx->remat);
+    free(ctx->remat_value);
+    free(ctx);
+}
+
+/*
+ * renumbers the virtual registers of a detached function densely from zero (in
+ * order of first appearance) and returns how many there are
+ */
+int renumber_function(ILOCInsn* first) {
+    // find the range of global ids used in this function
+    int min_id = INT_MAX;
+    int max_id = -1;
+    for (ILOCInsn* i = first; i != NULL; i = i->next) {
+        for (int op = 0; op < 3; op++) {
+            if (i->op[op].type == VIRTUAL_REG) {
+                if (i->op[op].id < min_id) min_id = i->op[op].id;
+                if (i->op[op].id > max_id) max_id = i->op[op].id;
+            }
+        }
+    }
+    if (max_id < 0) {
+        return 0;
+    }
+
+    // map old ids => new ids
+    int* new_id = (int*)malloc((max_id - min_id + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(new_id);
+    for (int id = 0; id <= max_id - min_id; id++) {
+        new_id[id] = INVALID;
+    }
+    int count = 0;
+    for (ILOCInsn* i = first; i != NULL; i = i->next) {
+        for (int op = 0; op < 3; op++) {
+            if (i->op[op].type == VIRTUAL_REG) {
+                int* mapped = &new_id[i->op[op].id - min_id];
+                if (*mapped == INVALID) {
+                    *mapped = count++;
+                }
+                i->op[op].id = *mapped;
+            }
+        }
+    }
+    free(new_id);
+    return count;
+}
+
+void renumber_virtual_registers (InsnList* list)
+{
+    if (list == NULL) {
+        return;
+    }
+    // temporarily detach each function so it can be renumbered on its own
+    ILOCInsn* first = list->head;
+    while (first != NULL) {
+        ILOCInsn* last = first;
+        while (last->next != NULL &&
+                !(last->next->form == LABEL && last->next->op[0].type == CALL_LABEL)) {
+            last = last->next;
+        }
+        ILOCInsn* next_first = last->next;
+        last->next = NULL;
+        renumber_function(first);
+        last->next = next_first;
+        first = next_first;
+    }
+}
+
+/*
+ * calculates the maximum number of virtual registers that are live at the same
+ * time (treating each register as live from its first to its last reference)
+ */
+int max_pressure(ILOCInsn* first, int num_vregs) {
+    int* first_ref = (int*)malloc((num_vregs + 1) * sizeof(int));
+    int* last_ref = (int*)malloc((num_vregs + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(first_ref);
+    CHECK_MALLOC_PTR(last_ref);
+    for (int vr = 0; vr < num_vregs; vr++) {
+        first_ref[vr] = INVALID;
+    }
+    int idx = 0;
+    for (ILOCInsn* i = first; i != NULL; i = i->next, idx++) {
+        for (int op = 0; op < 3; op++) {
+            if (i->op[op].type == VIRTUAL_REG) {
+                int vr = i->op[op].id;
+                if (first_ref[vr] == INVALID) {
+                    first_ref[vr] = idx;
+                }
+                last_ref[vr] = idx;
+            }
+        }
+    }
+
+    // sweep over +1/-1 events at each instruction index
+    int* delta = (int*)calloc(idx + 2, sizeof(int));
+    CHECK_MALLOC_PTR(delta);
+    for (int vr = 0; vr < num_vregs; vr++) {
+        if (first_ref[vr] != INVALID) {
+            delta[first_ref[vr]]++;
+            delta[last_ref[vr] + 1]--;
+        }
+    }
+    int live = 0;
+    int max_live = 0;
+    for (int n = 0; n <= idx; n++) {
+        live += delta[n];
+        if (live > max_live) {
+            max_live = live;
+        }
+    }
+    free(first_ref);
+    free(last_ref);
+    free(delta);
+    return max_live;
+}
 
-    }   
-    
+/*
+ * links every register reference in the function to the next reference of the
+ * same register so that next-use distances can be found without scanning
+ */
+void find_use_chains(RegAllocContext* ctx) {
+    int n = ctx->num_insns;
+    ctx->refs_vr = (int*)malloc((n * 3 + 1) * sizeof(int));
+    ctx->refs_next = (int*)malloc((n * 3 + 1) * sizeof(int));
+    ctx->next_ref = (int*)malloc((ctx->num_vregs + 1) * sizeof(int));
+    CHECK_MALLOC_PTR(ctx->refs_vr);
+    CHECK_MALLOC_PTR(ctx->refs_next);
+    CHECK_MALLOC_PTR(ctx->next_ref);
+    for (int vr = 0; vr < ctx->num_vregs; vr++) {
+        ctx->next_ref[vr] = INFINITY;
+    }
+
+    // walk backwards, so next_ref[vr] is always the closest later reference
+    for (int pos = n - 1; pos >= 0; pos--) {
+        ILOCInsn* i = ctx->code[pos];
+        for (int op = 0; op < 3; op++) {
+            ctx->refs_vr[pos*3 + op] = INVALID;
+            ctx->refs_next[pos*3 + op] = INFINITY;
+        }
+        for (int op = 0; op < 3; op++) {
+            if (i->op[op].type == VIRTUAL_REG) {
+                ctx->refs_vr[pos*3 + op] = i->op[op].id;
+                ctx->refs_next[pos*3 + op] = ctx->next_ref[i->op[op].id];
+            }
+        }
+        for (int op = 0; op < 3; op++) {
+            if (i->op[op].type == VIRTUAL_REG) {
+                ctx->next_ref[i->op[op].id] = pos;
+            }
+        }
+    }
+}
+
+/*
+ * records which virtual registers are rematerializable: those with exactly one
+ * definition, where that definition is a loadI of an integer constant (literals
+ * and static variable base addresses from codegen).
+ */
+void find_rematerializable(RegAllocContext* ctx, ILOCInsn* first) {
+    int* defs = (int*)calloc(ctx->num_vregs + 1, sizeof(int));
+    CHECK_MALLOC_PTR(defs);
+    for (ILOCInsn* i = first; i != NULL; i = i->next) {
+        Operand write_reg = ILOCInsn_get_write_register(i);
+        if (write_reg.type != VIRTUAL_REG) {
+            continue;
+        }
+        defs[write_reg.id]++;
+        if (i->form == LOAD_I && i->op[0].type == INT_CONST) {
+            ctx->remat[write_reg.id] = true;
+            ctx->remat_value[write_reg.id] = i->op[0].imm;
+        }
+    }
+    for (int vr = 0; vr < ctx->num_vregs; vr++) {
+        if (defs[vr] != 1) {
+            ctx->remat[vr] = false;
+        }
+    }
+    free(defs);
 }
 
 /*
@@ -159,32 +609,52 @@ void allocate_registers (InsnList* list, int num_physical_registers)
  * it selects the value stored in name that is farthest in the future, spills it,
  * and reallocates the corresponding physical register.
  * 
+ * @param ctx -- allocator state for the current function
  * @param vr -- virtual register needing a physical register
- * @param name -- array mapping phys_reg to vr
- * @size -- num of physical registers
+ * @param insn -- registers read by the current instruction (never chosen to spill) or NULL
+ * @param cursor -- spill code is inserted after *cursor, which is then advanced
  */
-int allocate(Operand vr, int *name, int size, ILOCInsn* prev_insn, ILOCInsn* stack_allocator, InsnList* list) {
-    ILOCInsn* curr = prev_insn->next;
+int allocate(RegAllocContext* ctx, Operand vr, ILOCInsn* insn, ILOCInsn** cursor) {
+    int* name = ctx->name;
     // if there's a free register, allocate and use it
-    for (int pr = 0; pr < size; pr++) {
+    for (int pr = 0; pr < ctx->size; pr++) {
         if (name[pr] == INVALID) {
             name[pr] = vr.id;
             return pr;
         }
     }
     // find pr that maximizes dist(name[pr])   // otherwise, find register to spill
-    int max_dist = 0;
-    int best_pr = 0;
-    for (int pr = 0; pr < size; pr++) {
-        int distance = dist(name[pr], curr, list);
-        if (distance > max_dist) {
+    // (rematerializable values break ties since spilling them is free)
+    int max_dist = -1;
+    int best_pr = INVALID;
+    for (int pr = 0; pr < ctx->size; pr++) {
+        bool in_use = false;
+        for (int op = 0; insn != NULL && op < 3; op++) {
+            if (insn->op[op].type == VIRTUAL_REG && insn->op[op].id == name[pr]) {
+                in_use = true;
+            }
+        }
+        if (in_use) {
+            continue;
+        }
+        int distance = dist(ctx, name[pr]);
+        if (distance > max_dist ||
+                (distance == max_dist && ctx->remat[name[pr]] && !ctx->remat[name[best_pr]])) {
             max_dist = distance;
             best_pr = pr;
         }  
     }
 
+    // every register holds a value this instruction still needs
+    if (best_pr == INVALID) {
+        printf("ERROR: Not enough physical registers (%d) to allocate: ", ctx->size);
+        ILOCInsn_print(ctx->code[ctx->k], stdout);
+        printf("\n");
+        exit(EXIT_FAILURE);
+    }
+
     // spill value to stack
-    spill(best_pr, name, prev_insn, stack_allocator);
+    spill(ctx, best_pr, cursor);
     // reallocate it
     name[best_pr] = vr.id;
     // and use it
@@ -194,45 +664,62 @@ int allocate(Operand vr, int *name, int size, ILOCInsn* prev_insn, ILOCInsn* sta
 /*
  * return physical register for virtual register.
  */
-int ensure(Operand vr, int *name, int size, ILOCInsn* prev_insn, ILOCInsn* stack_allocator, InsnList* list) {    
-    for (int pr = 0; pr < size; pr++) {
-        if (name[pr] == vr.id) {
+int ensure(RegAllocContext* ctx, Operand vr, ILOCInsn* insn, ILOCInsn** cursor) {    
+    for (int pr = 0; pr < ctx->size; pr++) {
+        if (ctx->name[pr] == vr.id) {
             return pr;
         }
     }
-    int pr = allocate(vr, name, size, prev_insn, stack_allocator, list);
-    // if vr was spilled, load it 
-    if (offset[vr.id] != INVALID) {
+    int pr = allocate(ctx, vr, insn, cursor);
+    if (ctx->remat[vr.id]) {
+        // recompute the constant instead of reloading it
+        insert_remat(ctx->remat_value[vr.id], pr, *cursor);
+        *cursor = (*cursor)->next;
+        ctx->stats->num_remats++;
+    } else if (ctx->offset[vr.id] != INVALID) {
+        // if vr was spilled, load it 
         // emit load into pr from offset[vr]
-        insert_load(offset[vr.id], pr, prev_insn);
+        insert_load(ctx->offset[vr.id], pr, *cursor);
+        *cursor = (*cursor)->next;
+        ctx->stats->num_reloads++;
     }
     return pr;     
  }
 
 /*
  * calcualte the distance from the instruction that is currently being allocated 
+ * to the next use of vr (INFINITY if there is none)
  */
-int dist(int vr, ILOCInsn* insn, InsnList* list) {
+int dist(RegAllocContext* ctx, int vr) {
     // return number of instructions until vr is next used (INFINITY if no use)
     // i.e. return the idx in the block of the next reference to vr 
-    int distance = 0;
-    ILOCInsn* next_ins = insn->next;
-    while (next_ins != NULL) {
-        for (int i = 0; i < 3; i++) {
-            if (next_ins->op[i].type == VIRTUAL_REG && next_ins->op[i].id == vr) {
-                return distance;
+    int next = ctx->next_ref[vr];
+    if (next == ctx->k) {
+        for (int op = 0; op < 3; op++) {
+            if (ctx->refs_vr[next*3 + op] == vr) {
+                next = ctx->refs_next[next*3 + op];
+                break;
             }
         }
-        next_ins = next_ins->next;
-        distance++;
     }
-
-    return INFINITY;
+    return (next == INFINITY ? INFINITY : next - ctx->k - 1);
 }
 
-void spill(int pr, int* name, ILOCInsn* prev_insn, ILOCInsn* stack_allocator) {
-    int bp_offset = insert_spill(pr, prev_insn, stack_allocator);
-    offset[name[pr]] = bp_offset;
-    name[pr] = INVALID;
+/*
+ * frees a physical register, storing its value to the stack unless it can be
+ * rematerialized later
+ */
+void spill(RegAllocContext* ctx, int pr, ILOCInsn** cursor) {
+    int vr = ctx->name[pr];
+    if (!ctx->remat[vr]) {
+        // a value keeps its spill slot once it has one
+        if (ctx->offset[vr] == INVALID) {
+            ctx->offset[vr] = insert_spill(pr, *cursor, ctx->stack_allocator);
+        } else {
+            insert_store(pr, ctx->offset[vr], *cursor);
+        }
+        *cursor = (*cursor)->next;
+        ctx->stats->num_spills++;
+    }
+    ctx->name[pr] = INVALID;
  }
-
@@ -0,0 +1,292 @@
+/**
+ * @file profile.c
+ * @brief Instruction-level profiling of simulated ILOC programs
+ */
+#include "profile.h"
+
+ILOCProfile* ILOCProfile_new (InsnList* program)
+{
+    ILOCProfile* profile = (ILOCProfile*)calloc(1, sizeof(ILOCProfile));
+    CHECK_MALLOC_PTR(profile);
+
+    /* index instructions */
+    FOR_EACH (ILOCInsn*, insn, program) {
+        profile->num_insns++;
+    }
+    int n = profile->num_insns;
+    profile->code        = (ILOCInsn**)calloc(n + 1, sizeof(ILOCInsn*));
+    profile->counts      = (long*)calloc(n + 1, sizeof(long));
+    profile->back_edges  = (long*)calloc(n + 1, sizeof(long));
+    profile->function_of = (int*)calloc(n + 1, sizeof(int));
+    CHECK_MALLOC_PTR(profile->code);
+    CHECK_MALLOC_PTR(profile->counts);
+    CHECK_MALLOC_PTR(profile->back_edges);
+    CHECK_MALLOC_PTR(profile->function_of);
+
+    /* find functions (instructions before the first label belong to function 0) */
+    int i = 0;
+    int f = -1;
+    FOR_EACH (ILOCInsn*, insn, program) {
+        profile->code[i] = insn;
+        if (insn->form == LABEL && insn->op[0].type == CALL_LABEL) {
+            f = profile->num_functions++;
+        }
+        profile->function_of[i++] = (f < 0 ? 0 : f);
+    }
+    int nf = (profile->num_functions > 0 ? profile->num_functions : 1);
+    profile->function_label = (int*)calloc(nf, sizeof(int));
+    profile->calls          = (long*)calloc(nf, sizeof(long));
+    profile->inclusive      = (long*)calloc(nf, sizeof(long));
+    profile->exclusive      = (long*)calloc(nf, sizeof(long));
+    profile->active         = (int*)calloc(nf, sizeof(int));
+    CHECK_MALLOC_PTR(profile->function_label);
+    CHECK_MALLOC_PTR(profile->calls);
+    CHECK_MALLOC_PTR(profile->inclusive);
+    CHECK_MALLOC_PTR(profile->exclusive);
+    CHECK_MALLOC_PTR(profile->active);
+    for (i = n - 1; i >= 0; i--) {
+        profile->function_label[profile->function_of[i]] = i;
+    }
+
+    /* calling context tree */
+    profile->root = (CallNode*)calloc(1, sizeof(CallNode));
+    CHECK_MALLOC_PTR(profile->root);
+    profile->root->function = -1;
+    profile->context = profile->root;
+
+    profile->prev = -1;
+    return profile;
+}
+
+const char* ILOCProfile_function_name (ILOCProfile* profile, int function)
+{
+    ILOCInsn* label = profile->code[profile->function_label[function]];
+    if (label != NULL && label->form == LABEL && label->op[0].type == CALL_LABEL) {
+        return label->op[0].str;
+    }
+    return "<unknown>";
+}
+
+/*
+ * shadow call stack maintenance
+ */
+
+void ILOCProfile_enter (ILOCProfile* profile, int function)
+{
+    if (profile->depth == profile->capacity) {
+        profile->capacity = (profile->capacity == 0 ? 64 : profile->capacity * 2);
+        profile->stack_function = (int*)realloc(profile->stack_function,
+                profile->capacity * sizeof(int));
+        profile->stack_start = (long*)realloc(profile->stack_start,
+                profile->capacity * sizeof(long));
+        CHECK_MALLOC_PTR(profile->stack_function);
+        CHECK_MALLOC_PTR(profile->stack_start);
+    }
+    profile->stack_function[profile->depth] = function;
+    profile->stack_start[profile->depth] = profile->total;
+    profile->depth++;
+    profile->calls[function]++;
+    profile->active[function]++;
+
+    /* find or create the callee's context */
+    CallNode* node = profile->context->child;
+    while (node != NULL && node->function != function) {
+        node = node->sibling;
+    }
+    if (node == NULL) {
+        node = (CallNode*)calloc(1, sizeof(CallNode));
+        CHECK_MALLOC_PTR(node);
+        node->function = function;
+        node->parent = profile->context;
+        node->sibling = profile->context->child;
+        profile->context->child = node;
+    }
+    profile->context = node;
+}
+
+void ILOCProfile_leave (ILOCProfile* profile)
+{
+    if (profile->depth == 0) {
+        return;
+    }
+    profile->depth--;
+    int function = profile->stack_function[profile->depth];
+
+    /* only the outermost activation counts toward inclusive totals (recursion) */
+    profile->active[function]--;
+    if (profile->active[function] == 0) {
+        profile->inclusive[function] += profile->total - profile->stack_start[profile->depth];
+    }
+    if (profile->context->parent != NULL) {
+        profile->context = profile->context->parent;
+    }
+}
+
+void ILOCProfile_step (ILOCProfile* profile, int index)
+{
+    /* control transfers are recognized by the previously executed instruction */
+    if (profile->prev < 0) {
+        ILOCProfile_enter(profile, profile->function_of[index]);
+    } else {
+        InsnForm form = profile->code[profile->prev]->form;
+        if (form == CALL) {
+            ILOCProfile_enter(profile, profile->function_of[index]);
+        } else if (form == RETURN) {
+            ILOCProfile_leave(profile);
+        } else if ((form == JUMP || form == CBR) && index <= profile->prev) {
+            profile->back_edges[index]++;
+        }
+    }
+
+    profile->counts[index]++;
+    profile->exclusive[profile->stack_function[profile->depth - 1]]++;
+    profile->context->self++;
+    profile->total++;
+    profile->prev = index;
+}
+
+void ILOCProfile_finish (ILOCProfile* profile)
+{
+    while (profile->depth > 0) {
+        ILOCProfile_leave(profile);
+    }
+}
+
+/*
+ * first instructions of basic blocks (control transfers always land on one)
+ */
+bool ILOCProfile_is_leader (ILOCProfile* profile, int index)
+{
+    if (index == 0) {
+        return true;
+    }
+    InsnForm prev = profile->code[index-1]->form;
+    return prev == LABEL || prev == JUMP || prev == CBR || prev == CALL || prev == RETURN;
+}
+
+void ILOCProfile_print_report (ILOCProfile* profile, FILE* output)
+{
+    fprintf(output, "Total instructions executed: %ld\n", profile->total);
+
+    /* functions */
+    fprintf(output, "\nFunctions:\n");
+    fprintf(output, "  %-20s %10s %14s %14s %7s\n", "function", "calls",
+            "inclusive", "exclusive", "excl%");
+    for (int f = 0; f < profile->num_functions; f++) {
+        double pct = (profile->total > 0 ? 100.0 * profile->exclusive[f] / profile->total : 0.0);
+        fprintf(output, "  %-20s %10ld %14ld %14ld %6.2f%%\n",
+                ILOCProfile_function_name(profile, f), profile->calls[f],
+                profile->inclusive[f], profile->exclusive[f], pct);
+    }
+
+    /*
+     * loops (targets of taken backward branches); every completed iteration
+     * ends with a back edge, and every other arrival at the header is an entry
+     */
+    fprintf(output, "\nLoops:\n");
+    fprintf(output, "  %-20s %8s %12s %10s %10s\n", "function", "header",
+            "iterations", "entries", "avg trips");
+    for (int i = 0; i < profile->num_insns; i++) {
+        if (profile->back_edges[i] > 0) {
+            long entries = profile->counts[i] - profile->back_edges[i];
+            fprintf(output, "  %-20s %8d %12ld %10ld %10.1f\n",
+                    ILOCProfile_function_name(profile, profile->function_of[i]), i,
+                    profile->back_edges[i], entries,
+                    (entries > 0 ? (double)profile->back_edges[i] / entries : 0.0));
+        }
+    }
+
+    /* basic blocks */
+    fprintf(output, "\nBasic blocks:\n");
+    fprintf(output, "  %-20s %8s %8s %12s\n", "function", "start", "end", "count");
+    for (int i = 0; i < profile->num_insns; i++) {
+        if (!ILOCProfile_is_leader(profile, i)) {
+            continue;
+        }
+        int end = i;
+        while (end + 1 < profile->num_insns && !ILOCProfile_is_leader(profile, end + 1)) {
+            end++;
+        }
+        if (profile->counts[i] > 0) {
+            fprintf(output, "  %-20s %8d %8d %12ld\n",
+                    ILOCProfile_function_name(profile, profile->function_of[i]),
+                    i, end, profile->counts[i]);
+        }
+    }
+
+    /* instructions */
+    fprintf(output, "\nInstructions:\n");
+    for (int i = 0; i < profile->num_insns; i++) {
+        fprintf(output, "  %12ld %6d  ", profile->counts[i], i);
+        ILOCInsn_print(profile->code[i], output);
+        fprintf(output, "\n");
+    }
+}
+
+void ILOCProfile_print_folded_node (ILOCProfile* profile, CallNode* node,
+        char* path, size_t length, size_t capacity, FILE* output)
+{
+    /* extend the path with this function's name */
+    const char* name = ILOCProfile_function_name(profile, node->function);
+    size_t needed = length + strlen(name) + 2;
+    char* new_path = path;
+    if (needed > capacity) {
+        capacity = needed * 2;
+        new_path = (char*)malloc(capacity);
+        CHECK_MALLOC_PTR(new_path);
+        memcpy(new_path, path, length);
+    }
+    if (length > 0) {
+        new_path[length++] = ';';
+    }
+    strcpy(new_path + length, name);
+    length += strlen(name);
+
+    if (node->self > 0) {
+        fprintf(output, "%s %ld\n", new_path, node->self);
+    }
+    for (CallNode* child = node->child; child != NULL; child = child->sibling) {
+        ILOCProfile_print_folded_node(profile, child, new_path, length, capacity, output);
+    }
+
+    if (new_path != path) {
+        free(new_path);
+    }
+}
+
+void ILOCProfile_print_folded (ILOCProfile* profile, FILE* output)
+{
+    char path[MAX_LINE_LEN];
+    for (CallNode* child = profile->root->child; child != NULL; child = child->sibling) {
+        path[0] = '\0';
+        ILOCProfile_print_folded_node(profile, child, path, 0, MAX_LINE_LEN, output);
+    }
+}
+
+void CallNode_free (CallNode* node)
+{
+    CallNode* child = node->child;
+    while (child != NULL) {
+        CallNode* next = child->sibling;
+        CallNode_free(child);
+        child = next;
+    }
+    free(node);
+}
+
+void ILOCProfile_free (ILOCProfile* profile)
+{
+    CallNode_free(profile->root);
+    free(profile->code);
+    free(profile->counts);
+    free(profile->back_edges);
+    free(profile->function_of);
+    free(profile->function_label);
+    free(profile->calls);
+    free(profile->inclusive);
+    free(profile->exclusive);
+    free(profile->active);
+    free(profile->stack_function);
+    free(profile->stack_start);
+    free(profile);
+}
@@ -0,0 +1,216 @@
+/**
+ * @file trace.c
+ * @brief Compact binary execution traces of simulated ILOC programs
+ */
+#include "trace.h"
+
+/*
+ * little-endian encoding helpers
+ */
+
+void put_uint (uint8_t** p, uint64_t value, int nbytes)
+{
+    for (int i = 0; i < nbytes; i++) {
+        *(*p)++ = (uint8_t)(value >> (8 * i));
+    }
+}
+
+bool get_uint (FILE* input, uint64_t* value, int nbytes)
+{
+    uint8_t bytes[8];
+    if (fread(bytes, 1, nbytes, input) != (size_t)nbytes) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < nbytes; i++) {
+        *value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return true;
+}
+
+TraceWriter* TraceWriter_new (FILE* output, InsnList* program, word_t mem_size)
+{
+    TraceWriter* writer = (TraceWriter*)calloc(1, sizeof(TraceWriter));
+    CHECK_MALLOC_PTR(writer);
+    writer->output = output;
+
+    /* header: magic followed by the machine parameters the records depend on */
+    uint8_t header[24];
+    uint8_t* p = header;
+    memcpy(p, TRACE_MAGIC, 8);
+    p += 8;
+    put_uint(&p, WORD_SIZE, 4);
+    put_uint(&p, (uint64_t)mem_size, 4);
+    put_uint(&p, NUM_REG_SLOTS(InsnList_max_id(program, VIRTUAL_REG) + 1), 4);
+    put_uint(&p, MAX_PHYSICAL_REGS, 4);
+    fwrite(header, 1, p - header, output);
+    return writer;
+}
+
+void TraceWriter_write (TraceWriter* writer, TraceRecord* record)
+{
+    uint8_t bytes[5 + TRACE_MAX_REG_WRITES * 12 + 12];
+    uint8_t* p = bytes;
+    put_uint(&p, record->pc, 4);
+    put_uint(&p, record->num_reg_writes | (record->mem_write ? 4 : 0), 1);
+    for (int i = 0; i < record->num_reg_writes; i++) {
+        put_uint(&p, record->reg_slot[i], 4);
+        put_uint(&p, (uint64_t)record->reg_value[i], 8);
+    }
+    if (record->mem_write) {
+        put_uint(&p, record->mem_address, 4);
+        put_uint(&p, (uint64_t)record->mem_value, 8);
+    }
+    fwrite(bytes, 1, p - bytes, writer->output);
+    writer->num_records++;
+}
+
+void TraceWriter_free (TraceWriter* writer)
+{
+    fflush(writer->output);
+    free(writer);
+}
+
+bool Trace_read_header (FILE* input, uint32_t* num_slots, uint32_t* mem_size)
+{
+    char magic[8];
+    uint64_t word_size, size, slots, num_physical;
+    if (fread(magic, 1, 8, input) == 8 && memcmp(magic, TRACE_MAGIC, 8) == 0 &&
+            get_uint(input, &word_size, 4)    && word_size == WORD_SIZE &&
+            get_uint(input, &size, 4)         && size > STATIC_VAR_OFFSET && size <= MAX_MEM_SIZE &&
+                                                 size % WORD_SIZE == 0 &&
+            get_uint(input, &slots, 4)        && slots >= NUM_REG_SLOTS(0) &&
+            get_uint(input, &num_physical, 4) && num_physical == MAX_PHYSICAL_REGS) {
+        *num_slots = (uint32_t)slots;
+        *mem_size = (uint32_t)size;
+        return true;
+    }
+    return false;
+}
+
+bool TraceRecord_read (FILE* input, TraceRecord* record)
+{
+    uint64_t pc, flags, slot, value, address;
+    if (!get_uint(input, &pc, 4) || !get_uint(input, &flags, 1)) {
+        return false;
+    }
+    record->pc = (uint32_t)pc;
+    record->num_reg_writes = (int)(flags & 3);
+    record->mem_write = (flags & 4) != 0;
+    if (record->num_reg_writes > TRACE_MAX_REG_WRITES) {
+        return false;
+    }
+    for (int i = 0; i < record->num_reg_writes; i++) {
+        if (!get_uint(input, &slot, 4) || !get_uint(input, &value, 8)) {
+            return false;
+        }
+        record->reg_slot[i] = (uint32_t)slot;
+        record->reg_value[i] = (word_t)value;
+    }
+    if (record->mem_write) {
+        if (!get_uint(input, &address, 4) || !get_uint(input, &value, 8)) {
+            return false;
+        }
+        record->mem_address = (uint32_t)address;
+        record->mem_value = (word_t)value;
+    }
+    return true;
+}
+
+TraceState* Trace_replay (FILE* input, long step)
+{
+    uint32_t num_slots, mem_size;
+    if (!Trace_read_header(input, &num_slots, &mem_size)) {
+        return NULL;
+    }
+
+    /* initial state matches a freshly-initialized simulator */
+    TraceState* state = (TraceState*)calloc(1, sizeof(TraceState));
+    CHECK_MALLOC_PTR(state);
+    state->num_slots = num_slots;
+    state->reg = (word_t*)malloc(num_slots * sizeof(word_t));
+    CHECK_MALLOC_PTR(state->reg);
+    for (uint32_t i = 0; i < num_slots; i++) {
+        state->reg[i] = UNINIT_REG;
+    }
+    state->reg[SP_SLOT] = mem_size;
+    state->mem = ILOCMemory_new(mem_size);
+
+    /* stop at the end of the trace or at the first malformed record */
+    TraceRecord record;
+    while ((step < 0 || state->step < step) && TraceRecord_read(input, &record)) {
+        bool valid = true;
+        for (int i = 0; i < record.num_reg_writes; i++) {
+            valid = valid && record.reg_slot[i] < num_slots;
+        }
+        if (record.mem_write) {
+            valid = valid && record.mem_address <= mem_size - WORD_SIZE;
+        }
+        if (!valid) {
+            break;
+        }
+        for (int i = 0; i < record.num_reg_writes; i++) {
+            state->reg[record.reg_slot[i]] = record.reg_value[i];
+        }
+        if (record.mem_write) {
+            ILOCMemory_set(state->mem, record.mem_address, record.mem_value);
+        }
+        state->pc = record.pc;
+        state->step++;
+    }
+    return state;
+}
+
+void TraceState_print (TraceState* state, FILE* output)
+{
+    fprintf(output, "step %ld (last pc %u)\n", state->step, state->pc);
+    fprintf(output, "==========================\n");
+
+    /* registers (special and virtual) */
+    fprintf(output, "sp=" PRIW " bp=" PRIW " ret=" PRIW "\n",
+            state->reg[SP_SLOT], state->reg[BP_SLOT], state->reg[RET_SLOT]);
+    fprintf(output, "registers: ");
+    for (int i = 0; VR_SLOT(i) < (int)state->num_slots; i++) {
+        if (state->reg[VR_SLOT(i)] != UNINIT_REG) {
+            fprintf(output, " r%d=" PRIW, i, state->reg[VR_SLOT(i)]);
+        }
+    }
+    for (int i = 0; i < MAX_PHYSICAL_REGS; i++) {
+        if (state->reg[PR_SLOT(i)] != UNINIT_REG) {
+            fprintf(output, " R%d=" PRIW, i, state->reg[PR_SLOT(i)]);
+        }
+    }
+    fprintf(output, "\n");
+
+    /* stack (memory from the end of the address space down to stack pointer) */
+    word_t size = state->mem->size;
+    fprintf(output, "stack:");
+    for (word_t addr = size - WORD_SIZE; addr >= state->reg[SP_SLOT] && addr >= 0; addr -= WORD_SIZE) {
+        fprintf(output, "  " PRIW ": " PRIW, addr, ILOCMemory_get(state->mem, addr));
+    }
+    fprintf(output, "\n");
+
+    /* other memory (any WORD_SIZE-aligned value that is non-zero; skips unwritten pages) */
+    fprintf(output, "other memory:");
+    for (word_t addr = STATIC_VAR_OFFSET; addr < state->reg[SP_SLOT] && addr <= size - WORD_SIZE;
+            addr += WORD_SIZE) {
+        if (!ILOCMemory_is_mapped(state->mem, addr)) {
+            addr += MEM_PAGE_SIZE - addr % MEM_PAGE_SIZE - WORD_SIZE;
+            continue;
+        }
+        word_t value = ILOCMemory_get(state->mem, addr);
+        if (value != 0) {
+            fprintf(output, "  " PRIW ": " PRIW, addr, value);
+        }
+    }
+    fprintf(output, "\n");
+
+    fprintf(output, "==========================\n");
+}
+
+void TraceState_free (TraceState* state)
+{
+    ILOCMemory_free(state->mem);
+    free(state->reg);
+    free(state);
+}
@@ -0,0 +1,515 @@
+#include "x86_64.h"
+
+static FILE* out = NULL;
+
+#define RET "%rax"
+
+#define GLOBALS "%r15"
+
+#define TMP1 "%r11"
+#define TMP1_BYTE "%r11b"
+#define TMP2 "%r10"
+
+/*
+ * For reference:
+ *
+ * rax - return register (RET); also the dividend and quotient of idivq
+ * rbx - r5
+ * rcx - r0
+ * rdx - scratch (remainder of idivq)
+ * rsp - stack pointer (SP)
+ * rbp - base pointer (BP)
+ * rsi - r1
+ * rdi - r2
+ * r8  - r3
+ * r9  - r4
+ * r10 - scratch (TMP2)
+ * r11 - scratch (TMP1; also the argument of the print routines)
+ * r12 - r6
+ * r13 - r7
+ * r14 - r8
+ * r15 - address of the global variables minus STATIC_VAR_OFFSET
+ */
+static const char* x86_64_reg_names[X86_64_NUM_REGS] = {
+    "%rcx", "%rsi", "%rdi", "%r8", "%r9", "%rbx", "%r12", "%r13", "%r14"
+};
+
+/*
+ * registers that the print routines must preserve (RET and the caller-saved
+ * registers that hold ILOC registers)
+ */
+static const char* x86_64_saved_regs[] = {
+    "%rax", "%rcx", "%rsi", "%rdi", "%r8", "%r9"
+};
+
+#define NUM_SAVED_REGS (int)(sizeof(x86_64_saved_regs) / sizeof(x86_64_saved_regs[0]))
+
+static const char* x86_64_reg (Operand op)
+{
+    const char* reg = "INVALID";
+    switch (op.type) {
+        case BASE_REG:   reg = "%rbp"; break;   // BP
+        case STACK_REG:  reg = "%rsp"; break;   // SP
+        case RETURN_REG: reg = RET;    break;   // RET
+        case PHYSICAL_REG:
+            if (op.id < 0 || op.id >= X86_64_NUM_REGS) {
+                fprintf(stderr, "Invalid register: ");
+                Operand_print(op, stderr);
+                fprintf(stderr, " (must be R0-R%d for translation to physical register)\n",
+                        X86_64_NUM_REGS - 1);
+                exit(EXIT_FAILURE);
+            }
+            reg = x86_64_reg_names[op.id];
+            break;
+        default:
+            break;
+    }
+    return reg;
+}
+
+static void x86_64_emit (const char* text)
+{
+    fprintf(out, "    %s\n", text);
+}
+
+static void x86_64_emitf (const char* format, ...)
+{
+    char buffer[MAX_LINE_LEN];
+
+    /* delegate to vsnprintf */
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, MAX_LINE_LEN, format, args);
+    va_end(args);
+
+    x86_64_emit(buffer);
+}
+
+static bool fits_int32 (long value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/*
+ * copy a register (if the source and destination are different)
+ */
+static void x86_64_move (const char* src, const char* dst)
+{
+    if (strcmp(src, dst) != 0) {
+        x86_64_emitf("movq %s, %s", src, dst);
+    }
+}
+
+/*
+ * load a constant (movabsq is only needed if it doesn't fit in 32 bits)
+ */
+static void x86_64_load_imm (long value, const char* dst)
+{
+    x86_64_emitf("%s $%ld, %s", (fits_int32(value) ? "movq" : "movabsq"), value, dst);
+}
+
+/*
+ * write the memory operand for ILOC address base + disp (+ index, if not NULL)
+ * to buffer, computing the address into TMP2 first if necessary; addresses in
+ * general-purpose registers are global variables (Decaf has no pointers and no
+ * local arrays), so they are made relative to GLOBALS
+ */
+static void x86_64_address (char* buffer, Operand base, Operand* index, long disp)
+{
+    const char* reg = x86_64_reg(base);
+    if (index != NULL || !fits_int32(disp)) {
+        if (index != NULL) {
+            x86_64_emitf("leaq (%s,%s), %s", reg, x86_64_reg(*index), TMP2);
+        } else {
+            x86_64_move(reg, TMP2);
+        }
+        if (!fits_int32(disp)) {
+            x86_64_load_imm(disp, TMP1);
+            x86_64_emitf("addq %s, %s", TMP1, TMP2);
+            disp = 0;
+        }
+        reg = TMP2;
+    }
+    if (base.type == PHYSICAL_REG) {
+        snprintf(buffer, MAX_LINE_LEN, "%ld(%s,%s)", disp, GLOBALS, reg);
+    } else {
+        snprintf(buffer, MAX_LINE_LEN, "%ld(%s)", disp, reg);
+    }
+}
+
+static void x86_64_bin_op (const char* opcode, bool commutative, Operand op0, Operand op1, Operand op2)
+{
+    const char* src0 = x86_64_reg(op0);
+    const char* src1 = x86_64_reg(op1);
+    const char* dst  = x86_64_reg(op2);
+    if (strcmp(src0, dst) == 0) {
+        /* first operand is also the output; overwrite it */
+        x86_64_emitf("%s %s, %s", opcode, src1, dst);
+    } else if (strcmp(src1, dst) == 0 && commutative) {
+        /* second operand is also the output; overwrite it */
+        x86_64_emitf("%s %s, %s", opcode, src0, dst);
+    } else if (strcmp(src1, dst) == 0) {
+        /* second operand is also the output, but the order matters */
+        x86_64_move(src0, TMP1);
+        x86_64_emitf("%s %s, %s", opcode, src1, TMP1);
+        x86_64_move(TMP1, dst);
+    } else {
+        /* no operands duplicated; use an extra move instruction */
+        x86_64_move(src0, dst);
+        x86_64_emitf("%s %s, %s", opcode, src1, dst);
+    }
+}
+
+/*
+ * binary operation with an immediate operand (which must be loaded into a
+ * register first if it doesn't fit in 32 bits)
+ */
+static void x86_64_imm_op (const char* opcode, Operand op0, long value, Operand op2)
+{
+    const char* src = x86_64_reg(op0);
+    const char* dst = x86_64_reg(op2);
+    if (!fits_int32(value)) {
+        x86_64_load_imm(value, TMP1);
+        if (strcmp(src, dst) != 0) {
+            x86_64_move(src, dst);
+        }
+        x86_64_emitf("%s %s, %s", opcode, TMP1, dst);
+    } else if (strcmp(opcode, "imulq") == 0) {
+        x86_64_emitf("imulq $%ld, %s, %s", value, src, dst);
+    } else if (strcmp(src, dst) == 0) {
+        x86_64_emitf("%s $%ld, %s", opcode, value, dst);
+    } else {
+        x86_64_emitf("leaq %ld(%s), %s", value, src, dst);     /* addq only */
+    }
+}
+
+/*
+ * condition code suffix for a comparison form, and its inverse
+ */
+static const char* x86_64_cc (InsnForm form, bool invert)
+{
+    switch (form) {
+        case CMP_LT: return invert ? "ge" : "l";
+        case CMP_LE: return invert ? "g"  : "le";
+        case CMP_EQ: return invert ? "ne" : "e";
+        case CMP_GE: return invert ? "l"  : "ge";
+        case CMP_GT: return invert ? "le" : "g";
+        case CMP_NE: return invert ? "e"  : "ne";
+        default:     return NULL;
+    }
+}
+
+static bool is_jump_label (ILOCInsn* insn, int id)
+{
+    return insn != NULL && insn->form == LABEL && insn->op[0].type == JUMP_LABEL && insn->op[0].id == id;
+}
+
+/*
+ * runtime error routine: print the message (as the simulator does) and exit
+ * with a failure status; never returns, so nothing needs to be preserved
+ */
+static void x86_64_emit_error_routine (const char* name, const char* message)
+{
+    fprintf(out, "\n%s:\n", name);
+    x86_64_emit("andq $-16, %rsp");
+    x86_64_emitf("leaq %s(%%rip), %%rdi", message);
+    x86_64_emit("call puts@PLT");
+    x86_64_emitf("movl $%d, %%edi", EXIT_FAILURE);
+    x86_64_emit("call exit@PLT");
+}
+
+/*
+ * print routine: save the registers that printf may clobber, align the stack
+ * as the System V ABI requires, and print TMP1 with the given format
+ */
+static void x86_64_emit_print_routine (const char* name, const char* format)
+{
+    fprintf(out, "\n%s:\n", name);
+    x86_64_emit("pushq %rbp");
+    x86_64_emit("movq %rsp, %rbp");
+    for (int r = 0; r < NUM_SAVED_REGS; r++) {
+        x86_64_emitf("pushq %s", x86_64_saved_regs[r]);
+    }
+    x86_64_emit("andq $-16, %rsp");
+    x86_64_emitf("movq %s, %%rsi", TMP1);
+    x86_64_emitf("leaq %s(%%rip), %%rdi", format);
+    x86_64_emit("xorl %eax, %eax");     /* no vector arguments */
+    x86_64_emit("call printf@PLT");
+    x86_64_emitf("leaq -%d(%%rbp), %%rsp", NUM_SAVED_REGS * WORD_SIZE);
+    for (int r = NUM_SAVED_REGS - 1; r >= 0; r--) {
+        x86_64_emitf("popq %s", x86_64_saved_regs[r]);
+    }
+    x86_64_emit("popq %rbp");
+    x86_64_emit("ret");
+}
+
+#define OP0 (i->op[0])
+#define OP1 (i->op[1])
+#define OP2 (i->op[2])
+#define REG0 x86_64_reg(OP0)
+#define REG1 x86_64_reg(OP1)
+#define REG2 x86_64_reg(OP2)
+
+void emit_x86_64 (InsnList* iloc, long static_size, FILE* output)
+{
+    const char** strings = NULL;
+    int num_strings = 0;
+    int strings_capacity = 0;
+    char mem[MAX_LINE_LEN];
+
+    /* comparison whose flags are still set (for fusing with a following CBR) */
+    InsnForm flags_form = NOP;
+    const char* flags_reg = NULL;
+
+    out = output;
+
+    fprintf(out, "    .text\n");
+
+    /* C entry point: preserve the callee-saved registers used by the
+     * translated code and set up the global variable base */
+    fprintf(out, "\n    .globl main\n");
+    fprintf(out, "main:\n");
+    x86_64_emit("pushq %rbp");
+    x86_64_emit("movq %rsp, %rbp");
+    x86_64_emit("pushq %rbx");
+    x86_64_emit("pushq %r12");
+    x86_64_emit("pushq %r13");
+    x86_64_emit("pushq %r14");
+    x86_64_emit("pushq %r15");
+    x86_64_emitf("leaq _decaf_globals-%d(%%rip), %s", STATIC_VAR_OFFSET, GLOBALS);
+    x86_64_emit("call decaf_main");
+    x86_64_emit("popq %r15");
+    x86_64_emit("popq %r14");
+    x86_64_emit("popq %r13");
+    x86_64_emit("popq %r12");
+    x86_64_emit("popq %rbx");
+    x86_64_emit("popq %rbp");
+    x86_64_emit("ret");             /* return value in %eax */
+
+    FOR_EACH (ILOCInsn*, i, iloc)
+    {
+        const char* fused_reg = flags_reg;
+        InsnForm fused_form = flags_form;
+        flags_reg = NULL;
+
+        switch (i->form)
+        {
+            /* data movement */
+
+            case I2I:       x86_64_move(REG0, REG1);                            break;
+            case PUSH:      x86_64_emitf("pushq %s", REG0);                     break;
+            case POP:       x86_64_emitf("popq %s", REG0);                      break;
+            case LOAD_I:    x86_64_load_imm(OP0.imm, REG1);                     break;
+            case LOAD:      x86_64_address(mem, OP0, NULL, 0);
+                            x86_64_emitf("movq %s, %s", mem, REG1);             break;
+            case LOAD_AI:   x86_64_address(mem, OP0, NULL, OP1.imm);
+                            x86_64_emitf("movq %s, %s", mem, REG2);             break;
+            case LOAD_AO:   x86_64_address(mem, OP0, &OP1, 0);
+                            x86_64_emitf("movq %s, %s", mem, REG2);             break;
+            case STORE:     x86_64_address(mem, OP1, NULL, 0);
+                            x86_64_emitf("movq %s, %s", REG0, mem);             break;
+            case STORE_AI:  x86_64_address(mem, OP1, NULL, OP2.imm);
+                            x86_64_emitf("movq %s, %s", REG0, mem);             break;
+            case STORE_AO:  x86_64_address(mem, OP1, &OP2, 0);
+                            x86_64_emitf("movq %s, %s", REG0, mem);             break;
+
+            /* arithmetic */
+
+            case ADD:       x86_64_bin_op("addq",  true,  OP0, OP1, OP2);       break;
+            case SUB:       x86_64_bin_op("subq",  false, OP0, OP1, OP2);       break;
+            case MULT:      x86_64_bin_op("imulq", true,  OP0, OP1, OP2);       break;
+            case AND:       x86_64_bin_op("andq",  true,  OP0, OP1, OP2);       break;
+            case OR:        x86_64_bin_op("orq",   true,  OP0, OP1, OP2);       break;
+            case ADD_I:     x86_64_imm_op("addq",  OP0, OP1.imm, OP2);          break;
+            case MULT_I:    x86_64_imm_op("imulq", OP0, OP1.imm, OP2);          break;
+
+            /* idivq divides %rdx:%rax, so RET is saved around it; a zero
+             * divisor or INT64_MIN / -1 (where negation overflows) would
+             * raise SIGFPE, so those stop the program as in the simulator */
+            case DIV:       x86_64_move(REG1, TMP2);
+                            x86_64_move(RET, TMP1);
+                            x86_64_move(REG0, RET);
+                            x86_64_emitf("testq %s, %s", TMP2, TMP2);
+                            x86_64_emit("je _decaf_div_zero");
+                            x86_64_emitf("cmpq $-1, %s", TMP2);
+                            x86_64_emit("jne 1f");
+                            x86_64_emit("movq %rax, %rdx");
+                            x86_64_emit("negq %rdx");
+                            x86_64_emit("jo _decaf_div_overflow");
+                            fprintf(out, "1:\n");
+                            x86_64_emit("cqto");
+                            x86_64_emitf("idivq %s", TMP2);
+                            x86_64_move(RET, REG2);
+                            if (strcmp(REG2, RET) != 0) {
+                                x86_64_move(TMP1, RET);
+                            }
+                            break;
+
+            case NEG:       x86_64_move(REG0, REG1);
+                            x86_64_emitf("negq %s", REG1);
+                            break;
+
+            /* !x = ~x & 1 (as in the simulator) */
+            case NOT:       x86_64_move(REG0, REG1);
+                            x86_64_emitf("notq %s", REG1);
+                            x86_64_emitf("andq $1, %s", REG1);
+                            break;
+
+            /* comparisons (setcc and movzbq leave the flags for a CBR) */
+
+            case CMP_LT: case CMP_LE: case CMP_EQ:
+            case CMP_GE: case CMP_GT: case CMP_NE:
+                x86_64_emitf("cmpq %s, %s", REG1, REG0);
+                x86_64_emitf("set%s %s", x86_64_cc(i->form, false), TMP1_BYTE);
+                x86_64_emitf("movzbq %s, %s", TMP1_BYTE, REG2);
+                flags_form = i->form;
+                flags_reg = REG2;
+                break;
+
+            /* control flow (jumps to the next instruction are omitted) */
+
+            case LABEL:
+                if (OP0.type == CALL_LABEL) {
+                    fprintf(out, "\n    .p2align 4\n");
+                    fprintf(out, "decaf_%s:\n", OP0.str);
+                } else {
+                    fprintf(out, ".L%d:\n", OP0.id);
+                }
+                break;
+
+            case JUMP:
+                if (!is_jump_label(i->next, OP0.id)) {
+                    x86_64_emitf("jmp .L%d", OP0.id);
+                }
+                break;
+
+            case CBR:
+            {
+                /* branch on the flags of the comparison that computed the
+                 * condition, if it was the previous instruction */
+                InsnForm form = CMP_NE;
+                if (fused_reg != NULL && strcmp(fused_reg, REG0) == 0) {
+                    form = fused_form;
+                } else {
+                    x86_64_emitf("testq %s, %s", REG0, REG0);
+                }
+                if (is_jump_label(i->next, OP1.id)) {
+                    x86_64_emitf("j%s .L%d", x86_64_cc(form, true), OP2.id);
+                } else {
+                    x86_64_emitf("j%s .L%d", x86_64_cc(form, false), OP1.id);
+                    if (!is_jump_label(i->next, OP2.id)) {
+                        x86_64_emitf("jmp .L%d", OP2.id);
+                    }
+                }
+                break;
+            }
+
+            case CALL:
+                x86_64_emitf("call decaf_%s", OP0.str);
+                break;
+
+            case RETURN:
+                x86_64_emit("ret");
+                break;
+
+            /* output (through the runtime routines) */
+
+            case PRINT:
+            {
+                switch (OP0.type)
+                {
+                    case PHYSICAL_REG:
+                        x86_64_move(REG0, TMP1);
+                        x86_64_emit("call _decaf_print_int");
+                        break;
+
+                    case INT_CONST:
+                        x86_64_load_imm(OP0.imm, TMP1);
+                        x86_64_emit("call _decaf_print_int");
+                        break;
+
+                    case STR_CONST:
+                    {
+                        /* identical strings share one table entry */
+                        int sidx = num_strings;
+                        for (int s = 0; s < num_strings; s++) {
+                            if (token_str_eq(strings[s], OP0.str)) {
+                                sidx = s;
+                                break;
+                            }
+                        }
+                        if (sidx == num_strings) {
+                            if (num_strings == strings_capacity) {
+                                strings_capacity = (strings_capacity == 0 ? 16 : strings_capacity * 2);
+                                strings = (const char**)realloc(strings, sizeof(const char*) * strings_capacity);
+                                CHECK_MALLOC_PTR(strings);
+                            }
+                            strings[num_strings] = (const char*)&(OP0.str);
+                            num_strings++;
+                        }
+                        x86_64_emitf("leaq _decaf_str%d(%%rip), %s", sidx, TMP1);
+                        x86_64_emit("call _decaf_print_str");
+                        break;
+                    }
+
+                    default:
+                        printf("Unsupported instruction: ");
+                        ILOCInsn_print(i, output);
+                        printf("\n");
+                        break;
+                }
+                break;
+            }
+
+            case NOP:
+                x86_64_emit("nop");
+                break;
+
+            case PHI:
+                /* nothing to do */
+                break;
+
+            default:
+                printf("Unsupported instruction: ");
+                ILOCInsn_print(i, output);
+                printf("\n");
+                break;
+        }
+    }
+
+    /* runtime */
+    x86_64_emit_print_routine("_decaf_print_int", "_decaf_fmt_int");
+    x86_64_emit_print_routine("_decaf_print_str", "_decaf_fmt_str");
+    x86_64_emit_error_routine("_decaf_div_zero", "_decaf_msg_div_zero");
+    x86_64_emit_error_routine("_decaf_div_overflow", "_decaf_msg_div_overflow");
+
+    /* string constants */
+    fprintf(out, "\n    .section .rodata\n");
+    fprintf(out, "_decaf_fmt_int:\n");
+    x86_64_emit(".string \"%ld\"");
+    fprintf(out, "_decaf_fmt_str:\n");
+    x86_64_emit(".string \"%s\"");
+    fprintf(out, "_decaf_msg_div_zero:\n");
+    x86_64_emit(".string \"ERROR: Division by zero\"");
+    fprintf(out, "_decaf_msg_div_overflow:\n");
+    x86_64_emitf(".string \"ERROR: Division overflow (%" PRId64 " / -1)\"", INT64_MIN);
+    for (int s = 0; s < num_strings; s++) {
+        fprintf(out, "_decaf_str%d:\n", s);
+        fprintf(out, "    .string \"");
+        print_escaped_string(strings[s], out);
+        fprintf(out, "\"\n");
+    }
+
+    /* global variables (zero-initialized) */
+    long globals_size = (static_size > 0 ? (static_size + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE : WORD_SIZE);
+    fprintf(out, "\n    .bss\n");
+    x86_64_emit(".p2align 3");
+    fprintf(out, "_decaf_globals:\n");
+    x86_64_emitf(".zero %ld", globals_size);
+
+    /* the code never needs an executable stack */
+    fprintf(out, "\n    .section .note.GNU-stack,\"\",@progbits\n");
+
+    out = NULL;
+    free(strings);
+}
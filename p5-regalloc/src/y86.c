@@ -1,4 +1,6 @@
+#define _DEFAULT_SOURCE
 #include "y86.h"
+#include "y86opt.h"
 
 static FILE* out = NULL;
 
@@ -23,15 +25,15 @@ static FILE* out = NULL;
  * rbx - literal 1
  * rsp - stack pointer (SP)
  * rbp - base pointer (BP)
- * rsi - I/O source
- * rdi - I/O destination
+ * rsi - I/O source (also scratch in _builtin_div)
+ * rdi - I/O destination (also scratch in _builtin_div)
  * r8  - reserved
  * r9  - reserved
  * r10 - r2
  * r11 - r3
  * r12 - reserved
  * r13 - reserved
- * r14 - reserved (currently unused)
+ * r14 - reserved (scratch in _builtin_mult and _builtin_div)
  */
 const char* reg_name(Operand op)
 {
@@ -41,7 +43,7 @@ const char* reg_name(Operand op)
         case STACK_REG:  reg = "%rsp"; break;   // SP
         case RETURN_REG: reg = "%rax"; break;   // RET
         case PHYSICAL_REG:
-            if (op.id >= 4) {
+            if (op.id >= Y86_NUM_PHYSICAL_REGS) {
                 fprintf(stderr, "Invalid register: ");
                 Operand_print(op, stderr);
                 fprintf(stderr, " (must be R0-R3 for translation to physical register)\n");
@@ -98,6 +100,11 @@ void emit_bin_op (const char* opcode, Operand op0, Operand op1, Operand op2)
     if (op0.id == op2.id) {
         /* first operand is also the output; overwrite it */
         emitf("%s %s, %s", opcode, reg_name(op1), reg_name(op0));
+    } else if (op1.id == op2.id && strcmp(opcode, "subq") == 0) {
+        /* second operand is also the output, but the order matters */
+        emitf("rrmovq %s, %s", reg_name(op0), TMP1);
+        emitf("%s %s, %s", opcode, reg_name(op1), TMP1);
+        emitf("rrmovq %s, %s", TMP1, reg_name(op2));
     } else if (op1.id == op2.id) {
         /* second operand is also the output; overwrite it */
         emitf("%s %s, %s", opcode, reg_name(op0), reg_name(op1));
@@ -108,6 +115,82 @@ void emit_bin_op (const char* opcode, Operand op0, Operand op1, Operand op2)
     }
 }
 
+/*
+ * negate a register in place (clobbers TMP5)
+ */
+void emit_neg (const char* reg)
+{
+    emitf("xorq %s, %s", TMP5, TMP5);
+    emitf("subq %s, %s", reg, TMP5);
+    emitf("rrmovq %s, %s", TMP5, reg);
+}
+
+/*
+ * multiply by a constant without a call: a chain of doublings, each followed
+ * by an addition or subtraction of x for every nonzero digit of |c| (using
+ * whichever of its binary and non-adjacent forms gives the shorter chain);
+ * clobbers TMP2 and TMP5
+ */
+void emit_mult_const (const char* src, long c, const char* dst)
+{
+    uint64_t m = (c < 0 ? -(uint64_t)c : (uint64_t)c);
+    if (m == 0) {
+        emitf("xorq %s, %s", dst, dst);
+        return;
+    }
+
+    /* signed digits of |c|, least significant first */
+    int binary[65], naf[65];
+    int binary_len = 0, naf_len = 0, binary_nonzero = 0, naf_nonzero = 0;
+    for (uint64_t n = m; n != 0; n >>= 1) {
+        binary[binary_len++] = (int)(n & 1);
+        binary_nonzero += (int)(n & 1);
+    }
+    for (uint64_t n = m; n != 0; n >>= 1) {
+        int d = 0;
+        if (n & 1) {
+            d = ((n & 3) == 1 ? 1 : -1);
+            n -= d;
+            naf_nonzero++;
+        }
+        naf[naf_len++] = d;
+    }
+    int* digits = binary;
+    int len = binary_len;
+    int nonzero = binary_nonzero;
+    if (naf_len + naf_nonzero < binary_len + binary_nonzero) {
+        digits = naf;
+        len = naf_len;
+        nonzero = naf_nonzero;
+    }
+    int sign = (c < 0 ? -1 : 1);
+
+    /* keep a copy of x if the destination overwrites it before the last use */
+    const char* x = src;
+    if (nonzero > 1 && strcmp(src, dst) == 0) {
+        emitf("rrmovq %s, %s", src, TMP2);
+        x = TMP2;
+    }
+
+    /* the most significant digit is always 1 */
+    if (sign > 0 && strcmp(src, dst) != 0) {
+        emitf("rrmovq %s, %s", src, dst);
+    } else if (sign < 0 && strcmp(src, dst) == 0) {
+        emit_neg(dst);
+    } else if (sign < 0) {
+        emitf("xorq %s, %s", dst, dst);
+        emitf("subq %s, %s", src, dst);
+    }
+    for (int d = len - 2; d >= 0; d--) {
+        emitf("addq %s, %s", dst, dst);
+        if (digits[d] * sign > 0) {
+            emitf("addq %s, %s", x, dst);
+        } else if (digits[d] * sign < 0) {
+            emitf("subq %s, %s", x, dst);
+        }
+    }
+}
+
 void emit_cmp (const char* opcode, Operand op0, Operand op1, Operand op2)
 {
     emitf("xorq %s, %s", TMP1, TMP1);
@@ -124,29 +207,87 @@ void emit_cmp (const char* opcode, Operand op0, Operand op1, Operand op2)
 #define REG1 reg_name(OP1)
 #define REG2 reg_name(OP2)
 
-#define MAX_STRINGS 256
+/*
+ * constants known to be in physical registers R0-R3 (tracked within basic
+ * blocks; see emit_y86)
+ */
+#define KNOWN(OP) ((OP).type == PHYSICAL_REG && (OP).id >= 0 && \
+                   (OP).id < Y86_NUM_PHYSICAL_REGS && known[(OP).id])
+#define VALUE(OP) (known_value[(OP).id])
+
+/*
+ * size in bytes of assembled code (standard Y86-64 instruction encodings, plus
+ * .byte and .quad data)
+ */
+static long measure_code (const char* text)
+{
+    long size = 0;
+    for (const char* line = text; *line != '\0'; ) {
+        size_t length = strcspn(line, "\n");
+        char buffer[MAX_LINE_LEN];
+        char word[MAX_LINE_LEN];
+        snprintf(buffer, sizeof(buffer), "%.*s", (int)length, line);
+        line += length + (line[length] == '\n' ? 1 : 0);
+
+        /* skip blank lines and labels */
+        if (sscanf(buffer, "%255s", word) != 1 || word[strlen(word) - 1] == ':') {
+            continue;
+        }
+        int operands = 1;
+        for (const char* c = buffer; *c != '\0' && *c != '#'; c++) {
+            operands += (*c == ',');
+        }
+        if (strcmp(word, "halt") == 0 || strcmp(word, "nop") == 0 ||
+                strcmp(word, "ret") == 0 || strcmp(word, "iotrap") == 0) {
+            size += 1;
+        } else if (strcmp(word, "rrmovq") == 0 || strncmp(word, "cmov", 4) == 0 ||
+                strcmp(word, "addq") == 0 || strcmp(word, "subq") == 0 ||
+                strcmp(word, "andq") == 0 || strcmp(word, "xorq") == 0 ||
+                strcmp(word, "pushq") == 0 || strcmp(word, "popq") == 0) {
+            size += 2;
+        } else if (strcmp(word, "irmovq") == 0 || strcmp(word, "rmmovq") == 0 ||
+                strcmp(word, "mrmovq") == 0) {
+            size += 10;
+        } else if (word[0] == 'j' || strcmp(word, "call") == 0) {
+            size += 9;
+        } else if (strcmp(word, ".byte") == 0) {
+            size += operands;
+        } else if (strcmp(word, ".quad") == 0) {
+            size += 8 * operands;
+        }
+    }
+    return size;
+}
+
+static long align_up (long address, long alignment)
+{
+    return (address + alignment - 1) / alignment * alignment;
+}
 
 void emit_y86 (InsnList* iloc, FILE* output)
 {
-    const char* strings[MAX_STRINGS];
+    Y86EmitOptions options = { .static_size = Y86_DEFAULT_STATIC_SIZE };
+    emit_y86_with_options(iloc, &options, output);
+}
+
+void emit_y86_with_options (InsnList* iloc, Y86EmitOptions* options, FILE* output)
+{
+    const char** strings = NULL;
     int num_strings = 0;
+    int strings_capacity = 0;
     bool need_mult = false;
     bool need_div = false;
+    bool known[Y86_NUM_PHYSICAL_REGS] = { false };
+    long known_value[Y86_NUM_PHYSICAL_REGS];
 
-    out = output;
-
-    /* address zero boilerplate (for compatibility with CS:APP simulator) */
-    emit(".pos 0 code");
-    emit("jmp _start");
-    emit("");
-
-    /* static data (not really necessary b/c Decaf has no initialized data region) */
-    emit(".pos 0x100 data");
-    /* TODO: detect static size and emit ".quad" directives? */
-    emit("");
+    /* generate code into memory first (for the peephole optimizer and to
+     * measure it before laying out the sections) */
+    char* text = NULL;
+    size_t text_length = 0;
+    out = open_memstream(&text, &text_length);
+    CHECK_MALLOC_PTR(out);
 
     /* entry point boilerplate (for compatibility with CS 261 projects) */
-    emit(".pos 0x400 code");
     emit_call_label("_start");
     emitf("irmovq $1, %s", ONE);
     emit("irmovq _stack, %rsp");
@@ -163,14 +304,14 @@ void emit_y86 (InsnList* iloc, FILE* output)
             case I2I:       emitf("rrmovq %s, %s", REG0, REG1);                 break;
             case PUSH:      emitf("pushq %s", REG0);                            break;
             case POP:       emitf("popq %s", REG0);                             break;
-            case LOAD_I:    emitf("irmovq $%d, %s", OP0.imm, REG1);             break;
+            case LOAD_I:    emitf("irmovq $%ld, %s", OP0.imm, REG1);             break;
             case LOAD:      emitf("mrmovq (%s), %s", REG0, REG1);               break;
-            case LOAD_AI:   emitf("mrmovq $%d(%s), %s", OP1.imm, REG0, REG2);   break;
+            case LOAD_AI:   emitf("mrmovq $%ld(%s), %s", OP1.imm, REG0, REG2);   break;
             case LOAD_AO:   emitf("rrmovq %s, %s", REG0, TMP1);
                             emitf("addq %s, %s", REG1, TMP1);
                             emitf("mrmovq (%s), %s", TMP1, REG2);               break;
             case STORE:     emitf("rmmovq %s, (%s)", REG0, REG1);               break;
-            case STORE_AI:  emitf("rmmovq %s, $%d(%s)", REG0, OP2.imm, REG1);   break;
+            case STORE_AI:  emitf("rmmovq %s, $%ld(%s)", REG0, OP2.imm, REG1);   break;
             case STORE_AO:  emitf("rrmovq %s, %s", REG1, TMP1);
                             emitf("addq %s, %s", REG2, TMP1);
                             emitf("rmmovq %s, (%s)", REG0, TMP1);               break;
@@ -181,32 +322,42 @@ void emit_y86 (InsnList* iloc, FILE* output)
             case SUB:       emit_bin_op("subq", OP0, OP1, OP2); break;
             case AND:       emit_bin_op("andq", OP0, OP1, OP2); break;
 
-            case ADD_I:     emitf("irmovq $%d, %s", OP1.imm, TMP1);
+            case ADD_I:     emitf("irmovq $%ld, %s", OP1.imm, TMP1);
                             if (OP0.id != OP2.id) {
                                 emitf("rrmovq %s, %s", REG0, REG2);
                             }
                             emitf("addq %s, %s", TMP1, REG2);
                             break;
 
-            case MULT:      emitf("rrmovq %s, %s", REG0, TMP1);
-                            emitf("rrmovq %s, %s", REG1, TMP2);
-                            emitf("call _builtin_mult");
-                            emitf("rrmovq %s, %s", TMP3, REG2);
-                            need_mult = true;
+            /* multiplication and division by known constants are expanded
+             * inline; everything else calls a helper routine */
+
+            case MULT:      if (KNOWN(OP1)) {
+                                emit_mult_const(REG0, VALUE(OP1), REG2);
+                            } else if (KNOWN(OP0)) {
+                                emit_mult_const(REG1, VALUE(OP0), REG2);
+                            } else {
+                                emitf("rrmovq %s, %s", REG0, TMP1);
+                                emitf("rrmovq %s, %s", REG1, TMP2);
+                                emitf("call _builtin_mult");
+                                emitf("rrmovq %s, %s", TMP3, REG2);
+                                need_mult = true;
+                            }
                             break;
 
-            case MULT_I:    emitf("rrmovq %s, %s", REG0, TMP1);
-                            emitf("irmovq $%d, %s", OP1.imm, TMP2);
-                            emitf("call _builtin_mult");
-                            emitf("rrmovq %s, %s", TMP3, REG2);
-                            need_mult = true;
+            case MULT_I:    emit_mult_const(REG0, OP1.imm, REG2);
                             break;
 
-            case DIV:       emitf("rrmovq %s, %s", REG0, TMP1);
-                            emitf("rrmovq %s, %s", REG1, TMP2);
-                            emitf("call _builtin_div");
-                            emitf("rrmovq %s, %s", TMP3, REG2);
-                            need_div = true;
+            case DIV:       if (KNOWN(OP1) && (VALUE(OP1) == 1 || VALUE(OP1) == -1)) {
+                                /* Y86 has no shifts, so only x/1 and x/-1 avoid the helper */
+                                emit_mult_const(REG0, VALUE(OP1), REG2);
+                            } else {
+                                emitf("rrmovq %s, %s", REG0, TMP1);
+                                emitf("rrmovq %s, %s", REG1, TMP2);
+                                emitf("call _builtin_div");
+                                emitf("rrmovq %s, %s", TMP3, REG2);
+                                need_div = true;
+                            }
                             break;
 
             /* OR(x,y) == XOR(x,y) + AND(x,y) */
@@ -285,13 +436,20 @@ void emit_y86 (InsnList* iloc, FILE* output)
 
                     case STR_CONST:
                     {
+                        /* identical strings share one table entry */
                         int sidx = num_strings;
                         for (int s = 0; s < num_strings; s++) {
                             if (token_str_eq(strings[s], OP0.str)) {
                                 sidx = s;
+                                break;
                             }
                         }
                         if (sidx == num_strings) {
+                            if (num_strings == strings_capacity) {
+                                strings_capacity = (strings_capacity == 0 ? 16 : strings_capacity * 2);
+                                strings = (const char**)realloc(strings, sizeof(const char*) * strings_capacity);
+                                CHECK_MALLOC_PTR(strings);
+                            }
                             strings[num_strings] = (const char*)&(OP0.str);
                             num_strings++;
                         }
@@ -324,43 +482,168 @@ void emit_y86 (InsnList* iloc, FILE* output)
                 printf("\n");
                 break;
         }
+
+        /* update known constants; ILOCInsn_get_write_register() reports no
+         * register for labels and calls (where everything must be forgotten)
+         * or for any form it does not list, so anything other than the forms
+         * known to leave registers alone forgets everything too */
+        Operand written = ILOCInsn_get_write_register(i);
+        if (written.type == EMPTY && i->form != STORE && i->form != STORE_AI &&
+                i->form != STORE_AO && i->form != NOP && i->form != JUMP &&
+                i->form != CBR && i->form != PUSH && i->form != PRINT && i->form != RETURN) {
+            for (int r = 0; r < Y86_NUM_PHYSICAL_REGS; r++) {
+                known[r] = false;
+            }
+        } else if (written.type == PHYSICAL_REG && written.id >= 0 &&
+                written.id < Y86_NUM_PHYSICAL_REGS) {
+            if (i->form == LOAD_I) {
+                known[written.id] = true;
+                known_value[written.id] = OP0.imm;
+            } else if (i->form == I2I && KNOWN(OP0)) {
+                known[written.id] = true;
+                known_value[written.id] = VALUE(OP0);
+            } else {
+                known[written.id] = false;
+            }
+        }
     }
 
     if (need_mult) {
-        /* TODO: handle negative numbers */
+        /* shift-and-add over the bits of |x| (Y86 has no shifts, so y and the
+         * bit mask are doubled instead); negating both operands leaves the
+         * product unchanged, and products wrap around like ILOC's MULT */
         emit("");
         emit_call_label("_builtin_mult");   /* x in TMP1, y in TMP2 */
         emitf("xorq %s, %s", TMP3, TMP3);   /* prod = 0 */
-        emit_call_label("_mul_loop");
+        emitf("andq %s, %s", TMP1, TMP1);
+        emitf("jge _mul_start");            /* if (x < 0): */
+        emit_neg(TMP1);                     /*   x = -x */
+        emit_neg(TMP2);                     /*   y = -y */
+        emit_call_label("_mul_start");
+        emitf("rrmovq %s, %s", ONE, TMP4);  /* bit = 1 */
         emitf("andq %s, %s", TMP1, TMP1);
         emitf("je _mul_done");              /* while (x != 0): */
-        emitf("addq %s, %s", TMP2, TMP3);   /*   prod += y */
-        emitf("subq %s, %s", ONE, TMP1);    /*   x = x - 1 */
-        emitf("jmp _mul_loop");
+        emit_call_label("_mul_loop");
+        emitf("rrmovq %s, %s", TMP4, TMP5);
+        emitf("andq %s, %s", TMP1, TMP5);
+        emitf("je _mul_skip");              /*   if (x & bit): */
+        emitf("addq %s, %s", TMP2, TMP3);   /*     prod += y */
+        emitf("subq %s, %s", TMP4, TMP1);   /*     x -= bit */
+        emit_call_label("_mul_skip");
+        emitf("addq %s, %s", TMP2, TMP2);   /*   y <<= 1 */
+        emitf("addq %s, %s", TMP4, TMP4);   /*   bit <<= 1 */
+        emitf("andq %s, %s", TMP1, TMP1);
+        emitf("jne _mul_loop");
         emit_call_label("_mul_done");
         emit("ret");                        /* return prod in TMP3 */
     }
 
     if (need_div) {
-        /* TODO: handle negative numbers */
+        /* binary long division of |x| by |y|: double the divisor until it
+         * exceeds |x|, pushing each multiple, then pop them back (Y86 has no
+         * right shift) and subtract where possible, one quotient bit each; the
+         * quotient is truncated toward zero and negated if the signs differ */
         emit("");
         emit_call_label("_builtin_div");    /* x in TMP1, y in TMP2 */
+        emitf("rrmovq %s, %s", TMP1, TMP5);
+        emitf("xorq %s, %s", TMP2, TMP5);
+        emitf("pushq %s", TMP5);            /* save sign of x ^ y */
+        emitf("andq %s, %s", TMP1, TMP1);
+        emitf("jge _div_xpos");
+        emit_neg(TMP1);                     /* x = |x| */
+        emit_call_label("_div_xpos");
+        emitf("andq %s, %s", TMP2, TMP2);
+        emitf("je _div_zero");
+        emitf("jg _div_ypos");
+        emit_neg(TMP2);                     /* y = |y| */
+        emit_call_label("_div_ypos");
+
+        /* |x| and multiples of |y| can reach 2^63, so they are compared as
+         * unsigned values by flipping their sign bits first */
+        emitf("irmovq $0x8000000000000000, %s", IOSRC);
         emitf("xorq %s, %s", TMP3, TMP3);   /* div = 0 */
-        emit_call_label("_div_loop");
-        emitf("xorq %s, %s", TMP4, TMP4);
-        emitf("subq %s, %s", TMP1, TMP4);
-        emitf("jge _div_done");             /* while (0 < x): */
-        emitf("subq %s, %s", TMP2, TMP1);   /*   x -= y */
-        emitf("addq %s, %s", ONE, TMP3);    /*   div = div + 1 */
-        emitf("jmp _div_loop");
+        emitf("rrmovq %s, %s", TMP1, TMP4);
+        emitf("xorq %s, %s", IOSRC, TMP4);
+        emitf("rrmovq %s, %s", RSP, IODST); /* bottom of the pushed multiples */
+        emit_call_label("_div_up");
+        emitf("rrmovq %s, %s", TMP2, TMP5);
+        emitf("xorq %s, %s", IOSRC, TMP5);
+        emitf("subq %s, %s", TMP4, TMP5);
+        emitf("jg _div_down");              /* while (y <= x): */
+        emitf("pushq %s", TMP2);            /*   push y */
+        emitf("andq %s, %s", TMP2, TMP2);
+        emitf("jl _div_down");              /*   (2^63 can't be doubled) */
+        emitf("addq %s, %s", TMP2, TMP2);   /*   y <<= 1 */
+        emitf("jmp _div_up");
+        emit_call_label("_div_down");
+        emitf("rrmovq %s, %s", IODST, TMP5);
+        emitf("subq %s, %s", RSP, TMP5);
+        emitf("je _div_sign");              /* while (multiples remain): */
+        emitf("popq %s", TMP2);             /*   pop y */
+        emitf("addq %s, %s", TMP3, TMP3);   /*   div <<= 1 */
+        emitf("rrmovq %s, %s", TMP1, TMP4);
+        emitf("xorq %s, %s", IOSRC, TMP4);
+        emitf("rrmovq %s, %s", TMP2, TMP5);
+        emitf("xorq %s, %s", IOSRC, TMP5);
+        emitf("subq %s, %s", TMP5, TMP4);   /*   tmp = x - y */
+        emitf("jl _div_down");              /*   if (x >= y): */
+        emitf("rrmovq %s, %s", TMP4, TMP1); /*     x = tmp */
+        emitf("addq %s, %s", ONE, TMP3);    /*     div |= 1 */
+        emitf("jmp _div_down");
+        emit_call_label("_div_sign");
+        emitf("popq %s", TMP5);
+        emitf("andq %s, %s", TMP5, TMP5);
+        emitf("jge _div_done");
+        emit_neg(TMP3);                     /* div = -div */
         emit_call_label("_div_done");
         emit("ret");                        /* return div in TMP3 */
+        emit_call_label("_div_zero");
+        emit_w_comment(".byte 0xf0", "invalid instruction (division by zero)");
+    }
+
+    fclose(out);
+    char* code = optimize_y86(text);
+    free(text);
+
+    /* lay out the sections: global variables where the ILOC code addresses
+     * them, then code, strings, and (at least Y86_MIN_STACK_SIZE bytes above
+     * everything else) the top of the stack */
+    long static_size = align_up(options->static_size > 0 ? options->static_size : 0, WORD_SIZE);
+    long code_addr = STATIC_VAR_OFFSET + static_size;
+    long rodata_addr = align_up(code_addr + measure_code(code), WORD_SIZE);
+    long rodata_size = 0;
+    for (int s = 0; s < num_strings; s++) {
+        rodata_size += strlen(strings[s]) + 1;
+    }
+    long stack_addr = options->stack_top;
+    if (stack_addr <= 0) {
+        stack_addr = align_up(rodata_addr + rodata_size + Y86_MIN_STACK_SIZE, 0x100);
+        if (stack_addr < Y86_DEFAULT_STACK_TOP) {
+            stack_addr = Y86_DEFAULT_STACK_TOP;
+        }
+    }
+
+    out = output;
+
+    /* address zero boilerplate (for compatibility with CS:APP simulator) */
+    emit(".pos 0 code");
+    emit("jmp _start");
+    emit("");
+
+    /* static data (zero-initialized; Decaf has no initialized data region) */
+    emitf(".pos 0x%lx data", (long)STATIC_VAR_OFFSET);
+    for (long offset = 0; offset < static_size; offset += WORD_SIZE) {
+        emit(".quad 0");
     }
+    emit("");
+
+    emitf(".pos 0x%lx code", code_addr);
+    fputs(code, out);
 
     /* emit string table if needed */
     if (num_strings > 0) {
         emit("");
-        emit(".pos 0xa00 rodata");
+        emitf(".pos 0x%lx rodata", rodata_addr);
         for (int s = 0; s < num_strings; s++) {
             fprintf(out, "_str%d:\n", s);
             fprintf(out, "    .string \"");
@@ -371,7 +654,11 @@ void emit_y86 (InsnList* iloc, FILE* output)
 
     /* emit stack location marker */
     emit("");
-    emit(".pos 0xf00 stack");
+    emitf(".pos 0x%lx stack", stack_addr);
     emit_call_label("_stack");
     emit("");
+
+    out = NULL;
+    free(code);
+    free(strings);
 }
@@ -0,0 +1,1026 @@
+/**
+ * @file y86opt.c
+ * @brief Peephole optimizer for Y86 assembly generated by @ref emit_y86
+ */
+#define _DEFAULT_SOURCE
+#include "y86opt.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+/*
+ * register sets: bit n is register n in the Y86-64 encoding (%rax = 0 through
+ * %r14 = 14), and bit 15 stands for the condition codes
+ */
+typedef uint16_t RegSet;
+
+#define NUM_REGS    15
+#define NO_REG      -1
+#define REG_ONE     3       /* %rbx (always 1 after _start) */
+#define REG_RSP     4
+#define CC_BIT      ((RegSet)(1u << 15))
+#define ALL_REGS    ((RegSet)0xffff)
+#define REG_BIT(R)  ((RegSet)(1u << (R)))
+
+/*
+ * emitter scratch registers (%rsi, %rdi, %r8, %r9, %r13, %r14), which never
+ * carry values into or out of functions; %r12 returns helper results
+ */
+#define SCRATCH     ((RegSet)(REG_BIT(6) | REG_BIT(7) | REG_BIT(8) | REG_BIT(9) | \
+                              REG_BIT(13) | REG_BIT(14)))
+
+/* maximum number of instructions searched by the local rewrites */
+#define MAX_WINDOW  16
+
+/* maximum number of optimization rounds */
+#define MAX_ROUNDS  20
+
+static const char* reg_names[NUM_REGS] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14"
+};
+
+/* condition suffixes and their negations */
+static const char* conditions[][2] = {
+    { "le", "g"  }, { "l",  "ge" }, { "e",  "ne" },
+    { "ne", "e"  }, { "ge", "l"  }, { "g",  "le" }
+};
+
+typedef enum LineType
+{
+    LINE_BLANK,     /* empty or comment only */
+    LINE_LABEL,
+    LINE_INSN,
+    LINE_OTHER      /* assembler directive */
+} LineType;
+
+typedef enum InsnKind
+{
+    K_OTHER,        /* halt, call, ret, iotrap, etc. (reads everything) */
+    K_NOP,
+    K_RRMOVQ,
+    K_CMOV,
+    K_IRMOVQ,
+    K_RMMOVQ,
+    K_MRMOVQ,
+    K_OPQ,
+    K_JMP,
+    K_JXX,
+    K_PUSHQ,
+    K_POPQ
+} InsnKind;
+
+#define MAX_OP_LEN  16
+#define MAX_ARG_LEN 64
+
+typedef struct Line
+{
+    LineType type;
+    char* text;                     /* original text (no newline) */
+    const char* comment;            /* trailing comment (points into text) */
+    char op[MAX_OP_LEN];            /* mnemonic or directive */
+    char arg[2][MAX_ARG_LEN];       /* operands (label name for LINE_LABEL) */
+    int nargs;
+    InsnKind kind;
+    int ra, rb;                     /* register operands (see get_operands) */
+    RegSet use, write, kill;        /* effects (see get_effects) */
+    int target;                     /* referenced label line, or -1 */
+    bool deleted;
+    bool modified;
+    RegSet live_out;
+    RegSet live_in;
+} Line;
+
+typedef struct Program
+{
+    Line* lines;
+    int size;
+    bool one_ok;                    /* %rbx is set to 1 once and never written again */
+    int one_def;                    /* line that sets %rbx */
+} Program;
+
+/*
+ * PARSING
+ */
+
+static char* trim (char* str)
+{
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+    char* end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+static int reg_num (const char* str)
+{
+    for (int r = 0; r < NUM_REGS; r++) {
+        if (strcmp(str, reg_names[r]) == 0) {
+            return r;
+        }
+    }
+    return NO_REG;
+}
+
+/* base register of a memory operand "D(%reg)" */
+static int base_reg (const char* str)
+{
+    const char* open = strchr(str, '(');
+    const char* close = (open ? strchr(open, ')') : NULL);
+    if (open == NULL || close == NULL || close - open - 1 >= MAX_ARG_LEN) {
+        return NO_REG;
+    }
+    char name[MAX_ARG_LEN];
+    snprintf(name, sizeof(name), "%.*s", (int)(close - open - 1), open + 1);
+    return reg_num(name);
+}
+
+static bool imm_value (const char* str, long* value)
+{
+    if (str[0] != '$' || str[1] == '\0') {
+        return false;
+    }
+    char* end = NULL;
+    errno = 0;
+    long long v = (str[1] == '-' ? strtoll(str + 1, &end, 0) :
+                   (long long)strtoull(str + 1, &end, 0));
+    if (*end != '\0' || errno != 0) {
+        return false;
+    }
+    *value = (long)v;
+    return true;
+}
+
+static bool is_condition (const char* suffix)
+{
+    for (size_t c = 0; c < sizeof(conditions) / sizeof(conditions[0]); c++) {
+        if (strcmp(suffix, conditions[c][0]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char* negate_condition (const char* suffix)
+{
+    for (size_t c = 0; c < sizeof(conditions) / sizeof(conditions[0]); c++) {
+        if (strcmp(suffix, conditions[c][0]) == 0) {
+            return conditions[c][1];
+        }
+    }
+    return suffix;
+}
+
+static InsnKind classify (const char* op)
+{
+    if (strcmp(op, "nop") == 0)     return K_NOP;
+    if (strcmp(op, "rrmovq") == 0)  return K_RRMOVQ;
+    if (strcmp(op, "irmovq") == 0)  return K_IRMOVQ;
+    if (strcmp(op, "rmmovq") == 0)  return K_RMMOVQ;
+    if (strcmp(op, "mrmovq") == 0)  return K_MRMOVQ;
+    if (strcmp(op, "pushq") == 0)   return K_PUSHQ;
+    if (strcmp(op, "popq") == 0)    return K_POPQ;
+    if (strcmp(op, "jmp") == 0)     return K_JMP;
+    if (strcmp(op, "addq") == 0 || strcmp(op, "subq") == 0 ||
+        strcmp(op, "andq") == 0 || strcmp(op, "xorq") == 0) {
+        return K_OPQ;
+    }
+    if (strncmp(op, "cmov", 4) == 0 && is_condition(op + 4)) {
+        return K_CMOV;
+    }
+    if (op[0] == 'j' && is_condition(op + 1)) {
+        return K_JXX;
+    }
+    return K_OTHER;
+}
+
+static void update_line (Line* line);
+
+static void parse_line (Line* line, const char* text, size_t length)
+{
+    memset(line, 0, sizeof(Line));
+    line->target = -1;
+    line->text = (char*)malloc(length + 1);
+    CHECK_MALLOC_PTR(line->text);
+    memcpy(line->text, text, length);
+    line->text[length] = '\0';
+
+    char buffer[MAX_LINE_LEN];
+    snprintf(buffer, sizeof(buffer), "%s", line->text);
+    char* hash = strchr(buffer, '#');
+    if (hash != NULL) {
+        *hash = '\0';
+        line->comment = trim(line->text + (hash - buffer) + 1);
+    }
+    char* str = trim(buffer);
+    size_t len = strlen(str);
+
+    if (len == 0) {
+        line->type = LINE_BLANK;
+    } else if (str[len - 1] == ':' && strpbrk(str, " \t") == NULL) {
+        line->type = LINE_LABEL;
+        snprintf(line->arg[0], MAX_ARG_LEN, "%.*s", (int)(len - 1), str);
+    } else {
+        line->type = (str[0] == '.' ? LINE_OTHER : LINE_INSN);
+
+        /* mnemonic followed by up to two comma-separated operands */
+        char* rest = str + strcspn(str, " \t");
+        if (*rest != '\0') {
+            *rest++ = '\0';
+        }
+        snprintf(line->op, MAX_OP_LEN, "%s", str);
+        rest = trim(rest);
+        while (*rest != '\0' && line->nargs < 2) {
+            char* comma = strchr(rest, ',');
+            if (comma != NULL) {
+                *comma = '\0';
+            }
+            snprintf(line->arg[line->nargs++], MAX_ARG_LEN, "%s", trim(rest));
+            rest = (comma != NULL ? comma + 1 : rest + strlen(rest));
+        }
+    }
+    update_line(line);
+}
+
+/* label lookup table (sorted by name) */
+typedef struct LabelEntry
+{
+    const char* name;
+    int line;
+} LabelEntry;
+
+static int compare_labels (const void* a, const void* b)
+{
+    return strcmp(((const LabelEntry*)a)->name, ((const LabelEntry*)b)->name);
+}
+
+static void resolve_labels (Program* prog)
+{
+    LabelEntry* labels = (LabelEntry*)malloc(sizeof(LabelEntry) * (prog->size + 1));
+    CHECK_MALLOC_PTR(labels);
+    int num_labels = 0;
+    for (int i = 0; i < prog->size; i++) {
+        if (prog->lines[i].type == LINE_LABEL) {
+            labels[num_labels].name = prog->lines[i].arg[0];
+            labels[num_labels].line = i;
+            num_labels++;
+        }
+    }
+    qsort(labels, num_labels, sizeof(LabelEntry), compare_labels);
+
+    /* any bare identifier operand (jump/call targets, addresses in irmovq or
+     * directives) refers to a label */
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->type != LINE_INSN && line->type != LINE_OTHER) {
+            continue;
+        }
+        for (int a = 0; a < line->nargs; a++) {
+            if (isalpha((unsigned char)line->arg[a][0]) || line->arg[a][0] == '_') {
+                LabelEntry key = { line->arg[a], 0 };
+                LabelEntry* found = (LabelEntry*)bsearch(&key, labels, num_labels,
+                        sizeof(LabelEntry), compare_labels);
+                if (found != NULL) {
+                    line->target = found->line;
+                }
+            }
+        }
+    }
+    free(labels);
+}
+
+/*
+ * INSTRUCTION PROPERTIES
+ */
+
+/* register operands in the rA and rB positions of the encoding */
+static void find_operands (Line* line, int* ra, int* rb)
+{
+    *ra = NO_REG;
+    *rb = NO_REG;
+    switch (line->kind) {
+        case K_RRMOVQ: case K_CMOV: case K_OPQ:
+            *ra = reg_num(line->arg[0]);
+            *rb = reg_num(line->arg[1]);
+            break;
+        case K_IRMOVQ:
+            *rb = reg_num(line->arg[1]);
+            break;
+        case K_RMMOVQ:
+            *ra = reg_num(line->arg[0]);
+            *rb = base_reg(line->arg[1]);
+            break;
+        case K_MRMOVQ:
+            *ra = reg_num(line->arg[1]);
+            *rb = base_reg(line->arg[0]);
+            break;
+        case K_PUSHQ: case K_POPQ:
+            *ra = reg_num(line->arg[0]);
+            break;
+        default:
+            break;
+    }
+}
+
+static RegSet reg_bit (int reg)
+{
+    return (reg == NO_REG ? 0 : REG_BIT(reg));
+}
+
+/*
+ * registers read, registers written, and registers whose previous values are
+ * definitely replaced (a conditional move writes its destination but may
+ * leave the old value)
+ */
+static void find_effects (Line* line, RegSet* use, RegSet* write, RegSet* kill)
+{
+    int ra, rb;
+    find_operands(line, &ra, &rb);
+    *use = 0;
+    *write = 0;
+    switch (line->kind) {
+        case K_NOP: case K_JMP:
+            break;
+        case K_RRMOVQ:
+            *use = reg_bit(ra);
+            *write = reg_bit(rb);
+            break;
+        case K_CMOV:
+            *use = reg_bit(ra) | reg_bit(rb) | CC_BIT;
+            *write = reg_bit(rb);
+            break;
+        case K_IRMOVQ:
+            *write = reg_bit(rb);
+            break;
+        case K_RMMOVQ:
+            *use = reg_bit(ra) | reg_bit(rb);
+            break;
+        case K_MRMOVQ:
+            *use = reg_bit(rb);
+            *write = reg_bit(ra);
+            break;
+        case K_OPQ:
+            /* x ^ x and x - x don't depend on x */
+            if (ra != rb || (strcmp(line->op, "xorq") != 0 && strcmp(line->op, "subq") != 0)) {
+                *use = reg_bit(ra) | reg_bit(rb);
+            }
+            *write = reg_bit(rb) | CC_BIT;
+            break;
+        case K_JXX:
+            *use = CC_BIT;
+            break;
+        case K_PUSHQ:
+            *use = reg_bit(ra) | REG_BIT(REG_RSP);
+            *write = REG_BIT(REG_RSP);
+            break;
+        case K_POPQ:
+            *use = REG_BIT(REG_RSP);
+            *write = reg_bit(ra) | REG_BIT(REG_RSP);
+            break;
+        default:
+            /* flags and scratch registers are not returned from functions
+             * (and a callee that reads them is handled by compute_liveness) */
+            if (strcmp(line->op, "call") == 0 || strcmp(line->op, "ret") == 0) {
+                *use = ALL_REGS & ~(CC_BIT | SCRATCH);
+            } else if (strcmp(line->op, "iotrap") == 0) {
+                *use = ALL_REGS & ~CC_BIT;
+            } else {
+                *use = ALL_REGS;
+            }
+            break;
+    }
+    if (ra == NO_REG && (line->kind == K_RRMOVQ || line->kind == K_CMOV ||
+                         line->kind == K_OPQ || line->kind == K_PUSHQ)) {
+        *use = ALL_REGS;    /* unrecognized operand; be conservative */
+    }
+    *kill = (line->kind == K_CMOV ? 0 : *write);
+    if (strcmp(line->op, "call") == 0) {
+        *kill = CC_BIT | SCRATCH;
+    }
+}
+
+/* recompute the cached properties of a line after parsing or rewriting it */
+static void update_line (Line* line)
+{
+    line->kind = (line->type == LINE_INSN ? classify(line->op) : K_OTHER);
+    find_operands(line, &line->ra, &line->rb);
+    find_effects(line, &line->use, &line->write, &line->kill);
+}
+
+static void get_operands (Line* line, int* ra, int* rb)
+{
+    *ra = line->ra;
+    *rb = line->rb;
+}
+
+static void get_effects (Line* line, RegSet* use, RegSet* write, RegSet* kill)
+{
+    *use = line->use;
+    *write = line->write;
+    *kill = line->kill;
+}
+
+/* instructions that can be deleted if nothing they write is live */
+static bool is_pure (Line* line)
+{
+    return line->kind == K_NOP || line->kind == K_RRMOVQ || line->kind == K_CMOV ||
+           line->kind == K_IRMOVQ || line->kind == K_OPQ;
+}
+
+/* straight-line ALU and move instructions (safe to rename and reorder around) */
+static bool is_simple (Line* line)
+{
+    return line->kind == K_RRMOVQ || line->kind == K_CMOV || line->kind == K_IRMOVQ ||
+           line->kind == K_MRMOVQ || line->kind == K_OPQ;
+}
+
+static bool is_insn (Program* prog, int i)
+{
+    return i >= 0 && i < prog->size && prog->lines[i].type == LINE_INSN;
+}
+
+/* next line (skipping deleted and blank lines), or prog->size */
+static int next_line (Program* prog, int i)
+{
+    do {
+        i++;
+    } while (i < prog->size && (prog->lines[i].deleted || prog->lines[i].type == LINE_BLANK));
+    return i;
+}
+
+/* previous line (skipping deleted and blank lines), or -1 */
+static int prev_line (Program* prog, int i)
+{
+    do {
+        i--;
+    } while (i >= 0 && (prog->lines[i].deleted || prog->lines[i].type == LINE_BLANK));
+    return i;
+}
+
+/* true if execution falls through from line i to line j without executing anything */
+static bool falls_through (Program* prog, int i, int j)
+{
+    if (j <= i) {
+        return false;
+    }
+    for (int k = i + 1; k < j; k++) {
+        if (!prog->lines[k].deleted && prog->lines[k].type != LINE_BLANK &&
+                prog->lines[k].type != LINE_LABEL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void set_insn (Line* line, const char* op, const char* arg0, const char* arg1)
+{
+    /* copy first (the arguments may point into the line itself) */
+    char o[MAX_OP_LEN], a0[MAX_ARG_LEN], a1[MAX_ARG_LEN];
+    snprintf(o, sizeof(o), "%s", op);
+    snprintf(a0, sizeof(a0), "%s", arg0 ? arg0 : "");
+    snprintf(a1, sizeof(a1), "%s", arg1 ? arg1 : "");
+    snprintf(line->op, MAX_OP_LEN, "%s", o);
+    snprintf(line->arg[0], MAX_ARG_LEN, "%s", a0);
+    snprintf(line->arg[1], MAX_ARG_LEN, "%s", a1);
+    line->nargs = (arg1 ? 2 : (arg0 ? 1 : 0));
+    line->modified = true;
+    update_line(line);
+}
+
+static void set_target (Program* prog, Line* line, int target)
+{
+    set_insn(line, line->op, prog->lines[target].arg[0], NULL);
+    line->target = target;
+}
+
+static void rename_reg (Line* line, int from, int to)
+{
+    for (int a = 0; a < line->nargs; a++) {
+        if (reg_num(line->arg[a]) == from) {
+            snprintf(line->arg[a], MAX_ARG_LEN, "%s", reg_names[to]);
+            line->modified = true;
+        } else if (base_reg(line->arg[a]) == from) {
+            char arg[MAX_ARG_LEN];
+            int offset = (int)(strchr(line->arg[a], '(') - line->arg[a]);
+            snprintf(arg, sizeof(arg), "%.*s(%s)", offset, line->arg[a], reg_names[to]);
+            snprintf(line->arg[a], MAX_ARG_LEN, "%s", arg);
+            line->modified = true;
+        }
+    }
+    update_line(line);
+}
+
+/*
+ * LIVENESS (backwards dataflow over registers and condition codes)
+ */
+
+static void compute_liveness (Program* prog)
+{
+    for (int i = 0; i < prog->size; i++) {
+        prog->lines[i].live_in = 0;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        RegSet next_in = ALL_REGS;      /* running off the end */
+        for (int i = prog->size - 1; i >= 0; i--) {
+            Line* line = &prog->lines[i];
+            RegSet out = next_in, in = next_in;
+            if (line->deleted || line->type == LINE_BLANK || line->type == LINE_LABEL) {
+                /* pass through */
+            } else if (line->type == LINE_OTHER) {
+                in = ALL_REGS;
+            } else {
+                RegSet target_in = (line->target >= 0 ? prog->lines[line->target].live_in : ALL_REGS);
+                if (line->kind == K_JMP) {
+                    out = target_in;
+                } else if (line->kind == K_JXX) {
+                    out = next_in | target_in;
+                } else if (strcmp(line->op, "ret") == 0 || strcmp(line->op, "halt") == 0) {
+                    out = 0;    /* never falls through (uses cover the caller) */
+                }
+                RegSet use, write, kill;
+                get_effects(line, &use, &write, &kill);
+                if (line->kind == K_OTHER && strcmp(line->op, "call") == 0) {
+                    use |= (target_in & (CC_BIT | SCRATCH));
+                }
+                in = use | (out & ~kill);
+            }
+            line->live_out = out;
+            if (in != line->live_in) {
+                line->live_in = in;
+                changed = true;
+            }
+            next_in = in;
+        }
+    }
+}
+
+/*
+ * REWRITES (each returns the number of changes made)
+ */
+
+/* "jmp L1 ... L1: jmp L2", jumps to the next line, "jXX a; jmp b; a:", and
+ * instructions after unconditional control transfers that no label reaches */
+static int simplify_jumps (Program* prog)
+{
+    int changes = 0;
+
+    /* thread jumps and remove jumps to the next line */
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->deleted || (line->kind != K_JMP && line->kind != K_JXX) ||
+                line->type != LINE_INSN || line->target < 0) {
+            continue;
+        }
+        for (int hops = 0; hops < MAX_WINDOW; hops++) {
+            int dest = next_line(prog, line->target);
+            while (dest < prog->size && prog->lines[dest].type == LINE_LABEL) {
+                dest = next_line(prog, dest);
+            }
+            if (!is_insn(prog, dest) || dest == i || prog->lines[dest].kind != K_JMP ||
+                    prog->lines[dest].target < 0 || prog->lines[dest].target == line->target) {
+                break;
+            }
+            set_target(prog, line, prog->lines[dest].target);
+            changes++;
+        }
+        if (falls_through(prog, i, line->target)) {
+            line->deleted = true;
+            changes++;
+            continue;
+        }
+
+        /* jXX a; jmp b; a: => jNXX b */
+        int j = next_line(prog, i);
+        if (line->kind == K_JXX && is_insn(prog, j) && prog->lines[j].kind == K_JMP &&
+                prog->lines[j].target >= 0 && falls_through(prog, j, line->target)) {
+            char op[MAX_OP_LEN];
+            snprintf(op, sizeof(op), "j%s", negate_condition(line->op + 1));
+            snprintf(line->op, MAX_OP_LEN, "%s", op);
+            set_target(prog, line, prog->lines[j].target);
+            prog->lines[j].deleted = true;
+            changes++;
+        }
+    }
+
+    /* find labels that are still referenced */
+    bool* referenced = (bool*)calloc((size_t)prog->size + 1, sizeof(bool));
+    CHECK_MALLOC_PTR(referenced);
+    for (int i = 0; i < prog->size; i++) {
+        if (!prog->lines[i].deleted && prog->lines[i].target >= 0) {
+            referenced[prog->lines[i].target] = true;
+        }
+    }
+
+    /* remove unreachable instructions */
+    bool reachable = true;
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->deleted || line->type == LINE_BLANK) {
+            continue;
+        }
+        if (line->type == LINE_OTHER || (line->type == LINE_LABEL && referenced[i])) {
+            reachable = true;
+        } else if (line->type == LINE_INSN) {
+            if (!reachable) {
+                line->deleted = true;
+                changes++;
+            } else if (line->kind == K_JMP || strcmp(line->op, "ret") == 0 ||
+                       strcmp(line->op, "halt") == 0) {
+                reachable = false;
+            }
+        }
+    }
+    free(referenced);
+    return changes;
+}
+
+/* compare-and-branch folding: a flag materialized by
+ *
+ *     xorq T, T ; OPq ..., U ; cmovCC %rbx, T ; [rrmovq T, r ;] andq r, r ; jne/je L
+ *
+ * becomes a jump on the flags of the OPq (jCC/jNCC L); also removes tests of a
+ * register just computed by an OPq if only ZF is needed */
+static int fold_branches (Program* prog)
+{
+    int changes = 0;
+    for (int i = 0; i < prog->size; i++) {
+        Line* test = &prog->lines[i];
+        int r, rb;
+        if (test->deleted || test->type != LINE_INSN || test->kind != K_OPQ ||
+                strcmp(test->op, "andq") != 0) {
+            continue;
+        }
+        get_operands(test, &r, &rb);
+        if (r == NO_REG || r != rb) {
+            continue;
+        }
+        int j = next_line(prog, i);
+        if (!is_insn(prog, j) || prog->lines[j].kind != K_JXX ||
+                (prog->lines[j].live_out & CC_BIT) ||
+                (strcmp(prog->lines[j].op, "je") != 0 && strcmp(prog->lines[j].op, "jne") != 0)) {
+            continue;
+        }
+        Line* jump = &prog->lines[j];
+
+        /* the register was just computed by another OPq (which set ZF for it) */
+        int p = prev_line(prog, i);
+        if (!is_insn(prog, p)) {
+            continue;
+        }
+        int pa, pb;
+        get_operands(&prog->lines[p], &pa, &pb);
+        if (prog->lines[p].kind == K_OPQ && pb == r) {
+            test->deleted = true;
+            changes++;
+            continue;
+        }
+
+        /* the register holds a flag set by cmov from %rbx over a zeroed register */
+        if (!prog->one_ok) {
+            continue;
+        }
+        int flag = r, c = p;
+        if (prog->lines[p].kind == K_RRMOVQ && pb == r) {
+            flag = pa;
+            c = prev_line(prog, p);
+        }
+        int ca, cb;
+        if (flag == NO_REG || !is_insn(prog, c) || prog->lines[c].kind != K_CMOV) {
+            continue;
+        }
+        get_operands(&prog->lines[c], &ca, &cb);
+        int o = prev_line(prog, c);
+        int oa, ob;
+        if (ca != REG_ONE || cb != flag || !is_insn(prog, o) || prog->lines[o].kind != K_OPQ) {
+            continue;
+        }
+        get_operands(&prog->lines[o], &oa, &ob);
+        if (ob == flag) {
+            continue;
+        }
+        bool zeroed = false;
+        for (int k = prev_line(prog, o), n = 0; is_insn(prog, k) && n < MAX_WINDOW;
+                k = prev_line(prog, k), n++) {
+            RegSet use, write, kill;
+            get_effects(&prog->lines[k], &use, &write, &kill);
+            if (prog->lines[k].kind == K_OTHER) {
+                break;
+            }
+            if (write & REG_BIT(flag)) {
+                int ka, kb;
+                long value;
+                get_operands(&prog->lines[k], &ka, &kb);
+                zeroed = (prog->lines[k].kind == K_OPQ && ka == kb &&
+                          (strcmp(prog->lines[k].op, "xorq") == 0 || strcmp(prog->lines[k].op, "subq") == 0)) ||
+                         (prog->lines[k].kind == K_IRMOVQ && imm_value(prog->lines[k].arg[0], &value) && value == 0);
+                break;
+            }
+        }
+        if (!zeroed) {
+            continue;
+        }
+
+        const char* cc = prog->lines[c].op + 4;
+        char op[MAX_OP_LEN];
+        snprintf(op, sizeof(op), "j%s", strcmp(jump->op, "jne") == 0 ? cc : negate_condition(cc));
+        set_insn(jump, op, jump->arg[0], NULL);
+        test->deleted = true;
+        changes++;
+    }
+    return changes;
+}
+
+/* self-moves, copies undone by the next instruction, and constants */
+static int simplify_moves (Program* prog)
+{
+    int changes = 0;
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->deleted || line->type != LINE_INSN) {
+            continue;
+        }
+        int ra, rb;
+        long value;
+        get_operands(line, &ra, &rb);
+        if (line->kind == K_RRMOVQ && ra != NO_REG && ra == rb) {
+            line->deleted = true;
+            changes++;
+        } else if (line->kind == K_RRMOVQ && ra != NO_REG && rb != NO_REG) {
+            /* rrmovq A, B ; rrmovq B, A */
+            int j = next_line(prog, i);
+            int ja, jb;
+            if (is_insn(prog, j) && prog->lines[j].kind == K_RRMOVQ) {
+                get_operands(&prog->lines[j], &ja, &jb);
+                if (ja == rb && jb == ra) {
+                    prog->lines[j].deleted = true;
+                    changes++;
+                }
+            }
+        } else if (line->kind == K_IRMOVQ && rb != NO_REG && imm_value(line->arg[0], &value)) {
+            if (value == 1 && prog->one_ok && i > prog->one_def && rb != REG_ONE) {
+                set_insn(line, "rrmovq", reg_names[REG_ONE], reg_names[rb]);
+                changes++;
+            } else if (value == 0 && !(line->live_out & CC_BIT)) {
+                set_insn(line, "xorq", reg_names[rb], reg_names[rb]);
+                changes++;
+            }
+        }
+    }
+    return changes;
+}
+
+/* copy propagation: "rrmovq A, X ; ... ; op X, Y" => "op A, Y" if this is the
+ * only use of X (also "irmovq $-1, X ; ... ; addq X, Y" => "subq %rbx, Y") */
+static int propagate_copies (Program* prog)
+{
+    int changes = 0;
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->deleted || line->type != LINE_INSN) {
+            continue;
+        }
+        int a, x;
+        long value;
+        get_operands(line, &a, &x);
+        bool minus_one = false;
+        if (line->kind == K_IRMOVQ) {
+            minus_one = prog->one_ok && imm_value(line->arg[0], &value) && value == -1;
+            if (!minus_one) {
+                continue;
+            }
+        } else if (line->kind != K_RRMOVQ || a == NO_REG || a == x) {
+            continue;
+        }
+        if (x == NO_REG || x == REG_RSP || a == REG_RSP) {
+            continue;
+        }
+
+        /* find the next instruction that mentions X (or overwrites A) */
+        int j = next_line(prog, i);
+        for (int n = 0; is_insn(prog, j) && n < MAX_WINDOW; j = next_line(prog, j), n++) {
+            RegSet use, write, kill;
+            get_effects(&prog->lines[j], &use, &write, &kill);
+            if (prog->lines[j].kind == K_OTHER) {
+                j = prog->size;
+                break;
+            }
+            if ((use | write) & REG_BIT(x)) {
+                break;
+            }
+            if (a != NO_REG && (write & REG_BIT(a))) {
+                j = prog->size;
+                break;
+            }
+        }
+        if (!is_insn(prog, j)) {
+            continue;
+        }
+        Line* user = &prog->lines[j];
+        int ua, ub;
+        get_operands(user, &ua, &ub);
+        if (ua != x || ub == x || (user->live_out & REG_BIT(x))) {
+            continue;
+        }
+        if (minus_one) {
+            if (user->kind == K_OPQ && strcmp(user->op, "addq") == 0) {
+                set_insn(user, "subq", reg_names[REG_ONE], user->arg[1]);
+                line->deleted = true;
+                changes++;
+            }
+        } else if (user->kind == K_RRMOVQ || user->kind == K_CMOV || user->kind == K_OPQ ||
+                   user->kind == K_RMMOVQ || user->kind == K_PUSHQ) {
+            snprintf(user->arg[0], MAX_ARG_LEN, "%s", reg_names[a]);
+            user->modified = true;
+            update_line(user);
+            line->deleted = true;
+            changes++;
+        }
+    }
+    return changes;
+}
+
+/* result forwarding: a value computed in a scratch register T and then moved
+ * ("... T ... ; rrmovq T, r") is computed in r directly if T is dead
+ * afterwards and r is not otherwise used in the meantime */
+static int forward_results (Program* prog)
+{
+    int changes = 0;
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        int t, r;
+        if (line->deleted || line->type != LINE_INSN || line->kind != K_RRMOVQ) {
+            continue;
+        }
+        get_operands(line, &t, &r);
+        if (t == NO_REG || r == NO_REG || t == r || t == REG_RSP || r == REG_RSP ||
+                (line->live_out & REG_BIT(t))) {
+            continue;
+        }
+
+        /* search backwards for the instruction that starts computing T */
+        int start = -1;
+        for (int k = prev_line(prog, i), n = 0; is_insn(prog, k) && n < MAX_WINDOW;
+                k = prev_line(prog, k), n++) {
+            Line* prev = &prog->lines[k];
+            if (!is_simple(prev)) {
+                break;
+            }
+            RegSet use, write, kill;
+            get_effects(prev, &use, &write, &kill);
+            if (use == ALL_REGS) {
+                break;
+            }
+            bool mentions_r = ((use | write) & REG_BIT(r)) != 0;
+            if ((kill & REG_BIT(t)) && !(use & REG_BIT(t))) {
+                /* T is replaced here without being read */
+                if (!(write & REG_BIT(r))) {
+                    start = k;
+                }
+                break;
+            }
+            if (mentions_r) {
+                break;
+            }
+        }
+        if (start < 0) {
+            continue;
+        }
+        for (int k = start; k < i; k++) {
+            if (!prog->lines[k].deleted && prog->lines[k].type == LINE_INSN) {
+                rename_reg(&prog->lines[k], t, r);
+            }
+        }
+        line->deleted = true;
+        changes++;
+    }
+    return changes;
+}
+
+/* instructions without side effects whose results are never read */
+static int eliminate_dead_code (Program* prog)
+{
+    int changes = 0;
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->deleted || line->type != LINE_INSN || !is_pure(line)) {
+            continue;
+        }
+        RegSet use, write, kill;
+        get_effects(line, &use, &write, &kill);
+        if (use != ALL_REGS && !(write & line->live_out)) {
+            line->deleted = true;
+            changes++;
+        }
+    }
+    return changes;
+}
+
+/*
+ * DRIVER
+ */
+
+/* %rbx may stand for the constant 1 if it is set to 1 exactly once */
+static void find_one_register (Program* prog)
+{
+    prog->one_ok = false;
+    prog->one_def = -1;
+    for (int i = 0; i < prog->size; i++) {
+        Line* line = &prog->lines[i];
+        if (line->type != LINE_INSN) {
+            continue;
+        }
+        RegSet use, write, kill;
+        long value;
+        get_effects(line, &use, &write, &kill);
+        if (!(write & REG_BIT(REG_ONE))) {
+            continue;
+        }
+        if (prog->one_def < 0 && line->kind == K_IRMOVQ &&
+                imm_value(line->arg[0], &value) && value == 1) {
+            prog->one_def = i;
+            prog->one_ok = true;
+        } else {
+            prog->one_ok = false;
+            return;
+        }
+    }
+}
+
+static void print_line (Line* line, FILE* output)
+{
+    if (!line->modified) {
+        fprintf(output, "%s\n", line->text);
+        return;
+    }
+    char insn[MAX_LINE_LEN];
+    if (line->nargs == 2) {
+        snprintf(insn, sizeof(insn), "%s %s, %s", line->op, line->arg[0], line->arg[1]);
+    } else if (line->nargs == 1) {
+        snprintf(insn, sizeof(insn), "%s %s", line->op, line->arg[0]);
+    } else {
+        snprintf(insn, sizeof(insn), "%s", line->op);
+    }
+    if (line->comment != NULL && line->comment[0] != '\0') {
+        fprintf(output, "    %-40s# %s\n", insn, line->comment);
+    } else {
+        fprintf(output, "    %s\n", insn);
+    }
+}
+
+char* optimize_y86 (const char* text)
+{
+    /* split into lines */
+    Program prog = { NULL, 0, false, -1 };
+    int capacity = 0;
+    for (const char* p = text; *p != '\0'; ) {
+        const char* end = strchr(p, '\n');
+        size_t length = (end != NULL ? (size_t)(end - p) : strlen(p));
+        if (prog.size == capacity) {
+            capacity = (capacity == 0 ? 256 : capacity * 2);
+            prog.lines = (Line*)realloc(prog.lines, sizeof(Line) * capacity);
+            CHECK_MALLOC_PTR(prog.lines);
+        }
+        parse_line(&prog.lines[prog.size++], p, length);
+        p += length + (end != NULL ? 1 : 0);
+    }
+    resolve_labels(&prog);
+    find_one_register(&prog);
+
+    /* apply rewrites until nothing changes (liveness is recomputed between
+     * passes; within a pass, rewrites only shrink other live ranges or touch
+     * registers that the pass checks directly) */
+    int (*passes[])(Program*) = {
+        simplify_jumps, fold_branches, simplify_moves,
+        propagate_copies, forward_results, eliminate_dead_code
+    };
+    for (int round = 0; round < MAX_ROUNDS; round++) {
+        int changes = 0;
+        for (size_t p = 0; p < sizeof(passes) / sizeof(passes[0]); p++) {
+            compute_liveness(&prog);
+            changes += passes[p](&prog);
+        }
+        if (changes == 0) {
+            break;
+        }
+    }
+
+    /* print remaining lines */
+    char* result = NULL;
+    size_t result_length = 0;
+    FILE* output = open_memstream(&result, &result_length);
+    CHECK_MALLOC_PTR(output);
+    for (int i = 0; i < prog.size; i++) {
+        if (!prog.lines[i].deleted) {
+            print_line(&prog.lines[i], output);
+        }
+        free(prog.lines[i].text);
+    }
+    fclose(output);
+    free(prog.lines);
+    return result;
+}
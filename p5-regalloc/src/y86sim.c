@@ -0,0 +1,882 @@
+/**
+ * @file y86sim.c
+ * @brief Y86-64 assembler and emulator (for running the output of @ref emit_y86)
+ */
+#define _DEFAULT_SOURCE
+#include "y86sim.h"
+#include "y86.h"
+#include "output.h"
+
+#include <ctype.h>
+
+/*
+ * instruction codes (high nibble of an instruction's first byte)
+ */
+#define I_HALT      0x0
+#define I_NOP       0x1
+#define I_RRMOVQ    0x2
+#define I_IRMOVQ    0x3
+#define I_RMMOVQ    0x4
+#define I_MRMOVQ    0x5
+#define I_OPQ       0x6
+#define I_JXX       0x7
+#define I_CALL      0x8
+#define I_RET       0x9
+#define I_PUSHQ     0xA
+#define I_POPQ      0xB
+#define I_IOTRAP    0xC
+
+#define REG_RAX     0x0
+#define REG_RSP     0x4
+#define REG_RSI     0x6
+#define REG_RDI     0x7
+#define REG_NONE    0xF
+
+/*
+ * I/O trap numbers (function code of iotrap)
+ */
+#define TRAP_CHAROUT 0
+#define TRAP_CHARIN  1
+#define TRAP_DECOUT  2
+#define TRAP_DECIN   3
+#define TRAP_STROUT  4
+#define TRAP_FLUSH   5
+
+/*
+ * encoded bytes shown per line of a .yo listing (the longest instruction)
+ */
+#define LISTING_BYTES_PER_LINE 10
+
+const char* y86_reg_names[Y86_NUM_REGS] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14"
+};
+
+/*
+ * instruction size by instruction code
+ */
+const int y86_insn_size[16] = {
+    [I_HALT] = 1, [I_NOP] = 1, [I_RRMOVQ] = 2, [I_IRMOVQ] = 10, [I_RMMOVQ] = 10,
+    [I_MRMOVQ] = 10, [I_OPQ] = 2, [I_JXX] = 9, [I_CALL] = 9, [I_RET] = 1,
+    [I_PUSHQ] = 2, [I_POPQ] = 2, [I_IOTRAP] = 1
+};
+
+/**
+ * @brief Assembly operand syntax of a mnemonic
+ */
+typedef enum Y86Syntax
+{
+    SYN_NONE,       /* halt */
+    SYN_RR,         /* rrmovq %rA, %rB */
+    SYN_IR,         /* irmovq $V, %rB */
+    SYN_RM,         /* rmmovq %rA, D(%rB) */
+    SYN_MR,         /* mrmovq D(%rB), %rA */
+    SYN_DEST,       /* jmp Dest */
+    SYN_R,          /* pushq %rA */
+    SYN_TRAP        /* iotrap N */
+} Y86Syntax;
+
+typedef struct Y86Mnemonic
+{
+    const char* name;
+    int icode;
+    int ifun;
+    Y86Syntax syntax;
+} Y86Mnemonic;
+
+const Y86Mnemonic y86_mnemonics[] = {
+    { "halt",   I_HALT,   0, SYN_NONE }, { "nop",    I_NOP,    0, SYN_NONE },
+    { "rrmovq", I_RRMOVQ, 0, SYN_RR   }, { "cmovle", I_RRMOVQ, 1, SYN_RR   },
+    { "cmovl",  I_RRMOVQ, 2, SYN_RR   }, { "cmove",  I_RRMOVQ, 3, SYN_RR   },
+    { "cmovne", I_RRMOVQ, 4, SYN_RR   }, { "cmovge", I_RRMOVQ, 5, SYN_RR   },
+    { "cmovg",  I_RRMOVQ, 6, SYN_RR   }, { "irmovq", I_IRMOVQ, 0, SYN_IR   },
+    { "rmmovq", I_RMMOVQ, 0, SYN_RM   }, { "mrmovq", I_MRMOVQ, 0, SYN_MR   },
+    { "addq",   I_OPQ,    0, SYN_RR   }, { "subq",   I_OPQ,    1, SYN_RR   },
+    { "andq",   I_OPQ,    2, SYN_RR   }, { "xorq",   I_OPQ,    3, SYN_RR   },
+    { "jmp",    I_JXX,    0, SYN_DEST }, { "jle",    I_JXX,    1, SYN_DEST },
+    { "jl",     I_JXX,    2, SYN_DEST }, { "je",     I_JXX,    3, SYN_DEST },
+    { "jne",    I_JXX,    4, SYN_DEST }, { "jge",    I_JXX,    5, SYN_DEST },
+    { "jg",     I_JXX,    6, SYN_DEST }, { "call",   I_CALL,   0, SYN_DEST },
+    { "ret",    I_RET,    0, SYN_NONE }, { "pushq",  I_PUSHQ,  0, SYN_R    },
+    { "popq",   I_POPQ,   0, SYN_R    }, { "iotrap", I_IOTRAP, 0, SYN_TRAP },
+};
+
+#define NUM_MNEMONICS (int)(sizeof(y86_mnemonics) / sizeof(y86_mnemonics[0]))
+
+/*
+ * ASSEMBLER
+ */
+
+/**
+ * @brief Symbol defined by a label
+ */
+typedef struct Y86Label
+{
+    char name[MAX_ID_LEN];
+    int64_t address;
+} Y86Label;
+
+/**
+ * @brief Assembler state (the source is processed twice: once to find label
+ * addresses and once to encode instructions)
+ */
+typedef struct Y86Assembler
+{
+    bool encoding;          // false in the first pass
+    int line;               // current line number (for error messages)
+    char* error;            // error message destination
+    Y86Label* labels;
+    int num_labels;
+    int labels_capacity;
+    int64_t address;        // current location
+    Y86Image* image;
+    FILE* listing;          // destination for a .yo listing (NULL for none)
+    int64_t line_address;   // address of the first byte of the current line
+    int64_t line_bytes;     // number of bytes encoded by the current line
+} Y86Assembler;
+
+bool asm_error (Y86Assembler* as, const char* format, ...)
+{
+    int length = snprintf(as->error, MAX_ERROR_LEN, "Line %d: ", as->line);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(as->error + length, MAX_ERROR_LEN - length, format, args);
+    va_end(args);
+    return false;
+}
+
+Y86Label* asm_find_label (Y86Assembler* as, const char* name)
+{
+    for (int i = 0; i < as->num_labels; i++) {
+        if (strcmp(as->labels[i].name, name) == 0) {
+            return &as->labels[i];
+        }
+    }
+    return NULL;
+}
+
+bool asm_define_label (Y86Assembler* as, const char* name)
+{
+    if (as->encoding) {
+        return true;    /* already defined in the first pass */
+    }
+    if (asm_find_label(as, name) != NULL) {
+        return asm_error(as, "Duplicate label '%s'", name);
+    }
+    if (as->num_labels == as->labels_capacity) {
+        as->labels_capacity = (as->labels_capacity == 0 ? 64 : as->labels_capacity * 2);
+        as->labels = (Y86Label*)realloc(as->labels, as->labels_capacity * sizeof(Y86Label));
+        CHECK_MALLOC_PTR(as->labels);
+    }
+    snprintf(as->labels[as->num_labels].name, MAX_ID_LEN, "%s", name);
+    as->labels[as->num_labels].address = as->address;
+    as->num_labels++;
+    return true;
+}
+
+bool asm_put_bytes (Y86Assembler* as, const byte_t* bytes, int count)
+{
+    if (as->address < 0 || as->address + count > MAX_MEM_SIZE) {
+        return asm_error(as, "Address 0x%" PRIx64 " is out of range", as->address);
+    }
+    if (as->encoding) {
+        Y86Image* image = as->image;
+        if (as->address + count > image->size) {
+            image->bytes = (byte_t*)realloc(image->bytes, as->address + count);
+            CHECK_MALLOC_PTR(image->bytes);
+            memset(image->bytes + image->size, 0, as->address + count - image->size);
+            image->size = as->address + count;
+        }
+        memcpy(image->bytes + as->address, bytes, count);
+        if (as->line_bytes == 0) {
+            as->line_address = as->address;
+        }
+        as->line_bytes += count;
+    }
+    as->address += count;
+    return true;
+}
+
+bool asm_put_word (Y86Assembler* as, int64_t value, int nbytes)
+{
+    byte_t bytes[8];
+    for (int i = 0; i < nbytes; i++) {
+        bytes[i] = (byte_t)((uint64_t)value >> (8 * i));
+    }
+    return asm_put_bytes(as, bytes, nbytes);
+}
+
+void skip_space (const char** p)
+{
+    while (**p == ' ' || **p == '\t' || **p == '\r') {
+        (*p)++;
+    }
+}
+
+bool is_ident_char (char c, bool first)
+{
+    return isalpha((unsigned char)c) || c == '_' || c == '.' || (!first && isdigit((unsigned char)c));
+}
+
+/*
+ * read an identifier (returns false if there isn't one)
+ */
+bool asm_ident (const char** p, char* name)
+{
+    skip_space(p);
+    if (!is_ident_char(**p, true)) {
+        return false;
+    }
+    int length = 0;
+    while (is_ident_char(**p, false)) {
+        if (length < MAX_ID_LEN - 1) {
+            name[length++] = **p;
+        }
+        (*p)++;
+    }
+    name[length] = '\0';
+    return true;
+}
+
+bool asm_expect (Y86Assembler* as, const char** p, char c)
+{
+    skip_space(p);
+    if (**p != c) {
+        return asm_error(as, "Expected '%c'", c);
+    }
+    (*p)++;
+    return true;
+}
+
+/*
+ * read a constant or label address, optionally prefixed with '$'
+ */
+bool asm_value (Y86Assembler* as, const char** p, int64_t* value)
+{
+    skip_space(p);
+    if (**p == '$') {
+        (*p)++;
+    }
+    char name[MAX_ID_LEN];
+    if (isdigit((unsigned char)**p) || **p == '-' || **p == '+') {
+        char* end;
+        *value = (int64_t)strtoull(*p, &end, 0);
+        if (**p == '-') {
+            *value = (int64_t)strtoll(*p, &end, 0);
+        }
+        if (end == *p) {
+            return asm_error(as, "Invalid number");
+        }
+        *p = end;
+    } else if (asm_ident(p, name)) {
+        Y86Label* label = asm_find_label(as, name);
+        if (label == NULL && as->encoding) {
+            return asm_error(as, "Undefined label '%s'", name);
+        }
+        *value = (label != NULL ? label->address : 0);
+    } else {
+        return asm_error(as, "Expected a constant or label");
+    }
+    return true;
+}
+
+bool asm_reg (Y86Assembler* as, const char** p, int* reg)
+{
+    char name[MAX_ID_LEN];
+    skip_space(p);
+    if (**p != '%') {
+        return asm_error(as, "Expected a register");
+    }
+    (*p)++;
+    if (asm_ident(p, name)) {
+        for (int r = 0; r < Y86_NUM_REGS; r++) {
+            if (strcmp(name, y86_reg_names[r]) == 0) {
+                *reg = r;
+                return true;
+            }
+        }
+    }
+    return asm_error(as, "Invalid register");
+}
+
+/*
+ * read a memory operand: D(%reg), $D(%reg), or (%reg)
+ */
+bool asm_mem (Y86Assembler* as, const char** p, int64_t* disp, int* reg)
+{
+    skip_space(p);
+    *disp = 0;
+    if (**p != '(' && !asm_value(as, p, disp)) {
+        return false;
+    }
+    return asm_expect(as, p, '(') && asm_reg(as, p, reg) && asm_expect(as, p, ')');
+}
+
+bool asm_string (Y86Assembler* as, const char** p)
+{
+    if (!asm_expect(as, p, '"')) {
+        return false;
+    }
+    while (**p != '"') {
+        byte_t c = (byte_t)**p;
+        if (c == '\0') {
+            return asm_error(as, "Unterminated string");
+        }
+        if (c == '\\') {
+            (*p)++;
+            switch (**p) {
+                case 'n':  c = '\n'; break;
+                case 't':  c = '\t'; break;
+                case '"':  c = '"';  break;
+                case '\\': c = '\\'; break;
+                default:
+                    return asm_error(as, "Invalid escape sequence");
+            }
+        }
+        if (!asm_put_bytes(as, &c, 1)) {
+            return false;
+        }
+        (*p)++;
+    }
+    (*p)++;
+    byte_t nul = 0;
+    return asm_put_bytes(as, &nul, 1);
+}
+
+bool asm_directive (Y86Assembler* as, const char* name, const char** p)
+{
+    int64_t value;
+    if (strcmp(name, ".pos") == 0) {
+        if (!asm_value(as, p, &value)) {
+            return false;
+        }
+        as->address = value;
+        char section[MAX_ID_LEN];
+        asm_ident(p, section);      /* optional section name (ignored) */
+        return true;
+    } else if (strcmp(name, ".align") == 0) {
+        if (!asm_value(as, p, &value)) {
+            return false;
+        }
+        if (value <= 0) {
+            return asm_error(as, "Invalid alignment");
+        }
+        as->address = (as->address + value - 1) / value * value;
+        return true;
+    } else if (strcmp(name, ".quad") == 0) {
+        return asm_value(as, p, &value) && asm_put_word(as, value, 8);
+    } else if (strcmp(name, ".byte") == 0) {
+        return asm_value(as, p, &value) && asm_put_word(as, value, 1);
+    } else if (strcmp(name, ".string") == 0) {
+        return asm_string(as, p);
+    }
+    return asm_error(as, "Unknown directive '%s'", name);
+}
+
+bool asm_instruction (Y86Assembler* as, const char* name, const char** p)
+{
+    const Y86Mnemonic* m = NULL;
+    for (int i = 0; i < NUM_MNEMONICS; i++) {
+        if (strcmp(name, y86_mnemonics[i].name) == 0) {
+            m = &y86_mnemonics[i];
+        }
+    }
+    if (m == NULL) {
+        return asm_error(as, "Unknown instruction '%s'", name);
+    }
+
+    int ra = REG_NONE, rb = REG_NONE, ifun = m->ifun;
+    int64_t value = 0;
+    bool ok = true;
+    switch (m->syntax) {
+        case SYN_NONE:
+            break;
+        case SYN_RR:
+            ok = asm_reg(as, p, &ra) && asm_expect(as, p, ',') && asm_reg(as, p, &rb);
+            break;
+        case SYN_IR:
+            ok = asm_value(as, p, &value) && asm_expect(as, p, ',') && asm_reg(as, p, &rb);
+            break;
+        case SYN_RM:
+            ok = asm_reg(as, p, &ra) && asm_expect(as, p, ',') && asm_mem(as, p, &value, &rb);
+            break;
+        case SYN_MR:
+            ok = asm_mem(as, p, &value, &rb) && asm_expect(as, p, ',') && asm_reg(as, p, &ra);
+            break;
+        case SYN_DEST:
+            ok = asm_value(as, p, &value);
+            break;
+        case SYN_R:
+            ok = asm_reg(as, p, &ra);
+            break;
+        case SYN_TRAP:
+            ok = asm_value(as, p, &value);
+            if (ok && (value < 0 || value > 0xF)) {
+                ok = asm_error(as, "Invalid trap number");
+            }
+            ifun = (int)value;
+            break;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    /* encode: opcode byte, register byte (if any), constant word (if any) */
+    byte_t bytes[10];
+    int size = y86_insn_size[m->icode];
+    bytes[0] = (byte_t)(m->icode << 4 | ifun);
+    int pos = 1;
+    if (m->syntax == SYN_RR || m->syntax == SYN_IR || m->syntax == SYN_RM ||
+            m->syntax == SYN_MR || m->syntax == SYN_R) {
+        bytes[pos++] = (byte_t)(ra << 4 | rb);
+    }
+    for (; pos < size; pos++) {
+        bytes[pos] = (byte_t)((uint64_t)value >> (8 * (pos - (size - 8))));
+    }
+    if (as->encoding) {
+        as->image->code_size += size;
+    }
+    return asm_put_bytes(as, bytes, size);
+}
+
+bool asm_line (Y86Assembler* as, const char* line)
+{
+    /* strip comments (outside of string literals) */
+    char buffer[MAX_LINE_LEN];
+    snprintf(buffer, MAX_LINE_LEN, "%s", line);
+    bool quoted = false;
+    for (char* c = buffer; *c != '\0'; c++) {
+        if (*c == '"' && (c == buffer || c[-1] != '\\')) {
+            quoted = !quoted;
+        } else if (*c == '#' && !quoted) {
+            *c = '\0';
+            break;
+        }
+    }
+
+    const char* p = buffer;
+    char name[MAX_ID_LEN];
+    while (asm_ident(&p, name)) {
+        skip_space(&p);
+        if (*p == ':') {
+            p++;
+            if (!asm_define_label(as, name)) {
+                return false;
+            }
+            continue;
+        }
+        bool ok = (name[0] == '.' ? asm_directive(as, name, &p) : asm_instruction(as, name, &p));
+        if (!ok) {
+            return false;
+        }
+        break;
+    }
+    skip_space(&p);
+    if (*p != '\0') {
+        return asm_error(as, "Unexpected text '%s'", p);
+    }
+    return true;
+}
+
+/*
+ * write the current line to the listing in the format of the CS:APP assembler
+ * (yas): address, up to ten encoded bytes, and the source line; longer
+ * encodings (strings) continue on following lines
+ */
+void asm_list_line (Y86Assembler* as, const char* line)
+{
+    const char* p = line;
+    skip_space(&p);
+    bool empty = (*p == '\0' || *p == '#');
+    int64_t address = (as->line_bytes > 0 ? as->line_address : as->address);
+    int64_t offset = 0;
+    do {
+        char hex[2 * LISTING_BYTES_PER_LINE + 1] = "";
+        int64_t count = as->line_bytes - offset;
+        if (count > LISTING_BYTES_PER_LINE) {
+            count = LISTING_BYTES_PER_LINE;
+        }
+        for (int64_t i = 0; i < count; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", as->image->bytes[address + offset + i]);
+        }
+        if (empty) {
+            fprintf(as->listing, "%28s| %s\n", "", line);
+        } else {
+            fprintf(as->listing, "0x%03" PRIx64 ": %-*s | %s\n", address + offset,
+                    2 * LISTING_BYTES_PER_LINE, hex, (offset == 0 ? line : ""));
+        }
+        offset += count;
+    } while (offset < as->line_bytes);
+}
+
+bool asm_pass (Y86Assembler* as, const char* text)
+{
+    as->address = 0;
+    as->line = 0;
+    const char* start = text;
+    while (*start != '\0') {
+        const char* end = strchr(start, '\n');
+        size_t length = (end != NULL ? (size_t)(end - start) : strlen(start));
+        char line[MAX_LINE_LEN];
+        if (length >= MAX_LINE_LEN) {
+            as->line++;
+            return asm_error(as, "Line is too long");
+        }
+        memcpy(line, start, length);
+        line[length] = '\0';
+        as->line++;
+        as->line_bytes = 0;
+        if (!asm_line(as, line)) {
+            return false;
+        }
+        if (as->encoding && as->listing != NULL) {
+            asm_list_line(as, line);
+        }
+        start += length + (end != NULL ? 1 : 0);
+    }
+    return true;
+}
+
+Y86Image* Y86Image_assemble (const char* text, char* error)
+{
+    return Y86Image_assemble_with_listing(text, NULL, error);
+}
+
+Y86Image* Y86Image_assemble_with_listing (const char* text, FILE* listing, char* error)
+{
+    Y86Image* image = (Y86Image*)calloc(1, sizeof(Y86Image));
+    CHECK_MALLOC_PTR(image);
+    Y86Assembler as = { .error = error, .image = image, .listing = listing };
+
+    bool ok = asm_pass(&as, text);
+    if (ok) {
+        as.encoding = true;
+        ok = asm_pass(&as, text);
+    }
+    free(as.labels);
+    if (!ok) {
+        Y86Image_free(image);
+        return NULL;
+    }
+    return image;
+}
+
+bool Y86Image_write (Y86Image* image, FILE* output)
+{
+    return fwrite(image->bytes, 1, (size_t)image->size, output) == (size_t)image->size;
+}
+
+void Y86Image_free (Y86Image* image)
+{
+    free(image->bytes);
+    free(image);
+}
+
+/*
+ * EMULATOR
+ */
+
+bool y86_cond (int ifun, bool zf, bool sf, bool of)
+{
+    switch (ifun) {
+        case 0:  return true;                   /* always */
+        case 1:  return (sf != of) || zf;       /* le */
+        case 2:  return sf != of;               /* l */
+        case 3:  return zf;                     /* e */
+        case 4:  return !zf;                    /* ne */
+        case 5:  return sf == of;               /* ge */
+        case 6:  return sf == of && !zf;        /* g */
+        default: return false;
+    }
+}
+
+bool Y86_run (Y86Image* image, Y86Options* options, Y86Result* result)
+{
+    int64_t mem_size = (options->mem_size > 0 ? options->mem_size : Y86_MEM_SIZE);
+    ProgramOutput* output = (options->output != NULL ? options->output : ProgramOutput_new_file(stdout));
+    memset(result, 0, sizeof(Y86Result));
+
+    /* register REG_NONE always reads as zero (writes to it are rejected) */
+    int64_t reg[REG_NONE + 1] = { 0 };
+    bool zf = true, sf = false, of = false;
+    int64_t pc = 0;
+    long count = 0;
+    long bubbles = 0;
+    int loaded = REG_NONE;      /* register loaded from memory by the previous instruction */
+    Y86Status status = Y86_AOK;
+    int64_t bad_address = 0;
+
+    byte_t* mem = NULL;
+    if (image->size > mem_size) {
+        status = Y86_ADR;
+        bad_address = image->size - 1;
+    } else {
+        mem = (byte_t*)calloc(mem_size, 1);
+        CHECK_MALLOC_PTR(mem);
+        memcpy(mem, image->bytes, image->size);
+    }
+
+#define VALID_ADDR(A,N) ((A) >= 0 && (A) <= mem_size - (N))
+#define FAULT(S,A)      { status = (S); bad_address = (A); break; }
+
+    while (status == Y86_AOK) {
+        if (count >= Y86_TIMEOUT_NUM_INSTRUCTIONS) {
+            status = Y86_TIMEOUT;
+            break;
+        }
+
+        /* fetch */
+        if (!VALID_ADDR(pc, 1)) FAULT(Y86_ADR, pc);
+        int icode = mem[pc] >> 4;
+        int ifun = mem[pc] & 0xF;
+        int size = y86_insn_size[icode];
+        if (size == 0) FAULT(Y86_INS, pc);
+        if (!VALID_ADDR(pc, size)) FAULT(Y86_ADR, pc);
+        int ra = REG_NONE, rb = REG_NONE;
+        int64_t val = 0;
+        if (size == 2 || size == 10) {
+            ra = mem[pc+1] >> 4;
+            rb = mem[pc+1] & 0xF;
+        }
+        if (size >= 9) {
+            memcpy(&val, &mem[pc + size - 8], sizeof(int64_t));
+        }
+        int64_t next = pc + size;
+        count++;
+
+        /* load/use hazard: the loaded value isn't available until after memory */
+        if (loaded != REG_NONE) {
+            bool uses = false;
+            switch (icode) {
+                case I_RRMOVQ: uses = (ra == loaded); break;
+                case I_RMMOVQ: case I_OPQ: uses = (ra == loaded || rb == loaded); break;
+                case I_MRMOVQ: uses = (rb == loaded); break;
+                case I_PUSHQ:  uses = (ra == loaded || loaded == REG_RSP); break;
+                case I_POPQ: case I_CALL: case I_RET: uses = (loaded == REG_RSP); break;
+                case I_IOTRAP: uses = (loaded == REG_RSI || loaded == REG_RDI); break;
+                default: break;
+            }
+            bubbles += (uses ? 1 : 0);
+        }
+        loaded = REG_NONE;
+
+        /* execute */
+        switch (icode) {
+            case I_HALT:
+                status = Y86_HLT;
+                next = pc;
+                break;
+            case I_NOP:
+                break;
+            case I_RRMOVQ:
+                if (ra == REG_NONE || rb == REG_NONE || ifun > 6) FAULT(Y86_INS, pc);
+                if (y86_cond(ifun, zf, sf, of)) {
+                    reg[rb] = reg[ra];
+                }
+                break;
+            case I_IRMOVQ:
+                if (rb == REG_NONE) FAULT(Y86_INS, pc);
+                reg[rb] = val;
+                break;
+            case I_RMMOVQ: {
+                int64_t address = (int64_t)((uint64_t)reg[rb] + (uint64_t)val);
+                if (ra == REG_NONE) FAULT(Y86_INS, pc);
+                if (!VALID_ADDR(address, 8)) FAULT(Y86_ADR, address);
+                memcpy(&mem[address], &reg[ra], sizeof(int64_t));
+                break;
+            }
+            case I_MRMOVQ: {
+                int64_t address = (int64_t)((uint64_t)reg[rb] + (uint64_t)val);
+                if (ra == REG_NONE) FAULT(Y86_INS, pc);
+                if (!VALID_ADDR(address, 8)) FAULT(Y86_ADR, address);
+                memcpy(&reg[ra], &mem[address], sizeof(int64_t));
+                loaded = ra;
+                break;
+            }
+            case I_OPQ: {
+                if (ra == REG_NONE || rb == REG_NONE || ifun > 3) FAULT(Y86_INS, pc);
+                int64_t a = reg[ra], b = reg[rb], r = 0;
+                of = false;
+                switch (ifun) {
+                    case 0:
+                        r = (int64_t)((uint64_t)b + (uint64_t)a);
+                        of = ((a < 0) == (b < 0)) && ((r < 0) != (b < 0));
+                        break;
+                    case 1:
+                        r = (int64_t)((uint64_t)b - (uint64_t)a);
+                        of = ((a < 0) != (b < 0)) && ((r < 0) != (b < 0));
+                        break;
+                    case 2: r = b & a; break;
+                    case 3: r = b ^ a; break;
+                }
+                reg[rb] = r;
+                zf = (r == 0);
+                sf = (r < 0);
+                break;
+            }
+            case I_JXX:
+                if (ifun > 6) FAULT(Y86_INS, pc);
+                if (y86_cond(ifun, zf, sf, of)) {
+                    next = val;
+                } else if (ifun != 0) {
+                    bubbles += 2;   /* mispredicted (PIPE predicts taken) */
+                }
+                break;
+            case I_CALL: {
+                int64_t sp = reg[REG_RSP] - 8;
+                if (!VALID_ADDR(sp, 8)) FAULT(Y86_ADR, sp);
+                memcpy(&mem[sp], &next, sizeof(int64_t));
+                reg[REG_RSP] = sp;
+                next = val;
+                break;
+            }
+            case I_RET: {
+                int64_t sp = reg[REG_RSP];
+                if (!VALID_ADDR(sp, 8)) FAULT(Y86_ADR, sp);
+                memcpy(&next, &mem[sp], sizeof(int64_t));
+                reg[REG_RSP] = sp + 8;
+                bubbles += 3;
+                break;
+            }
+            case I_PUSHQ: {
+                if (ra == REG_NONE) FAULT(Y86_INS, pc);
+                int64_t sp = reg[REG_RSP] - 8;
+                if (!VALID_ADDR(sp, 8)) FAULT(Y86_ADR, sp);
+                memcpy(&mem[sp], &reg[ra], sizeof(int64_t));
+                reg[REG_RSP] = sp;
+                break;
+            }
+            case I_POPQ: {
+                if (ra == REG_NONE) FAULT(Y86_INS, pc);
+                int64_t sp = reg[REG_RSP];
+                if (!VALID_ADDR(sp, 8)) FAULT(Y86_ADR, sp);
+                reg[REG_RSP] = sp + 8;
+                memcpy(&reg[ra], &mem[sp], sizeof(int64_t));
+                loaded = ra;
+                break;
+            }
+            case I_IOTRAP: {
+                int64_t src = reg[REG_RSI], dst = reg[REG_RDI];
+                switch (ifun) {
+                    case TRAP_CHAROUT: {
+                        if (!VALID_ADDR(src, 1)) FAULT(Y86_ADR, src);
+                        char str[2] = { (char)mem[src], '\0' };
+                        ProgramOutput_write_str(output, str);
+                        break;
+                    }
+                    case TRAP_CHARIN: {
+                        if (!VALID_ADDR(dst, 1)) FAULT(Y86_ADR, dst);
+                        int c = (options->input != NULL ? fgetc(options->input) : EOF);
+                        if (c == EOF) FAULT(Y86_INS, pc);
+                        mem[dst] = (byte_t)c;
+                        break;
+                    }
+                    case TRAP_DECOUT: {
+                        if (!VALID_ADDR(src, 8)) FAULT(Y86_ADR, src);
+                        int64_t value;
+                        memcpy(&value, &mem[src], sizeof(int64_t));
+                        ProgramOutput_write_int(output, value);
+                        break;
+                    }
+                    case TRAP_DECIN: {
+                        if (!VALID_ADDR(dst, 8)) FAULT(Y86_ADR, dst);
+                        int64_t value;
+                        if (options->input == NULL ||
+                                fscanf(options->input, "%" SCNd64, &value) != 1) FAULT(Y86_INS, pc);
+                        memcpy(&mem[dst], &value, sizeof(int64_t));
+                        break;
+                    }
+                    case TRAP_STROUT:
+                        if (!VALID_ADDR(src, 1)) FAULT(Y86_ADR, src);
+                        if (memchr(&mem[src], '\0', mem_size - src) == NULL) FAULT(Y86_ADR, mem_size);
+                        ProgramOutput_write_str(output, (const char*)&mem[src]);
+                        break;
+                    case TRAP_FLUSH:
+                        ProgramOutput_flush(output);
+                        break;
+                    default:
+                        FAULT(Y86_INS, pc);
+                }
+                break;
+            }
+            default:
+                FAULT(Y86_INS, pc);
+        }
+        if (status == Y86_AOK || status == Y86_HLT) {
+            pc = next;
+        }
+    }
+
+#undef VALID_ADDR
+#undef FAULT
+
+    /* report the outcome */
+    result->status = status;
+    result->return_value = reg[REG_RAX];
+    result->instructions = count;
+    result->cycles = (count > 0 ? count + 4 + bubbles : 0);
+    result->pc = pc;
+    switch (status) {
+        case Y86_ADR:
+            if (mem == NULL) {
+                snprintf(result->message, MAX_ERROR_LEN,
+                        "ERROR: Program (%" PRId64 " bytes) does not fit in memory", image->size);
+            } else {
+                snprintf(result->message, MAX_ERROR_LEN,
+                        "ERROR: Invalid address 0x%" PRIx64 " (pc 0x%" PRIx64 ")", bad_address, pc);
+            }
+            break;
+        case Y86_INS:
+            snprintf(result->message, MAX_ERROR_LEN,
+                    "ERROR: Invalid instruction or failed I/O (pc 0x%" PRIx64 ")", pc);
+            break;
+        case Y86_TIMEOUT:
+            snprintf(result->message, MAX_ERROR_LEN,
+                    "TIMEOUT: Program executed too many instructions (probably an infinite loop)");
+            break;
+        default:
+            break;
+    }
+
+    /* clean up (caller-supplied outputs are flushed but not deallocated) */
+    if (options->output != NULL) {
+        ProgramOutput_flush(output);
+    } else {
+        ProgramOutput_free(output);
+    }
+    free(mem);
+    return status == Y86_HLT;
+}
+
+Y86Image* assemble_y86 (InsnList* program, long static_size, long stack_top, FILE* listing)
+{
+    /* generate assembly into memory */
+    char* text = NULL;
+    size_t length = 0;
+    FILE* stream = open_memstream(&text, &length);
+    if (stream == NULL) {
+        printf("ERROR: Could not allocate buffer for Y86 code\n");
+        exit(EXIT_FAILURE);
+    }
+    Y86EmitOptions layout = { .static_size = static_size, .stack_top = stack_top };
+    emit_y86_with_options(program, &layout, stream);
+    fclose(stream);
+
+    char error[MAX_ERROR_LEN];
+    Y86Image* image = Y86Image_assemble_with_listing(text, listing, error);
+    if (image == NULL) {
+        printf("ERROR: Generated Y86 code does not assemble (%s)\n", error);
+        exit(EXIT_FAILURE);
+    }
+    free(text);
+    return image;
+}
+
+bool run_y86 (InsnList* program, Y86Options* options, Y86Result* result)
+{
+    Y86Image* image = assemble_y86(program, options->static_size,
+            (options->mem_size > 0 ? options->mem_size : Y86_MEM_SIZE), NULL);
+    bool halted = Y86_run(image, options, result);
+    Y86Image_free(image);
+    return halted;
+}
@@ -48,6 +48,1310 @@ TEST_PROGRAM(B_spilled_regs, 72,
         "  return (((1+2)+(3+4))+((5+6)+(7+8)))+"
         "         (((1+2)+(3+4))+((5+6)+(7+8))); }")
 
+START_TEST (A_remat_constant)
+{
+    /* the constants must be recomputed rather than spilled and reloaded */
+    InsnList* iloc = generate_program(
+        "int g; "
+        "def int main() { "
+        "  g = 7; "
+        "  return 1000 - (((1+2)+(3+4))+((5+6)+(7+8))) * "
+        "      (g + (((1+2)*(3+4))-((5+6)*(7+g)))); }");
+    RegAllocStatsList* stats = RegAllocStatsList_new();
+    allocate_registers_with_stats(iloc, 3, stats);
+    ck_assert_int_gt(stats->head->num_remats, 0);
+    ck_assert_int_eq(run_simulator(iloc, false), 5536);
+    RegAllocStatsList_free(stats);
+    InsnList_free(iloc);
+}
+END_TEST
+
+/**
+ * @brief Print an ILOC program to a string (allocated; caller must free)
+ */
+static char* iloc_text (InsnList* iloc)
+{
+    FILE* stream = tmpfile();
+    InsnList_print(iloc, stream);
+    long length = ftell(stream);
+    rewind(stream);
+    char* text = (char*)calloc(length + 1, 1);
+    ck_assert_int_eq(fread(text, 1, length, stream), length);
+    fclose(stream);
+    return text;
+}
+
+START_TEST (A_parallel_allocation)
+{
+    /* enough functions and instructions for the allocator to use its worker
+     * threads (MIN_PARALLEL_INSNS in p5-regalloc.c) */
+    static char text[MAX_FILE_SIZE];
+    int length = 0;
+    for (int f = 0; f < 12; f++) {
+        length += snprintf(text + length, MAX_FILE_SIZE - length,
+                "def int f%d(int x) { int y; y = x * %d; "
+                "  return ((x+1)*(y+2)-((x+3)*(y-%d)+(x*y-1)))+((y+5)*(x-6)-((x+7)*(y+%d))); } ",
+                f, f + 2, f, f + 1);
+    }
+    length += snprintf(text + length, MAX_FILE_SIZE - length, "def int main() { return ");
+    for (int f = 0; f < 12; f++) {
+        length += snprintf(text + length, MAX_FILE_SIZE - length, "f%d(%d) + ", f, f);
+    }
+    snprintf(text + length, MAX_FILE_SIZE - length, "0; }");
+
+    InsnList* parallel = generate_program(text);
+    ck_assert_int_gt(InsnList_size(parallel), 512);
+
+    /* single-threaded reference: allocate each function on its own */
+    RegAllocStatsList* expected_stats = RegAllocStatsList_new();
+    char expected[MAX_FILE_SIZE * 4] = "";
+    InsnList* function = NULL;
+    for (ILOCInsn* i = parallel->head; i != NULL; i = i->next) {
+        if (i->form == LABEL && i->op[0].type == CALL_LABEL) {
+            function = InsnList_new();
+        }
+        InsnList_add(function, ILOCInsn_copy(i));
+        if (i->next == NULL || (i->next->form == LABEL && i->next->op[0].type == CALL_LABEL)) {
+            allocate_registers_with_stats(function, 3, expected_stats);
+            char* function_text = iloc_text(function);
+            strncat(expected, function_text, sizeof(expected) - strlen(expected) - 1);
+            free(function_text);
+            InsnList_free(function);
+        }
+    }
+
+    RegAllocStatsList* stats = RegAllocStatsList_new();
+    allocate_registers_with_stats(parallel, 3, stats);
+    char* actual = iloc_text(parallel);
+    ck_assert_str_eq(actual, expected);
+    free(actual);
+
+    ck_assert_int_eq(RegAllocStatsList_size(stats), 13);
+    ck_assert_int_eq(RegAllocStatsList_size(expected_stats), 13);
+    for (RegAllocStats* a = stats->head, *e = expected_stats->head; a != NULL; a = a->next, e = e->next) {
+        ck_assert_str_eq(a->function, e->function);
+        ck_assert_int_eq(a->num_spills, e->num_spills);
+        ck_assert_int_eq(a->num_reloads, e->num_reloads);
+        ck_assert_int_eq(a->num_remats, e->num_remats);
+        ck_assert_int_eq(a->num_call_spills, e->num_call_spills);
+        ck_assert_int_eq(a->frame_growth, e->frame_growth);
+    }
+    ck_assert_int_gt(stats->head->num_spills, 0);
+    RegAllocStatsList_free(stats);
+    RegAllocStatsList_free(expected_stats);
+    InsnList_free(parallel);
+}
+END_TEST
+
+TEST_PROGRAM_WITH_REGS(A_spill_in_loop, 3, -55,
+        "def int main() { "
+        "  int i; int s; i = 0; s = 0; "
+        "  while (i < 5) { "
+        "    s = s + ((i+1)+(i+2))*((i+3)-(i*2+(1+1))); "
+        "    i = i + 1; } "
+        "  return s; }")
+
+START_TEST (A_renumber_per_function)
+{
+    InsnList* iloc = generate_program(
+        "def int f(int x) { return x * 2 + 1; } "
+        "def int main() { return f(3) + (4 + 5); }");
+    int max_before = InsnList_max_id(iloc, VIRTUAL_REG);
+    renumber_virtual_registers(iloc);
+
+    /* each function uses IDs 0..N-1, in order of first appearance */
+    int next = 0;
+    FOR_EACH (ILOCInsn*, insn, iloc) {
+        if (insn->form == LABEL && insn->op[0].type == CALL_LABEL) {
+            next = 0;
+        }
+        for (int op = 0; op < 3; op++) {
+            if (insn->op[op].type == VIRTUAL_REG) {
+                ck_assert(insn->op[op].id <= next);
+                if (insn->op[op].id == next) {
+                    next++;
+                }
+            }
+        }
+    }
+    ck_assert(InsnList_max_id(iloc, VIRTUAL_REG) < max_before);
+    ck_assert_int_eq(run_simulator(iloc, false), 16);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_regalloc_stats_csv)
+{
+    /* (1+2) is live across the call, so main needs a call spill */
+    InsnList* iloc = generate_program(
+        "def int f(int x) { return x * 2; } "
+        "def int main() { return (1 + 2) * (3 + f(4)); }");
+    RegAllocStatsList* stats = RegAllocStatsList_new();
+    allocate_registers_with_stats(iloc, 3, stats);
+    ck_assert_int_eq(run_simulator(iloc, false), 33);
+    ck_assert_int_eq(RegAllocStatsList_size(stats), 2);
+
+    FILE* csv = tmpfile();
+    RegAllocStatsList_print(stats, csv);
+    rewind(csv);
+    char line[MAX_LINE_LEN];
+    ck_assert(fgets(line, MAX_LINE_LEN, csv) != NULL);
+    ck_assert_str_eq(line, "function,spills,reloads,remats,call_spills,frame_growth,max_pressure\n");
+    FOR_EACH (RegAllocStats*, st, stats) {
+        char function[MAX_LINE_LEN];
+        int spills, reloads, remats, call_spills, frame_growth, pressure;
+        ck_assert(fgets(line, MAX_LINE_LEN, csv) != NULL);
+        ck_assert_int_eq(sscanf(line, "%[^,],%d,%d,%d,%d,%d,%d", function, &spills,
+                    &reloads, &remats, &call_spills, &frame_growth, &pressure), 7);
+        ck_assert_str_eq(function, st->function);
+        ck_assert_int_eq(spills, st->num_spills);
+        ck_assert_int_eq(reloads, st->num_reloads);
+        ck_assert_int_eq(remats, st->num_remats);
+        ck_assert_int_eq(call_spills, st->num_call_spills);
+        ck_assert_int_eq(frame_growth, st->frame_growth);
+        ck_assert_int_eq(pressure, st->max_pressure);
+    }
+    ck_assert(fgets(line, MAX_LINE_LEN, csv) == NULL);
+    fclose(csv);
+
+    ck_assert_str_eq(stats->head->function, "f");
+    ck_assert_int_eq(stats->head->num_spills, 0);
+    ck_assert_str_eq(stats->tail->function, "main");
+    ck_assert_int_gt(stats->tail->num_call_spills, 0);
+    ck_assert_int_eq(stats->tail->frame_growth, 8);
+    RegAllocStatsList_free(stats);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_decoded_instruction_semantics)
+{
+    InsnForm forms[] = { ADD, SUB, MULT, DIV, AND, OR,
+        CMP_LT, CMP_LE, CMP_EQ, CMP_NE, CMP_GE, CMP_GT };
+    word_t expected[] = { 10, 4, 21, 2, 3, 7, 0, 0, 0, 1, 1, 1 };
+    int num_forms = sizeof(forms) / sizeof(forms[0]);
+
+    /* every binary form on a = 7 and b = 3, then the other forms */
+    InsnList* iloc = InsnList_new();
+    Operand a = virtual_register(), b = virtual_register();
+    Operand dst[12];
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(7), a));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(3), b));
+    for (int i = 0; i < num_forms; i++) {
+        dst[i] = virtual_register();
+        InsnList_add(iloc, ILOCInsn_new_3op(forms[i], a, b, dst[i]));
+    }
+    Operand add_i = virtual_register(), mult_i = virtual_register();
+    Operand inverted = virtual_register(), neg = virtual_register(), copy = virtual_register();
+    InsnList_add(iloc, ILOCInsn_new_3op(ADD_I, a, int_const(-10), add_i));
+    InsnList_add(iloc, ILOCInsn_new_3op(MULT_I, a, int_const(6), mult_i));
+    InsnList_add(iloc, ILOCInsn_new_2op(NOT, dst[0], inverted));
+    InsnList_add(iloc, ILOCInsn_new_2op(NEG, a, neg));
+    InsnList_add(iloc, ILOCInsn_new_2op(I2I, b, copy));
+
+    /* memory (in the global area) and the stack */
+    Operand base = virtual_register(), offset = virtual_register();
+    Operand via_ai = virtual_register(), via_ao = virtual_register();
+    Operand via_reg = virtual_register(), popped = virtual_register();
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(STATIC_VAR_OFFSET), base));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(16), offset));
+    InsnList_add(iloc, ILOCInsn_new_3op(STORE_AI, a, base, int_const(8)));
+    InsnList_add(iloc, ILOCInsn_new_3op(STORE_AO, b, base, offset));
+    InsnList_add(iloc, ILOCInsn_new_2op(STORE, dst[2], base));
+    InsnList_add(iloc, ILOCInsn_new_3op(LOAD_AI, base, int_const(8), via_ai));
+    InsnList_add(iloc, ILOCInsn_new_3op(LOAD_AO, base, offset, via_ao));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD, base, via_reg));
+    InsnList_add(iloc, ILOCInsn_new_1op(PUSH, mult_i));
+    InsnList_add(iloc, ILOCInsn_new_1op(POP, popped));
+
+    /* control flow: a taken branch, a jump, and a call */
+    Operand taken = anonymous_label(), not_taken = anonymous_label(), done = anonymous_label();
+    Operand branch = virtual_register(), called = virtual_register();
+    InsnList_add(iloc, ILOCInsn_new_3op(CBR, dst[11], taken, not_taken));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, not_taken));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(0), branch));
+    InsnList_add(iloc, ILOCInsn_new_1op(JUMP, done));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, taken));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(1), branch));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, done));
+    InsnList_add(iloc, ILOCInsn_new_1op(CALL, call_label("f")));
+    InsnList_add(iloc, ILOCInsn_new_2op(I2I, return_register(), called));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("f")));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(42), return_register()));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+
+    /* same results with and without the uninitialized register checks */
+    for (int unchecked = 0; unchecked <= 1; unchecked++) {
+        ProgramOutput* output = ProgramOutput_new_memory();
+        SimulatorOptions options = { .output = output, .unchecked = unchecked };
+        ILOCMachine* machine = ILOCMachine_new(iloc, &options);
+        SimulatorResult result;
+        ck_assert(ILOCMachine_run(machine, &result));
+        for (int i = 0; i < num_forms; i++) {
+            ck_assert_int_eq(ILOCMachine_get_reg(machine, dst[i]), expected[i]);
+        }
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, add_i), -3);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, mult_i), 42);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, inverted), 1);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, neg), -7);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, copy), 3);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, via_ai), 7);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, via_ao), 3);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, via_reg), 21);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, popped), 42);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, branch), 1);
+        ck_assert_int_eq(ILOCMachine_get_reg(machine, called), 42);
+        ck_assert_str_eq(ProgramOutput_contents(output), "");
+        ILOCMachine_free(machine);
+        ProgramOutput_free(output);
+    }
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_verify_rejects_malformed)
+{
+    /* a well-formed program passes (and leaves no message) */
+    InsnList* iloc = InsnList_new();
+    char message[MAX_ERROR_LEN] = "unchanged";
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(1), return_register()));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    ck_assert(check_program(iloc, message));
+    ck_assert_str_eq(message, "");
+    InsnList_free(iloc);
+
+    /* wrong number of operands */
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(ADD, virtual_register(), virtual_register()));
+    assert_rejected(iloc, "expected 3 operands but found 2");
+
+    /* constant where a register is expected */
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(I2I, int_const(5), virtual_register()));
+    assert_rejected(iloc, "(expected register)");
+
+    /* physical register that does not exist */
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(1), physical_register(MAX_PHYSICAL_REGS)));
+    assert_rejected(iloc, "does not exist");
+
+    /* jump labels defined twice or not at all */
+    Operand label = anonymous_label();
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, label));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, label));
+    assert_rejected(iloc, "Duplicate jump label");
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_1op(JUMP, anonymous_label()));
+    assert_rejected(iloc, "Undefined jump label");
+
+    /* no main() */
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("start")));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    assert_rejected(iloc, "No call target found for 'main'");
+}
+END_TEST
+
+START_TEST (A_call_target_table)
+{
+    /* more names than buckets, so chains are searched too */
+    CallTargetTable* table = CallTargetTable_new();
+    char name[MAX_TOKEN_LEN];
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, MAX_TOKEN_LEN, "func%d", i);
+        CallTargetTable_add_new(table, name, i * 10);
+    }
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, MAX_TOKEN_LEN, "func%d", i);
+        ck_assert_int_eq(CallTargetTable_find(table, name), i * 10);
+    }
+    CallTargetTable_free(table);
+
+    /* duplicate and unknown functions */
+    InsnList* iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("f")));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("f")));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    assert_rejected(iloc, "Duplicate call target 'f'");
+    iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_1op(CALL, call_label("g")));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    assert_rejected(iloc, "No call target found for 'g'");
+
+    /* every call reaches its own function and returns to its own caller */
+    ck_assert_int_eq(run_program(
+        "def int a() { return 1; } "
+        "def int b() { return a() + 1; } "
+        "def int c() { return b() + a() + 1; } "
+        "def int main() { return a() * 100 + b() * 10 + c(); }"), 124);
+}
+END_TEST
+
+START_TEST (A_trace_round_trip)
+{
+    /* records with no, one, and two register writes and a memory write */
+    TraceRecord records[] = {
+        { .pc = 3 },
+        { .pc = 7, .num_reg_writes = 1, .reg_slot = { PR_SLOT(2) }, .reg_value = { -42 } },
+        { .pc = 70000, .num_reg_writes = 2, .reg_slot = { SP_SLOT, VR_SLOT(300) },
+          .reg_value = { MEM_SIZE - 8, INT32_MAX + 5L } },
+        { .pc = 12, .mem_write = true, .mem_address = 264, .mem_value = -1 }
+    };
+    int num_records = sizeof(records) / sizeof(records[0]);
+    InsnList* iloc = generate_program("def int main() { return 0; }");
+    FILE* file = tmpfile();
+    TraceWriter* writer = TraceWriter_new(file, iloc, MEM_SIZE);
+    for (int r = 0; r < num_records; r++) {
+        TraceWriter_write(writer, &records[r]);
+    }
+    TraceWriter_free(writer);
+    rewind(file);
+    uint32_t num_slots, mem_size;
+    ck_assert(Trace_read_header(file, &num_slots, &mem_size));
+    ck_assert_int_eq(mem_size, MEM_SIZE);
+    for (int r = 0; r < num_records; r++) {
+        TraceRecord record;
+        ck_assert(TraceRecord_read(file, &record));
+        ck_assert_int_eq(record.pc, records[r].pc);
+        ck_assert_int_eq(record.num_reg_writes, records[r].num_reg_writes);
+        for (int w = 0; w < record.num_reg_writes; w++) {
+            ck_assert_int_eq(record.reg_slot[w], records[r].reg_slot[w]);
+            ck_assert_int_eq(record.reg_value[w], records[r].reg_value[w]);
+        }
+        ck_assert_int_eq(record.mem_write, records[r].mem_write);
+        if (record.mem_write) {
+            ck_assert_int_eq(record.mem_address, records[r].mem_address);
+            ck_assert_int_eq(record.mem_value, records[r].mem_value);
+        }
+    }
+    TraceRecord extra;
+    ck_assert(!TraceRecord_read(file, &extra));
+    fclose(file);
+    InsnList_free(iloc);
+
+    /* replaying a simulator trace rebuilds the final machine state */
+    iloc = generate_program(
+        "int g; "
+        "def int f(int n) { if (n < 2) { return n; } return f(n-1) + f(n-2); } "
+        "def int main() { int i; i = 0; g = 0; "
+        "  while (i < 5) { g = g + f(i); i = i + 1; } return g * 3; }");
+    allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+    file = tmpfile();
+    SimulatorOptions options = { .output = ProgramOutput_new_memory() };
+    options.trace = TraceWriter_new(file, iloc, MEM_SIZE);
+    ILOCMachine* machine = ILOCMachine_new(iloc, &options);
+    SimulatorResult result;
+    ck_assert(ILOCMachine_run(machine, &result));
+    ck_assert_int_eq(result.return_value, 21);
+    long num_steps = options.trace->num_records;
+    TraceWriter_free(options.trace);
+    rewind(file);
+    TraceState* state = Trace_replay(file, -1);
+    ck_assert(state != NULL);
+    ck_assert_int_eq(state->step, num_steps);
+    Operand regs[] = { stack_register(), base_register(), return_register(),
+        physical_register(0), physical_register(1), physical_register(2) };
+    for (size_t r = 0; r < sizeof(regs) / sizeof(regs[0]); r++) {
+        ck_assert_int_eq(state->reg[ILOCMachine_reg_slot(regs[r])],
+                ILOCMachine_get_reg(machine, regs[r]));
+    }
+    ck_assert_int_eq(ILOCMemory_get(state->mem, STATIC_VAR_OFFSET), 7);
+    TraceState_free(state);
+    ILOCMachine_free(machine);
+    ProgramOutput_free(options.output);
+    fclose(file);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_large_program)
+{
+    /* far more instructions, registers, and labels than the old fixed tables held */
+    InsnList* iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    Operand sum = virtual_register();
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(0), sum));
+    for (int i = 0; i < 20000; i++) {
+        Operand next = virtual_register();
+        Operand label = anonymous_label();
+        InsnList_add(iloc, ILOCInsn_new_3op(ADD_I, sum, int_const(i % 7), next));
+        InsnList_add(iloc, ILOCInsn_new_1op(JUMP, label));
+        InsnList_add(iloc, ILOCInsn_new_1op(LABEL, label));
+        sum = next;
+    }
+    Operand far = { .type = VIRTUAL_REG, .id = 1000000 };
+    InsnList_add(iloc, ILOCInsn_new_2op(I2I, sum, far));
+    InsnList_add(iloc, ILOCInsn_new_2op(I2I, far, return_register()));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+
+    /* sum of i % 7 for i < 20000 */
+    int expected = 0;
+    for (int i = 0; i < 20000; i++) {
+        expected += i % 7;
+    }
+    ck_assert_int_eq(run_simulator(iloc, false), expected);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_paged_memory)
+{
+    ILOCMemory* mem = ILOCMemory_new(16 * MEM_PAGE_SIZE);
+    ck_assert_int_eq(ILOCMemory_get(mem, 5 * MEM_PAGE_SIZE), 0);
+    ck_assert(!ILOCMemory_is_mapped(mem, 5 * MEM_PAGE_SIZE));
+
+    /* a word that straddles pages 2 and 3 */
+    word_t straddle = 3 * MEM_PAGE_SIZE - 4;
+    ILOCMemory_set(mem, straddle, 0x1122334455667788L);
+    ck_assert_int_eq(ILOCMemory_get(mem, straddle), 0x1122334455667788L);
+    ck_assert_int_eq(ILOCMemory_get(mem, 3 * MEM_PAGE_SIZE), 0x11223344L);
+    ck_assert(ILOCMemory_is_mapped(mem, 2 * MEM_PAGE_SIZE));
+    ck_assert(ILOCMemory_is_mapped(mem, 3 * MEM_PAGE_SIZE));
+    ck_assert(!ILOCMemory_is_mapped(mem, 4 * MEM_PAGE_SIZE));
+
+    /* restoring a copy undoes later writes, including to new pages */
+    ILOCMemory* saved = ILOCMemory_copy(mem);
+    ILOCMemory_set(mem, straddle, -1);
+    ILOCMemory_set(mem, 9 * MEM_PAGE_SIZE + 8, 99);
+    ILOCMemory_restore(mem, saved, true);
+    ck_assert_int_eq(ILOCMemory_get(mem, straddle), 0x1122334455667788L);
+    ck_assert_int_eq(ILOCMemory_get(mem, 9 * MEM_PAGE_SIZE + 8), 0);
+    ILOCMemory_set(mem, 15 * MEM_PAGE_SIZE + 8, 5);
+    ILOCMemory_restore(mem, saved, false);
+    ck_assert_int_eq(ILOCMemory_get(mem, 15 * MEM_PAGE_SIZE + 8), 0);
+    ILOCMemory_free(saved);
+    ILOCMemory_free(mem);
+
+    /* the largest address space only costs the pages that are used */
+    InsnList* iloc = generate_program(
+        "def int f(int n) { if (n == 0) { return 0; } return n + f(n - 1); } "
+        "def int main() { return f(1000); }");
+    allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+    SimulatorOptions options = { .mem_size = MAX_MEM_SIZE };
+    SimulatorResult result;
+    ck_assert(run_simulator_with_result(iloc, &options, &result));
+    ck_assert_int_eq(result.return_value, 500500);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_unchecked_mode)
+{
+    /* R1 is read before it is written */
+    InsnList* iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(5), physical_register(0)));
+    InsnList_add(iloc, ILOCInsn_new_3op(MULT, physical_register(0), physical_register(1),
+                physical_register(2)));
+    InsnList_add(iloc, ILOCInsn_new_1op(PRINT, int_const(1)));
+    InsnList_add(iloc, ILOCInsn_new_2op(I2I, physical_register(0), return_register()));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+
+    const char* expected_output[] = {
+        "WARNING: Potential uninitialized read from register R1\n1", "1"
+    };
+    for (int unchecked = 0; unchecked <= 1; unchecked++) {
+        ProgramOutput* output = ProgramOutput_new_memory();
+        SimulatorOptions options = { .output = output, .unchecked = unchecked };
+        SimulatorResult result;
+        ck_assert(run_simulator_with_result(iloc, &options, &result));
+        ck_assert_int_eq(result.return_value, 5);
+        ck_assert_str_eq(ProgramOutput_contents(output), expected_output[unchecked]);
+        ProgramOutput_free(output);
+    }
+    InsnList_free(iloc);
+
+    /* allocated code for real programs behaves the same either way */
+    iloc = generate_program(
+        "int a[10]; "
+        "def int main() { int i; i = 0; "
+        "  while (i < 10) { a[i] = i * i; i = i + 1; } "
+        "  print_int(a[3] + a[9]); return a[7]; }");
+    allocate_registers(iloc, 3);
+    for (int unchecked = 0; unchecked <= 1; unchecked++) {
+        ProgramOutput* output = ProgramOutput_new_memory();
+        SimulatorOptions options = { .output = output, .unchecked = unchecked };
+        SimulatorResult result;
+        ck_assert(run_simulator_with_result(iloc, &options, &result));
+        ck_assert_int_eq(result.return_value, 49);
+        ck_assert_str_eq(ProgramOutput_contents(output), "90");
+        ProgramOutput_free(output);
+    }
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_superinstructions)
+{
+    /* every fused pair: comparisons before branches, global and array accesses, and calls with arguments */
+    char* text =
+        "int g; int a[20]; "
+        "def int f(int x) { return x * 3; } "
+        "def int main() { int i; int s; i = 0; s = 0; g = 4; "
+        "  while (i < 20) { a[i] = f(i) + g; i = i + 1; } "
+        "  i = 0; "
+        "  while (i <= 19) { "
+        "    if (a[i] == 10) { s = s + 1; } "
+        "    if (a[i] != 7)  { s = s + 2; } "
+        "    if (a[i] >= 40) { s = s + 3; } "
+        "    if (a[i] > 50)  { s = s + 4; } "
+        "    i = i + 1; } "
+        "  print_int(s); print_str(\" \"); print_int(g); "
+        "  return a[19] + s; }";
+
+    /* fusion is only done in unchecked mode, so compare against checked runs */
+    for (int allocate = 0; allocate <= 1; allocate++) {
+        InsnList* iloc = generate_program(text);
+        if (allocate) {
+            allocate_registers(iloc, 3);
+        }
+        for (int unchecked = 0; unchecked <= 1; unchecked++) {
+            ProgramOutput* output = ProgramOutput_new_memory();
+            SimulatorOptions options = { .output = output, .unchecked = unchecked };
+            SimulatorResult result;
+            ck_assert(run_simulator_with_result(iloc, &options, &result));
+            ck_assert_int_eq(result.return_value, 61 + 79);
+            ck_assert_str_eq(ProgramOutput_contents(output), "79 4");
+            ProgramOutput_free(output);
+        }
+        InsnList_free(iloc);
+    }
+}
+END_TEST
+
+/**
+ * @brief Output collected by @ref collect_output
+ */
+typedef struct CollectedOutput
+{
+    char data[4 * OUTPUT_BUFFER_SIZE];
+    size_t length;
+    int num_calls;
+} CollectedOutput;
+
+static void collect_output (void* context, const char* data, size_t length)
+{
+    CollectedOutput* collected = (CollectedOutput*)context;
+    memcpy(collected->data + collected->length, data, length);
+    collected->length += length;
+    collected->data[collected->length] = '\0';
+    collected->num_calls++;
+}
+
+START_TEST (A_program_output_sinks)
+{
+    /* in-memory sink */
+    ProgramOutput* output = ProgramOutput_new_memory();
+    ProgramOutput_write_str(output, "a=");
+    ProgramOutput_write_int(output, -42);
+    ProgramOutput_write_str(output, " min=");
+    ProgramOutput_write_int(output, INT64_MIN);
+    ck_assert_str_eq(ProgramOutput_contents(output), "a=-42 min=-9223372036854775808");
+    for (int i = 0; i < 3 * OUTPUT_BUFFER_SIZE / 10; i++) {
+        ProgramOutput_write_str(output, "0123456789");
+    }
+    const char* contents = ProgramOutput_contents(output);
+    ck_assert_int_eq(strlen(contents), 30 + 3 * OUTPUT_BUFFER_SIZE / 10 * 10);
+    ck_assert_str_eq(contents + strlen(contents) - 10, "0123456789");
+    ProgramOutput_free(output);
+
+    /* callback sink: called only on flush or when the buffer fills */
+    static CollectedOutput collected;
+    collected.length = 0;
+    collected.num_calls = 0;
+    output = ProgramOutput_new_callback(collect_output, &collected);
+    ck_assert(ProgramOutput_contents(output) == NULL);
+    ProgramOutput_write_str(output, "hi ");
+    ProgramOutput_write_int(output, 7);
+    ck_assert_int_eq(collected.num_calls, 0);
+    ProgramOutput_flush(output);
+    ck_assert_int_eq(collected.num_calls, 1);
+    ck_assert_str_eq(collected.data, "hi 7");
+    for (int i = 0; i < 2 * OUTPUT_BUFFER_SIZE / 10; i++) {
+        ProgramOutput_write_str(output, "abcdefghij");
+    }
+    ck_assert_int_gt(collected.num_calls, 1);
+    ProgramOutput_free(output);
+    ck_assert_int_eq(collected.length, 4 + 2 * OUTPUT_BUFFER_SIZE / 10 * 10);
+
+    /* a simulated program's PRINT output reaches the callback by the end of the run */
+    collected.length = 0;
+    collected.num_calls = 0;
+    output = ProgramOutput_new_callback(collect_output, &collected);
+    InsnList* iloc = generate_program(
+        "def int main() { int i; i = 0; "
+        "  while (i < 3) { print_int(i); print_str(\",\"); i = i + 1; } return i; }");
+    SimulatorOptions options = { .output = output };
+    ck_assert_int_eq(run_simulator_with_options(iloc, &options), 3);
+    ck_assert_str_eq(collected.data, "0,1,2,");
+    ProgramOutput_free(output);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_machine_snapshot_restore)
+{
+    InsnList* iloc = generate_program(
+        "int g; def int main() { g = g + 1; print_int(g); return g; }");
+    ProgramOutput* output = ProgramOutput_new_memory();
+    SimulatorOptions options = { .output = output };
+    ILOCMachine* machine = ILOCMachine_new(iloc, &options);
+    SimulatorResult result;
+
+    /* without a restore, the global keeps counting between runs */
+    ILOCSnapshot* initial = ILOCMachine_snapshot(machine);
+    ck_assert(ILOCMachine_run(machine, &result));
+    ck_assert_int_eq(result.return_value, 1);
+    ck_assert(ILOCMachine_run(machine, &result));
+    ck_assert_int_eq(result.return_value, 2);
+    ILOCSnapshot* after_two = ILOCMachine_snapshot(machine);
+
+    /* the most recent snapshot, then an older one */
+    ck_assert(ILOCMachine_run(machine, &result));
+    ck_assert_int_eq(result.return_value, 3);
+    ILOCMachine_restore(machine, after_two);
+    ck_assert(ILOCMachine_run(machine, &result));
+    ck_assert_int_eq(result.return_value, 3);
+    ILOCMachine_restore(machine, initial);
+    ck_assert(ILOCMachine_run(machine, &result));
+    ck_assert_int_eq(result.return_value, 1);
+
+    /* registers are part of the snapshot too */
+    ILOCMachine_restore(machine, initial);
+    word_t sp = ILOCMachine_get_reg(machine, stack_register());
+    ILOCMachine_set_reg(machine, stack_register(), sp - 64);
+    ILOCMachine_restore(machine, initial);
+    ck_assert_int_eq(ILOCMachine_get_reg(machine, stack_register()), sp);
+    ck_assert_str_eq(ProgramOutput_contents(output), "12331");
+
+    ILOCSnapshot_free(after_two);
+    ILOCSnapshot_free(initial);
+    ILOCMachine_free(machine);
+    ProgramOutput_free(output);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_y86_emulator)
+{
+    /* hand-written code */
+    char error[MAX_ERROR_LEN];
+    Y86Image* image = Y86Image_assemble(
+        "    irmovq $5, %rax\n"
+        "    irmovq $7, %rcx\n"
+        "    addq %rcx, %rax\n"
+        "    halt\n", error);
+    ck_assert(image != NULL);
+    ck_assert_int_eq(image->code_size, 10 + 10 + 2 + 1);
+    Y86Options options = { 0 };
+    Y86Result result;
+    ck_assert(Y86_run(image, &options, &result));
+    ck_assert_int_eq(result.status, Y86_HLT);
+    ck_assert_int_eq(result.return_value, 12);
+    ck_assert_int_eq(result.instructions, 4);
+    Y86Image_free(image);
+
+    /* invalid source and runtime faults */
+    ck_assert(Y86Image_assemble("    frobq %rax\n", error) == NULL);
+    ck_assert(strlen(error) > 0);
+    image = Y86Image_assemble(
+        "    irmovq $0x100000, %rdx\n"
+        "    mrmovq (%rdx), %rax\n"
+        "    halt\n", error);
+    ck_assert(!Y86_run(image, &options, &result));
+    ck_assert_int_eq(result.status, Y86_ADR);
+    Y86Image_free(image);
+    image = Y86Image_assemble("    nop\n    .byte 0xf0\n", error);
+    ck_assert(!Y86_run(image, &options, &result));
+    ck_assert_int_eq(result.status, Y86_INS);
+    ck_assert_int_eq(result.pc, 1);
+    Y86Image_free(image);
+
+    /* generated code behaves like the ILOC it came from */
+    char* programs[] = {
+        "def int main() { return 1 + 2 * 3 - 4; }",
+        "def int main() { int i; int s; i = 0; s = 0; "
+        "  while (i < 10) { s = s + i; i = i + 1; } print_int(s); print_str(\"!\"); return s; }",
+        "def int fib(int n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); } "
+        "def int main() { return fib(15); }",
+        "int a[8]; def int main() { int i; i = 0; "
+        "  while (i < 8) { a[i] = i * i; i = i + 1; } return a[3] + a[7]; }",
+        "def int main() { int x; x = -17; print_int(x / 5); print_int(x * -3); return x / 0; }",
+    };
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+        InsnList* iloc = generate_program(programs[p]);
+        allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+        assert_y86_matches_simulator(iloc);
+        InsnList_free(iloc);
+    }
+}
+END_TEST
+
+START_TEST (A_y86_builtin_mult_div)
+{
+    /* operands are loaded before a label so that the emitter cannot treat
+     * them as known constants and must call the helper routines (division by
+     * zero fails in both) */
+    word_t values[] = {
+        0, 1, -1, 2, -2, 3, -3, 7, -7, 10, -10, 1000003, -1000003,
+        INT32_MAX, INT32_MIN, 1L << 40, -(1L << 40), INT64_MAX, WORD_MIN, WORD_MIN + 1
+    };
+    int num_values = sizeof(values) / sizeof(values[0]);
+    for (int x = 0; x < num_values; x++) {
+        for (int y = 0; y < num_values; y++) {
+            for (int f = 0; f < 2; f++) {
+                InsnForm form = (f == 0 ? MULT : DIV);
+                if (form == DIV && values[x] == WORD_MIN && values[y] == -1) {
+                    continue;   /* overflows (the simulator reports an error) */
+                }
+                InsnList* iloc = InsnList_new();
+                InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+                InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(values[x]), physical_register(0)));
+                InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(values[y]), physical_register(1)));
+                InsnList_add(iloc, ILOCInsn_new_1op(LABEL, anonymous_label()));
+                InsnList_add(iloc, ILOCInsn_new_3op(form, physical_register(0), physical_register(1),
+                            return_register()));
+                InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+                assert_y86_matches_simulator(iloc);
+                InsnList_free(iloc);
+            }
+        }
+    }
+}
+END_TEST
+
+/**
+ * @brief Build "return x * c" for a value of x that the Y86 emitter does not know
+ */
+static InsnList* mult_const_program (word_t x, long c)
+{
+    InsnList* iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(x), physical_register(0)));
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, anonymous_label()));
+    InsnList_add(iloc, ILOCInsn_new_3op(MULT_I, physical_register(0), int_const(c), return_register()));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    return iloc;
+}
+
+/**
+ * @brief Count the additions and subtractions in the Y86 code for "x * c"
+ */
+static int count_mult_const_ops (long c)
+{
+    InsnList* iloc = mult_const_program(3, c);
+    static char text[MAX_FILE_SIZE];
+    FILE* stream = tmpfile();
+    emit_y86(iloc, stream);
+    rewind(stream);
+    text[fread(text, 1, MAX_FILE_SIZE - 1, stream)] = '\0';
+    fclose(stream);
+    int count = 0;
+    for (char* p = text; (p = strstr(p, "q ")) != NULL; p++) {
+        count += (strncmp(p - 3, "add", 3) == 0 || strncmp(p - 3, "sub", 3) == 0);
+    }
+    InsnList_free(iloc);
+    return count;
+}
+
+START_TEST (A_y86_mult_const)
+{
+    /* doublings plus one addition or subtraction per nonzero digit after the
+     * first, using non-adjacent form only when it gives a shorter chain */
+    int base = count_mult_const_ops(1);
+    ck_assert_int_eq(count_mult_const_ops(2) - base, 1);
+    ck_assert_int_eq(count_mult_const_ops(64) - base, 6);
+    ck_assert_int_eq(count_mult_const_ops(5) - base, 2 + 1);         /* 101 */
+    ck_assert_int_eq(count_mult_const_ops(7) - base, 2 + 2);         /* 111 (tie) */
+    ck_assert_int_eq(count_mult_const_ops(15) - base, 4 + 1);        /* 1000(-1) */
+    ck_assert_int_eq(count_mult_const_ops(255) - base, 8 + 1);       /* 10000000(-1) */
+    ck_assert_int_eq(count_mult_const_ops(0x5555) - base, 14 + 7);   /* 0101...01 */
+    ck_assert_int_eq(count_mult_const_ops(0x7fff) - base, 15 + 1);
+
+    /* every constant gives the right product */
+    word_t xs[] = { 0, 1, -1, 12345, -987654321, INT64_MAX, WORD_MIN };
+    long cs[] = { 0, 1, -1, 2, -2, 3, -3, 5, 7, -7, 15, -15, 100, 255, -256, 0x5555, 0x7fff,
+                  1000000007, -(1L << 40), INT64_MAX, INT64_MIN };
+    for (size_t x = 0; x < sizeof(xs) / sizeof(xs[0]); x++) {
+        for (size_t c = 0; c < sizeof(cs) / sizeof(cs[0]); c++) {
+            InsnList* iloc = mult_const_program(xs[x], cs[c]);
+            assert_y86_matches_simulator(iloc);
+            InsnList_free(iloc);
+        }
+    }
+}
+END_TEST
+
+START_TEST (A_y86_stale_constant)
+{
+    /* r2 holds the constant 5 (copied from r1) until one of these redefines
+     * it; multiplying by a stale 5 afterwards would give the wrong product */
+    for (int redefinition = 0; redefinition < 6; redefinition++) {
+        InsnList* iloc = InsnList_new();
+        InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+        InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(3), physical_register(0)));
+        InsnList_add(iloc, ILOCInsn_new_1op(LABEL, anonymous_label()));
+        InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(5), physical_register(1)));
+        InsnList_add(iloc, ILOCInsn_new_2op(I2I, physical_register(1), physical_register(2)));
+        switch (redefinition) {
+            case 0:     /* the source of the copy changes, but not the copy */
+                InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(7), physical_register(1)));
+                break;
+            case 1:     /* copy of a register with an unknown value */
+                InsnList_add(iloc, ILOCInsn_new_2op(I2I, physical_register(0), physical_register(2)));
+                break;
+            case 2:     /* arithmetic on the constant itself */
+                InsnList_add(iloc, ILOCInsn_new_3op(ADD_I, physical_register(2), int_const(1),
+                            physical_register(2)));
+                break;
+            case 3:
+                InsnList_add(iloc, ILOCInsn_new_2op(NEG, physical_register(2), physical_register(2)));
+                break;
+            case 4:     /* popped from the stack */
+                InsnList_add(iloc, ILOCInsn_new_1op(PUSH, physical_register(0)));
+                InsnList_add(iloc, ILOCInsn_new_1op(POP, physical_register(2)));
+                break;
+            case 5:     /* loaded from memory */
+                InsnList_add(iloc, ILOCInsn_new_1op(PUSH, physical_register(0)));
+                InsnList_add(iloc, ILOCInsn_new_3op(LOAD_AI, stack_register(), int_const(0),
+                            physical_register(2)));
+                InsnList_add(iloc, ILOCInsn_new_1op(POP, physical_register(3)));
+                break;
+        }
+        InsnList_add(iloc, ILOCInsn_new_3op(MULT, physical_register(0), physical_register(2),
+                    physical_register(3)));
+        InsnList_add(iloc, ILOCInsn_new_3op(MULT, physical_register(2), physical_register(1),
+                    return_register()));
+        InsnList_add(iloc, ILOCInsn_new_3op(ADD, physical_register(3), return_register(),
+                    return_register()));
+        InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+        assert_y86_matches_simulator(iloc);
+        InsnList_free(iloc);
+    }
+}
+END_TEST
+
+START_TEST (A_y86_peephole)
+{
+    char* text =
+        "_start:\n"
+        "    irmovq $1, %rbx\n"
+        "    irmovq $0x800, %rsp\n"
+        "    irmovq $%d, %rcx\n"
+        "    irmovq $%d, %rdx\n"
+        "    call main\n"
+        "    halt\n"
+        "main:\n"
+        "    rrmovq %rcx, %rcx\n"          /* self-move */
+        "    irmovq $99, %r9\n"            /* dead write */
+        "    irmovq $-1, %r8\n"            /* add -1 */
+        "    addq %r8, %rdx\n"
+        "    xorq %r8, %r8\n"              /* compare-and-branch */
+        "    rrmovq %rcx, %r9\n"
+        "    subq %rdx, %r9\n"
+        "    cmovl %rbx, %r8\n"
+        "    rrmovq %r8, %r10\n"
+        "    andq %r10, %r10\n"
+        "    jne L1\n"                     /* jump over a jump */
+        "    jmp L4\n"
+        "L1:\n"
+        "    irmovq $7, %rax\n"
+        "    jmp L3\n"
+        "L4:\n"
+        "    irmovq $9, %rax\n"
+        "    jmp L3\n"                     /* jump to the next line */
+        "L3:\n"
+        "    ret\n";
+    int inputs[][3] = { { 2, 10, 7 }, { 5, 3, 9 }, { 4, 5, 9 } };
+    for (int t = 0; t < 3; t++) {
+        char original[MAX_LINE_LEN * 32];
+        snprintf(original, sizeof(original), text, inputs[t][0], inputs[t][1]);
+        char* optimized = optimize_y86(original);
+        ck_assert(strstr(optimized, "rrmovq %rcx, %rcx") == NULL);
+        ck_assert(strstr(optimized, "irmovq $99") == NULL);
+        ck_assert(strstr(optimized, "irmovq $-1") == NULL);
+        ck_assert(strstr(optimized, "subq %rbx, %rdx") != NULL);
+        ck_assert(strstr(optimized, "andq") == NULL);
+        ck_assert(strstr(optimized, "jne") == NULL);
+        ck_assert(strstr(optimized, "jge L4") != NULL);
+        ck_assert(strstr(optimized, "jmp L4") == NULL);
+        ck_assert(strstr(strstr(optimized, "jmp L3") + 1, "jmp L3") == NULL);
+
+        /* same result in fewer instructions */
+        char error[MAX_ERROR_LEN];
+        Y86Image* before = Y86Image_assemble(original, error);
+        Y86Image* after = Y86Image_assemble(optimized, error);
+        Y86Options options = { 0 };
+        Y86Result before_result, after_result;
+        ck_assert(Y86_run(before, &options, &before_result));
+        ck_assert(Y86_run(after, &options, &after_result));
+        ck_assert_int_eq(before_result.return_value, inputs[t][2]);
+        ck_assert_int_eq(after_result.return_value, inputs[t][2]);
+        ck_assert_int_gt(before_result.instructions, after_result.instructions);
+        Y86Image_free(before);
+        Y86Image_free(after);
+        free(optimized);
+    }
+}
+END_TEST
+
+/**
+ * @brief Read the little-endian word at an address of a Y86 image
+ */
+static int64_t y86_image_word (Y86Image* image, int64_t address)
+{
+    uint64_t value = 0;
+    for (int b = WORD_SIZE - 1; b >= 0; b--) {
+        value = (value << 8) | image->bytes[address + b];
+    }
+    return (int64_t)value;
+}
+
+START_TEST (A_y86_memory_layout)
+{
+    InsnList* iloc = generate_program(
+        "int a[300]; "
+        "def int main() { int i; int s; i = 0; s = 0; "
+        "  while (i < 300) { a[i] = i; i = i + 1; } "
+        "  i = 0; while (i < 300) { s = s + a[i]; i = i + 1; } "
+        "  print_str(\"sum of a long enough array to need its own string section: \"); "
+        "  print_int(s); return s; }");
+    allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+    long static_size = 300 * WORD_SIZE;
+
+    /* code follows the globals ("jmp _start" at zero, then "irmovq _stack, %rsp"
+     * after the first instruction of _start), and the default stack top
+     * leaves room above everything else */
+    Y86Image* image = assemble_y86(iloc, static_size, 0, NULL);
+    int64_t code_addr = y86_image_word(image, 1);
+    int64_t stack_top = y86_image_word(image, code_addr + 10 + 2);
+    ck_assert_int_eq(code_addr, STATIC_VAR_OFFSET + static_size);
+    ck_assert_int_gt(image->size, code_addr + image->code_size);
+    ck_assert(stack_top >= image->size + Y86_MIN_STACK_SIZE);
+    ck_assert(stack_top % 0x100 == 0);
+    Y86Image_free(image);
+
+    /* an explicit stack top is used as given */
+    image = assemble_y86(iloc, static_size, 0x8000, NULL);
+    ck_assert_int_eq(y86_image_word(image, code_addr + 10 + 2), 0x8000);
+    Y86Image_free(image);
+
+    /* a small program keeps the default stack top */
+    InsnList* small = generate_program("def int main() { return 4; }");
+    allocate_registers(small, DEFAULT_NUM_REGISTERS);
+    image = assemble_y86(small, 0, 0, NULL);
+    ck_assert_int_eq(y86_image_word(image, 1), STATIC_VAR_OFFSET);
+    ck_assert_int_eq(y86_image_word(image, STATIC_VAR_OFFSET + 10 + 2), Y86_DEFAULT_STACK_TOP);
+    Y86Image_free(image);
+    InsnList_free(small);
+
+    /* the globals, code, and strings do not overlap when run */
+    ProgramOutput* output = ProgramOutput_new_memory();
+    Y86Options options = { .mem_size = Y86_TEST_MEM_SIZE, .output = output,
+                           .static_size = static_size };
+    Y86Result result;
+    ck_assert(run_y86(iloc, &options, &result));
+    ck_assert_int_eq(result.return_value, 299 * 300 / 2);
+    ck_assert_str_eq(ProgramOutput_contents(output),
+            "sum of a long enough array to need its own string section: 44850");
+    ProgramOutput_free(output);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_y86_listing_and_image)
+{
+    /* the .yo format of the CS:APP assembler */
+    char error[MAX_ERROR_LEN];
+    char listing[MAX_FILE_SIZE];
+    FILE* stream = tmpfile();
+    Y86Image* image = Y86Image_assemble_with_listing(
+        "    irmovq $1, %rbx\n"
+        "loop:\n"
+        "    jmp loop\n", stream, error);
+    rewind(stream);
+    listing[fread(listing, 1, MAX_FILE_SIZE - 1, stream)] = '\0';
+    fclose(stream);
+    ck_assert_str_eq(listing,
+        "0x000: 30f30100000000000000 |     irmovq $1, %rbx\n"
+        "0x00a:                      | loop:\n"
+        "0x00a: 700a00000000000000   |     jmp loop\n");
+    Y86Image_free(image);
+
+    /* the listing of a generated program describes exactly the bytes of its
+     * image, and the raw image is those bytes */
+    InsnList* iloc = generate_program(
+        "def int fact(int n) { if (n <= 1) { return 1; } return n * fact(n - 1); } "
+        "def int main() { print_str(\"5! = \"); print_int(fact(5)); return 0; }");
+    allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+    stream = tmpfile();
+    image = assemble_y86(iloc, 0, 0, stream);
+    rewind(stream);
+    byte_t* bytes = (byte_t*)calloc(image->size, 1);
+    char line[MAX_LINE_LEN];
+    while (fgets(line, sizeof(line), stream) != NULL) {
+        ck_assert(strlen(line) > 28 && line[28] == '|');
+        unsigned long address;
+        char hex[MAX_LINE_LEN];
+        if (sscanf(line, "0x%lx: %[0-9a-f] |", &address, hex) == 2) {
+            for (size_t i = 0; i < strlen(hex) / 2; i++) {
+                unsigned int value;
+                sscanf(hex + 2 * i, "%2x", &value);
+                ck_assert(address + i < (unsigned long)image->size);
+                bytes[address + i] = (byte_t)value;
+            }
+        }
+    }
+    fclose(stream);
+    ck_assert(memcmp(bytes, image->bytes, image->size) == 0);
+
+    stream = tmpfile();
+    ck_assert(Y86Image_write(image, stream));
+    ck_assert_int_eq(ftell(stream), image->size);
+    rewind(stream);
+    ck_assert_int_eq(fread(bytes, 1, image->size, stream), image->size);
+    ck_assert(memcmp(bytes, image->bytes, image->size) == 0);
+    fclose(stream);
+    free(bytes);
+    Y86Image_free(image);
+    InsnList_free(iloc);
+}
+END_TEST
+
+/**
+ * @brief Build a program as native x86-64 code with the system compiler, run
+ * it, and check that it prints the same output as the simulator and exits
+ * with the low byte of the simulator's return value (or prints the same error
+ * message and exits with a failure status)
+ */
+static void assert_native_matches_simulator (InsnList* iloc, long static_size)
+{
+    FILE* assembly = fopen("x86_64_test.s", "w");
+    ck_assert(assembly != NULL);
+    emit_x86_64(iloc, static_size, assembly);
+    fclose(assembly);
+    ck_assert_int_eq(system("gcc -o x86_64_test x86_64_test.s && "
+                            "{ ./x86_64_test > x86_64_test.out; echo \" $?\" >> x86_64_test.out; }"), 0);
+    char native[MAX_FILE_SIZE];
+    FILE* result_file = fopen("x86_64_test.out", "r");
+    ck_assert(result_file != NULL);
+    native[fread(native, 1, MAX_FILE_SIZE - 1, result_file)] = '\0';
+    fclose(result_file);
+    remove("x86_64_test.s");
+    remove("x86_64_test");
+    remove("x86_64_test.out");
+
+    ProgramOutput* output = ProgramOutput_new_memory();
+    SimulatorOptions options = { .output = output };
+    SimulatorResult result;
+    char expected[MAX_FILE_SIZE];
+    if (run_simulator_with_result(iloc, &options, &result)) {
+        snprintf(expected, sizeof(expected), "%s %d\n", ProgramOutput_contents(output),
+                (int)(result.return_value & 0xff));
+    } else {
+        snprintf(expected, sizeof(expected), "%s%s\n %d\n", ProgramOutput_contents(output),
+                result.message, EXIT_FAILURE);
+    }
+    ck_assert_str_eq(native, expected);
+    ProgramOutput_free(output);
+}
+
+START_TEST (A_x86_64_backend)
+{
+    if (system("gcc --version > /dev/null 2>&1") != 0) {
+        return;     /* no system toolchain to assemble with */
+    }
+    struct {
+        char* text;
+        long static_size;
+        int num_registers;
+    } programs[] = {
+        { "def int main() { return 1 + 2 * 3 - 4; }", 0, X86_64_NUM_REGS },
+        { "def int fib(int n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); } "
+          "def int main() { print_int(fib(20)); return fib(12); }", 0, X86_64_NUM_REGS },
+        { "int a[50]; int total; "
+          "def void fill(int n) { int i; i = 0; while (i < n) { a[i] = i * i - 7; i = i + 1; } } "
+          "def int main() { int i; fill(50); i = 0; "
+          "  while (i < 50) { total = total + a[i] / 3; i = i + 1; } "
+          "  print_str(\"total \"); print_int(total); print_bool(total > 0); return total; }",
+          51 * WORD_SIZE, X86_64_NUM_REGS },
+        { "def int main() { int a; int b; int c; int d; int e; int f; "
+          "  a = 1; b = 2; c = 3; d = 4; e = 5; f = 6; "
+          "  print_int(-17 / 5); print_int(a * b + c * d - e * f); "
+          "  return (a + b) * (c + d) * (e + f); }", 0, 3 },
+        { "def int main() { int z; z = 0; print_int(5); return 7 / z; }", 0, 3 },
+        { "def int main() { int x; int i; x = 1; i = 0; "
+          "  while (i < 63) { x = x * 2; i = i + 1; } "
+          "  print_int(x / 3); print_int(x / 1); print_int(i / (0-1)); return x / (0-1); }", 0, 3 },
+    };
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+        InsnList* iloc = generate_program(programs[p].text);
+        allocate_registers(iloc, programs[p].num_registers);
+        assert_native_matches_simulator(iloc, programs[p].static_size);
+        InsnList_free(iloc);
+    }
+}
+END_TEST
+
+START_TEST (A_jit_matches_simulator)
+{
+    const char* inputs[] = {
+        "inputs/2regs.decaf", "inputs/3regs.decaf", "inputs/add.decaf",
+        "inputs/assgn.decaf", "inputs/cond.decaf", "inputs/fib.decaf",
+        "inputs/funccall.decaf", "inputs/gcd.decaf", "inputs/mult_assgn.decaf",
+        "inputs/p0.decaf", "inputs/sanity.decaf", "inputs/test.decaf"
+    };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        InsnList* iloc = generate_program_file(inputs[i]);
+        ck_assert(iloc != NULL);
+        allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+        assert_jit_matches_simulator(iloc);
+        InsnList_free(iloc);
+    }
+
+    /* runtime errors end both runs the same way (after the same output) */
+    char* errors[] = {
+        "def int f(int n) { return f(n+1); } "
+        "def int main() { print_int(7); return f(0); }",
+        "int a[10]; "
+        "def int main() { print_str(\"x\"); a[100000000] = 1; return 0; }",
+        "def int main() { int z; z = 0; return 7 / z; }",
+        "def int main() { int x; int i; x = 1; i = 0; "
+        "  while (i < 63) { x = x * 2; i = i + 1; } "
+        "  print_int(x); return x / (0-1); }"
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        InsnList* iloc = generate_program(errors[i]);
+        ck_assert(iloc != NULL);
+        assert_jit_matches_simulator(iloc);
+        InsnList_free(iloc);
+    }
+
+    /* like the unchecked simulator, native runs do not warn about reads from
+     * uninitialized registers */
+    InsnList* iloc = InsnList_new();
+    InsnList_add(iloc, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(iloc, ILOCInsn_new_1op(PRINT, physical_register(1)));
+    InsnList_add(iloc, ILOCInsn_new_2op(LOAD_I, int_const(4), return_register()));
+    InsnList_add(iloc, ILOCInsn_new_0op(RETURN));
+    ProgramOutput* checked_output = ProgramOutput_new_memory();
+    ProgramOutput* unchecked_output = ProgramOutput_new_memory();
+    ProgramOutput* jit_output = ProgramOutput_new_memory();
+    SimulatorOptions checked = { .output = checked_output };
+    SimulatorOptions unchecked = { .output = unchecked_output, .unchecked = true };
+    SimulatorOptions native = { .output = jit_output };
+    SimulatorResult result;
+    ck_assert(run_simulator_with_result(iloc, &checked, &result));
+    ck_assert(run_simulator_with_result(iloc, &unchecked, &result));
+    ck_assert(run_jit_with_result(iloc, &native, &result));
+    ck_assert_int_eq(result.return_value, 4);
+    ck_assert(strstr(ProgramOutput_contents(checked_output), "WARNING") != NULL);
+    ck_assert(strstr(ProgramOutput_contents(unchecked_output), "WARNING") == NULL);
+    ck_assert_str_eq(ProgramOutput_contents(jit_output), ProgramOutput_contents(unchecked_output));
+    ProgramOutput_free(checked_output);
+    ProgramOutput_free(unchecked_output);
+    ProgramOutput_free(jit_output);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_profile_loop_trips)
+{
+    /* two entries into a loop that runs five times each time */
+    InsnList* iloc = generate_program(
+        "def int f() { int i; i = 0; while (i < 5) { i = i + 1; } return i; } "
+        "def int main() { return f() + f(); }");
+    allocate_registers(iloc, DEFAULT_NUM_REGISTERS);
+    ILOCProfile* profile = ILOCProfile_new(iloc);
+    SimulatorOptions options = { .profile = profile };
+    ck_assert_int_eq(run_simulator_with_options(iloc, &options), 10);
+
+    FILE* report = tmpfile();
+    ILOCProfile_print_report(profile, report);
+    rewind(report);
+    char line[MAX_LINE_LEN] = "";
+    while (strcmp(line, "Loops:\n") != 0 && fgets(line, MAX_LINE_LEN, report) != NULL);
+    ck_assert(fgets(line, MAX_LINE_LEN, report) != NULL);     /* column headings */
+    char function[MAX_LINE_LEN];
+    int header;
+    long iterations, entries;
+    double trips;
+    ck_assert(fgets(line, MAX_LINE_LEN, report) != NULL);
+    ck_assert_int_eq(sscanf(line, "%s %d %ld %ld %lf",
+                function, &header, &iterations, &entries, &trips), 5);
+    ck_assert_str_eq(function, "f");
+    ck_assert_int_eq(iterations, 10);
+    ck_assert_int_eq(entries, 2);
+    ck_assert(trips == 5.0);
+    fclose(report);
+    ILOCProfile_free(profile);
+    InsnList_free(iloc);
+}
+END_TEST
+
+START_TEST (A_batch_failing_jobs)
+{
+    /* a malformed program (calls a function that does not exist) */
+    InsnList* malformed = InsnList_new();
+    InsnList_add(malformed, ILOCInsn_new_1op(LABEL, call_label("main")));
+    InsnList_add(malformed, ILOCInsn_new_1op(CALL, call_label("missing")));
+    InsnList_add(malformed, ILOCInsn_new_0op(RETURN));
+
+    InsnList* programs[] = {
+        generate_program("def int main() { print_int(1); return 10; }"),
+        malformed,
+        generate_program("def int main() { int z; z = 0; print_str(\"a\"); return 7 / z; }"),
+        generate_program("def int main() { while (true) { } return 0; }"),
+        generate_program("def int main() { print_str(\"ok\"); return 20; }")
+    };
+    BatchJob jobs[5];
+    memset(jobs, 0, sizeof(jobs));
+    for (int j = 0; j < 5; j++) {
+        ck_assert(programs[j] != NULL);
+        jobs[j].program = programs[j];
+        jobs[j].options.unchecked = true;
+    }
+    run_batch(jobs, 5, 3);
+
+    ck_assert_int_eq(jobs[0].result.status, SIM_OK);
+    ck_assert_int_eq(jobs[0].result.return_value, 10);
+    ck_assert_str_eq(jobs[0].output, "1");
+
+    ck_assert_int_eq(jobs[1].result.status, SIM_ERROR);
+    ck_assert_str_eq(jobs[1].result.message, "ERROR: No call target found for 'missing'");
+    ck_assert_str_eq(jobs[1].output, "");
+
+    ck_assert_int_eq(jobs[2].result.status, SIM_ERROR);
+    ck_assert_str_eq(jobs[2].result.message, "ERROR: Division by zero");
+    ck_assert_str_eq(jobs[2].output, "a");
+
+    ck_assert_int_eq(jobs[3].result.status, SIM_TIMEOUT);
+    ck_assert_str_eq(jobs[3].output, "");
+
+    ck_assert_int_eq(jobs[4].result.status, SIM_OK);
+    ck_assert_int_eq(jobs[4].result.return_value, 20);
+    ck_assert_str_eq(jobs[4].output, "ok");
+
+    for (int j = 0; j < 5; j++) {
+        BatchJob_free_output(&jobs[j]);
+        InsnList_free(programs[j]);
+    }
+}
+END_TEST
+
 #endif
 
 /**
@@ -72,6 +1376,33 @@ void public_tests (Suite *s)
     TEST(B_func_call);
     TEST(B_spilled_regs);
 
+    TEST(A_remat_constant);
+    TEST(A_parallel_allocation);
+    TEST(A_spill_in_loop);
+    TEST(A_renumber_per_function);
+    TEST(A_regalloc_stats_csv);
+    TEST(A_decoded_instruction_semantics);
+    TEST(A_verify_rejects_malformed);
+    TEST(A_call_target_table);
+    TEST(A_trace_round_trip);
+    TEST(A_large_program);
+    TEST(A_paged_memory);
+    TEST(A_unchecked_mode);
+    TEST(A_superinstructions);
+    TEST(A_program_output_sinks);
+    TEST(A_machine_snapshot_restore);
+    TEST(A_y86_emulator);
+    TEST(A_y86_builtin_mult_div);
+    TEST(A_y86_mult_const);
+    TEST(A_y86_stale_constant);
+    TEST(A_y86_peephole);
+    TEST(A_y86_memory_layout);
+    TEST(A_y86_listing_and_image);
+    TEST(A_x86_64_backend);
+    TEST(A_jit_matches_simulator);
+    TEST(A_profile_loop_trips);
+    TEST(A_batch_failing_jobs);
+
     suite_add_tcase (s, tc);
 }
 
@@ -12,26 +12,94 @@ int run_program (char* text)
     return run_program_with_allocation(text, DEFAULT_NUM_REGISTERS);
 }
 
-int run_program_with_allocation (char* text, int num_registers)
+InsnList* generate_program (char* text)
 {
     ASTNode* tree = NULL;
     if (setjmp(decaf_error) == 0) {
         /* no error */
         tree = parse(lex(text));
     } else {
-        /* parsing error; return code */
-        return ERROR_RETURN_CODE;
+        /* parsing error */
+        return NULL;
     }
     NodeVisitor_traverse_and_free(SetParentVisitor_new(), tree);
     NodeVisitor_traverse_and_free(CalcDepthVisitor_new(), tree);
     NodeVisitor_traverse_and_free(BuildSymbolTablesVisitor_new(), tree);
     ErrorList* errors = analyze(tree);
     if (!ErrorList_is_empty(errors)) {
-        /* static analysis error; return code */
-        return ERROR_RETURN_CODE;
+        /* static analysis error */
+        return NULL;
     }
     NodeVisitor_traverse_and_free(AllocateSymbolsVisitor_new(), tree);
-    InsnList* iloc = generate_code(tree);
+    return generate_code(tree);
+}
+
+InsnList* generate_program_file (const char* filename)
+{
+    FILE* input = fopen(filename, "r");
+    if (input == NULL) {
+        return NULL;
+    }
+    char text[MAX_FILE_SIZE];
+    size_t nchars = fread(text, 1, MAX_FILE_SIZE - 1, input);
+    text[nchars] = '\0';
+    fclose(input);
+    return generate_program(text);
+}
+
+void assert_jit_matches_simulator (InsnList* iloc)
+{
+    ProgramOutput* sim_output = ProgramOutput_new_memory();
+    ProgramOutput* jit_output = ProgramOutput_new_memory();
+    SimulatorOptions sim_options = { .output = sim_output };
+    SimulatorOptions jit_options = { .output = jit_output };
+    SimulatorResult sim_result, jit_result;
+    bool sim_success = run_simulator_with_result(iloc, &sim_options, &sim_result);
+    bool jit_success = run_jit_with_result(iloc, &jit_options, &jit_result);
+    ck_assert_int_eq(jit_success, sim_success);
+    ck_assert_int_eq(jit_result.status, sim_result.status);
+    ck_assert_int_eq(jit_result.return_value, sim_result.return_value);
+    ck_assert_str_eq(jit_result.message, sim_result.message);
+    ck_assert_str_eq(ProgramOutput_contents(jit_output), ProgramOutput_contents(sim_output));
+    ProgramOutput_free(sim_output);
+    ProgramOutput_free(jit_output);
+}
+
+void assert_y86_matches_simulator (InsnList* iloc)
+{
+    ProgramOutput* sim_output = ProgramOutput_new_memory();
+    ProgramOutput* y86_output = ProgramOutput_new_memory();
+    SimulatorOptions sim_options = { .output = sim_output };
+    Y86Options y86_options = { .mem_size = Y86_TEST_MEM_SIZE, .output = y86_output,
+                               .static_size = Y86_DEFAULT_STATIC_SIZE };
+    SimulatorResult sim_result;
+    Y86Result y86_result;
+    bool sim_success = run_simulator_with_result(iloc, &sim_options, &sim_result);
+    bool y86_success = run_y86(iloc, &y86_options, &y86_result);
+    ck_assert_int_eq(y86_success, sim_success);
+    if (sim_success) {
+        ck_assert_int_eq(y86_result.return_value, sim_result.return_value);
+        ck_assert_str_eq(ProgramOutput_contents(y86_output), ProgramOutput_contents(sim_output));
+    }
+    ProgramOutput_free(sim_output);
+    ProgramOutput_free(y86_output);
+}
+
+void assert_rejected (InsnList* iloc, const char* problem)
+{
+    char message[MAX_ERROR_LEN];
+    ck_assert(!check_program(iloc, message));
+    ck_assert(strstr(message, problem) != NULL);
+    InsnList_free(iloc);
+}
+
+int run_program_with_allocation (char* text, int num_registers)
+{
+    InsnList* iloc = generate_program(text);
+    if (iloc == NULL) {
+        /* parsing or static analysis error; return code */
+        return ERROR_RETURN_CODE;
+    }
     allocate_registers(iloc, num_registers);
     FOR_EACH (ILOCInsn*, insn, iloc) {
         for (int i = 0; i < 3; i++) {
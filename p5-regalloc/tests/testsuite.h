@@ -17,12 +17,26 @@
 #include "p3-analysis.h"
 #include "p4-codegen.h"
 #include "p5-regalloc.h"
+#include "output.h"
+#include "jit.h"
+#include "profile.h"
+#include "batch.h"
+#include "trace.h"
+#include "y86.h"
+#include "y86sim.h"
+#include "y86opt.h"
+#include "x86_64.h"
 
 /**
  * @brief Number of physical registers for most tests
  */
 #define DEFAULT_NUM_REGISTERS 4
 
+/**
+ * @brief Address space size for Y86 runs in tests (room for deep recursion)
+ */
+#define Y86_TEST_MEM_SIZE 0x10000
+
 /**
  * @brief Return value indicating an error
  */
@@ -92,6 +106,48 @@ END_TEST
  */
 int run_program (char* text);
 
+/**
+ * @brief Run lexer, parser, analysis, and code generation on given program
+ *
+ * @param text Code to lex, parse, analyze, and generate
+ * @returns ILOC program (using virtual registers) or @c NULL if there was an error
+ */
+InsnList* generate_program (char* text);
+
+/**
+ * @brief Run lexer, parser, analysis, and code generation on a program file
+ *
+ * @param filename Path of the Decaf source file (relative to the tests folder)
+ * @returns ILOC program (using virtual registers) or @c NULL if there was an error
+ */
+InsnList* generate_program_file (const char* filename);
+
+/**
+ * @brief Run a program both natively (see @ref run_jit_with_result) and in the
+ * simulator and check that the runs end the same way with the same output
+ *
+ * @param iloc ILOC program
+ */
+void assert_jit_matches_simulator (InsnList* iloc);
+
+/**
+ * @brief Run a program as Y86 code (see @ref run_y86) and in the simulator and
+ * check that both runs succeed or fail together, and that successful runs
+ * return the same value with the same output
+ *
+ * @param iloc ILOC program (using only physical registers R0-R3)
+ */
+void assert_y86_matches_simulator (InsnList* iloc);
+
+/**
+ * @brief Check that a malformed program is rejected by @ref check_program
+ * with a message that mentions the given problem
+ *
+ * @param iloc ILOC program (deallocated afterwards)
+ * @param problem Text that the error message must contain
+ */
+void assert_rejected (InsnList* iloc, const char* problem);
+
 /**
  * @brief Run lexer, parser, analysis, code generation, and register allocation on given program
  *